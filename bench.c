@@ -0,0 +1,403 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ * Benchmarks for the empack readers and writers.
+ *
+ * Every case encodes or decodes one "message" per call, where a message is
+ * either a single value (microbenchmarks) or one record from a generated
+ * corpus. Throughput comes from timing batches of messages; the latency
+ * percentiles come from timing BENCH_LATENCY_SAMPLES messages one at a
+ * time, less the clock's own overhead, so they show per-message tails down
+ * to the resolution of CLOCK_MONOTONIC. Results are printed as one JSON
+ * object per line:
+ *
+ *   {"bench":"skip_rpc","msgs":...,"bytes":...,"mb_s":...,"msgs_s":...,
+ *    "p50_ns":...,"p99_ns":...}
+ *
+ * Usage: ./bench [name-filter]
+ */
+
+#define _POSIX_C_SOURCE 199309L
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "em_buffer.h"
+#include "em_cursor.h"
+#include "empack.h"
+
+#ifndef BENCH_SAMPLES
+#define BENCH_SAMPLES 200
+#endif
+
+#ifndef BENCH_LATENCY_SAMPLES
+#define BENCH_LATENCY_SAMPLES 20000
+#endif
+
+#ifndef BENCH_MIN_SAMPLE_NS
+#define BENCH_MIN_SAMPLE_NS 200000
+#endif
+
+#define BENCH_BUFF_SIZE (1 << 20)
+#define BENCH_BLOB_SIZE (64 * 1024)
+
+static em_byte_t scratch[BENCH_BUFF_SIZE];
+static em_byte_t corpus[BENCH_BUFF_SIZE];
+static em_byte_t blob[BENCH_BLOB_SIZE];
+static volatile uint64_t sink;
+
+typedef size_t (*bench_fn)(void);
+
+struct bench_case {
+  const char* name;
+  bench_fn run;
+};
+
+static uint64_t bench_now_ns(void)
+{
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+}
+
+static int bench_cmp_double(const void* a, const void* b)
+{
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+// ======= Corpora ===== //
+
+static buffer_t out;
+static buffer_t in;
+static em_size_t corpus_size;
+
+static void corpus_rpc(buffer_t* b, uint32_t id)
+{
+  empack_write_map_start(b, 4);
+  empack_write_string(b, "id", 2);
+  empack_write_u32(b, id);
+  empack_write_string(b, "method", 6);
+  empack_write_string(b, "get_status", 10);
+  empack_write_string(b, "params", 6);
+  empack_write_array_start(b, 3);
+  empack_write_string(b, "sensor", 6);
+  empack_write_i16(b, -12);
+  empack_write_bool(b, true);
+  empack_write_string(b, "ts", 2);
+  empack_write_u64(b, 1537000000000ull + id);
+}
+
+static void corpus_wide_map(buffer_t* b, uint32_t id)
+{
+  char key[16];
+  empack_write_map_start(b, 256);
+  for (uint32_t i = 0; i < 256; i++) {
+    int n = snprintf(key, sizeof(key), "field_%03u", i);
+    empack_write_string(b, key, n);
+    empack_write_u32(b, id * i);
+  }
+}
+
+static void corpus_numeric_array(buffer_t* b, uint32_t id)
+{
+  empack_write_array_start(b, 1024);
+  for (uint32_t i = 0; i < 1024; i++) {
+    switch (i & 3) {
+    case 0:
+      empack_write_u8(b, i & 0x7F);
+      break;
+    case 1:
+      empack_write_i32(b, -(int32_t)(i * 977 + id));
+      break;
+    case 2:
+      empack_write_u64(b, (uint64_t)i << 33);
+      break;
+    default:
+      empack_write_float(b, i * 0.25f);
+      break;
+    }
+  }
+}
+
+static void corpus_deep_nesting(buffer_t* b, uint32_t id)
+{
+  for (int i = 0; i < 64; i++) {
+    empack_write_array_start(b, 2);
+    empack_write_u32(b, id + i);
+  }
+  empack_write_nil(b);
+}
+
+static void corpus_large_blob(buffer_t* b, uint32_t id)
+{
+  blob[0] = id;
+  empack_write_bin(b, blob, BENCH_BLOB_SIZE);
+}
+
+static void corpus_load(void (*gen)(buffer_t*, uint32_t))
+{
+  buffer_init(&out, corpus, BENCH_BUFF_SIZE);
+  gen(&out, 1);
+  corpus_size = out.max;
+}
+
+// ======= Corpus cases ===== //
+
+#define BENCH_ENCODE(name, gen)        \
+  static size_t bench_##name(void)     \
+  {                                    \
+    buffer_init(&out, scratch, BENCH_BUFF_SIZE); \
+    gen(&out, (uint32_t)sink++);       \
+    return out.max;                    \
+  }
+
+#define BENCH_DECODE(name, gen)                   \
+  static size_t bench_##name(void)                \
+  {                                               \
+    static bool loaded;                           \
+    static em_size_t size;                        \
+    static em_byte_t* data;                       \
+    if (!loaded) {                                \
+      corpus_load(gen);                           \
+      data = malloc(corpus_size);                 \
+      memcpy(data, corpus, corpus_size);          \
+      size = corpus_size;                         \
+      loaded = true;                              \
+    }                                             \
+    empack_type_t type;                           \
+    buffer_init(&in, data, size);                 \
+    sink += empack_next_skip(&in, &type);         \
+    return size;                                  \
+  }
+
+BENCH_ENCODE(encode_rpc, corpus_rpc)
+BENCH_ENCODE(encode_wide_map, corpus_wide_map)
+BENCH_ENCODE(encode_numeric_array, corpus_numeric_array)
+BENCH_ENCODE(encode_deep_nesting, corpus_deep_nesting)
+BENCH_ENCODE(encode_large_blob, corpus_large_blob)
+
+BENCH_DECODE(skip_rpc, corpus_rpc)
+BENCH_DECODE(skip_wide_map, corpus_wide_map)
+BENCH_DECODE(skip_numeric_array, corpus_numeric_array)
+BENCH_DECODE(skip_deep_nesting, corpus_deep_nesting)
+BENCH_DECODE(skip_large_blob, corpus_large_blob)
+
+static size_t bench_cursor_rpc(void)
+{
+  static em_byte_t data[256];
+  static em_size_t size;
+  if (size == 0) {
+    corpus_load(corpus_rpc);
+    memcpy(data, corpus, corpus_size);
+    size = corpus_size;
+  }
+
+  empack_cursor_t c;
+  uint32_t n;
+  uint64_t ts = 0;
+  buffer_init(&in, data, size);
+  empack_cursor_init(&c, &in);
+  empack_cursor_enter_map(&c, &n);
+  empack_cursor_find_key(&c, "ts", 2);
+  empack_cursor_read_uint(&c, &ts);
+  empack_cursor_leave(&c);
+  sink += ts;
+  return size;
+}
+
+// ======= Microbenchmarks ===== //
+
+#define BENCH_WRITE(name, op)          \
+  static size_t bench_##name(void)     \
+  {                                    \
+    buffer_init(&out, scratch, 64);    \
+    op;                                \
+    return out.max;                    \
+  }
+
+BENCH_WRITE(write_nil, empack_write_nil(&out))
+BENCH_WRITE(write_bool, empack_write_bool(&out, sink & 1))
+BENCH_WRITE(write_u8, empack_write_u8(&out, 0xC8))
+BENCH_WRITE(write_u16, empack_write_u16(&out, 0xC8C8))
+BENCH_WRITE(write_u32, empack_write_u32(&out, 0xC8C8C8C8))
+BENCH_WRITE(write_u64, empack_write_u64(&out, 0xC8C8C8C8C8C8ull))
+BENCH_WRITE(write_i8, empack_write_i8(&out, -100))
+BENCH_WRITE(write_i16, empack_write_i16(&out, -10000))
+BENCH_WRITE(write_i32, empack_write_i32(&out, -100000000))
+BENCH_WRITE(write_i64, empack_write_i64(&out, -10000000000ll))
+BENCH_WRITE(write_float, empack_write_float(&out, 3.25f))
+BENCH_WRITE(write_string, empack_write_string(&out, "temperature", 11))
+BENCH_WRITE(write_bin, empack_write_bin(&out, blob, 32))
+BENCH_WRITE(write_array_start, empack_write_array_start(&out, 1000))
+BENCH_WRITE(write_map_start, empack_write_map_start(&out, 1000))
+BENCH_WRITE(write_ext, empack_write_ext(&out, 7, blob, 12))
+BENCH_WRITE(write_timestamp, empack_write_timestamp(&out, 1537112576, 250))
+
+#define BENCH_READ(name, writer, reader)        \
+  static size_t bench_##name(void)              \
+  {                                             \
+    static em_byte_t data[64];                  \
+    static em_size_t size;                      \
+    if (size == 0) {                            \
+      buffer_init(&out, data, sizeof(data));    \
+      writer;                                   \
+      size = out.max;                           \
+    }                                           \
+    buffer_init(&in, data, size);               \
+    sink += reader;                             \
+    return size;                                \
+  }
+
+static uint64_t u;
+static int64_t i;
+static float f;
+static bool b;
+static uint32_t n;
+static char str[64];
+static int8_t ext_type;
+static int64_t sec;
+static uint32_t nsec;
+
+BENCH_READ(read_nil, empack_write_nil(&out), empack_read_nil(&in))
+BENCH_READ(read_bool, empack_write_bool(&out, true), empack_read_bool(&in, &b))
+BENCH_READ(read_uint, empack_write_u32(&out, 0xC8C8C8C8),
+    empack_read_uint(&in, (em_byte_t*)&u, 8))
+BENCH_READ(read_sint, empack_write_i32(&out, -100000000),
+    empack_read_sint(&in, (em_byte_t*)&i, 8))
+BENCH_READ(read_float, empack_write_float(&out, 3.25f), empack_read_float(&in, &f))
+BENCH_READ(read_string, empack_write_string(&out, "temperature", 11),
+    empack_read_string_sz(&in, str, sizeof(str), &n))
+BENCH_READ(read_bin, empack_write_bin(&out, blob, 32),
+    empack_read_bin_sz(&in, (em_byte_t*)str, sizeof(str), &n))
+BENCH_READ(read_array_size, empack_write_array_start(&out, 1000),
+    empack_read_array_size(&in, &n))
+BENCH_READ(read_map_size, empack_write_map_start(&out, 1000),
+    empack_read_map_size(&in, &n))
+BENCH_READ(read_ext, empack_write_ext(&out, 7, blob, 12),
+    empack_read_ext_sz(&in, &ext_type, (em_byte_t*)str, sizeof(str), &n))
+BENCH_READ(read_timestamp, empack_write_timestamp(&out, 1537112576, 250),
+    empack_read_timestamp(&in, &sec, &nsec))
+
+// ======= Runner ===== //
+
+static const struct bench_case cases[] = {
+  { "write_nil", bench_write_nil },
+  { "write_bool", bench_write_bool },
+  { "write_u8", bench_write_u8 },
+  { "write_u16", bench_write_u16 },
+  { "write_u32", bench_write_u32 },
+  { "write_u64", bench_write_u64 },
+  { "write_i8", bench_write_i8 },
+  { "write_i16", bench_write_i16 },
+  { "write_i32", bench_write_i32 },
+  { "write_i64", bench_write_i64 },
+  { "write_float", bench_write_float },
+  { "write_string", bench_write_string },
+  { "write_bin", bench_write_bin },
+  { "write_array_start", bench_write_array_start },
+  { "write_map_start", bench_write_map_start },
+  { "write_ext", bench_write_ext },
+  { "write_timestamp", bench_write_timestamp },
+  { "read_nil", bench_read_nil },
+  { "read_bool", bench_read_bool },
+  { "read_uint", bench_read_uint },
+  { "read_sint", bench_read_sint },
+  { "read_float", bench_read_float },
+  { "read_string", bench_read_string },
+  { "read_bin", bench_read_bin },
+  { "read_array_size", bench_read_array_size },
+  { "read_map_size", bench_read_map_size },
+  { "read_ext", bench_read_ext },
+  { "read_timestamp", bench_read_timestamp },
+  { "encode_rpc", bench_encode_rpc },
+  { "encode_wide_map", bench_encode_wide_map },
+  { "encode_numeric_array", bench_encode_numeric_array },
+  { "encode_deep_nesting", bench_encode_deep_nesting },
+  { "encode_large_blob", bench_encode_large_blob },
+  { "skip_rpc", bench_skip_rpc },
+  { "skip_wide_map", bench_skip_wide_map },
+  { "skip_numeric_array", bench_skip_numeric_array },
+  { "skip_deep_nesting", bench_skip_deep_nesting },
+  { "skip_large_blob", bench_skip_large_blob },
+  { "cursor_rpc", bench_cursor_rpc },
+};
+
+// the cheapest back-to-back clock read, taken off every latency sample
+static uint64_t bench_clock_overhead(void)
+{
+  uint64_t least = UINT64_MAX;
+
+  for (int k = 0; k < 1000; k++) {
+    uint64_t start = bench_now_ns();
+    uint64_t elapsed = bench_now_ns() - start;
+    least = elapsed < least ? elapsed : least;
+  }
+
+  return least;
+}
+
+static void bench_run(const struct bench_case* bc)
+{
+  static double samples[BENCH_LATENCY_SAMPLES];
+  uint64_t msgs = 0, bytes = 0, total_ns = 0;
+  uint64_t batch = 1, overhead = bench_clock_overhead();
+
+  // grow the batch until one sample is long enough to time reliably
+  for (;;) {
+    uint64_t start = bench_now_ns();
+    for (uint64_t k = 0; k < batch; k++)
+      bc->run();
+    if (bench_now_ns() - start >= BENCH_MIN_SAMPLE_NS || batch >= (1u << 24))
+      break;
+    batch *= 2;
+  }
+
+  for (int s = 0; s < BENCH_SAMPLES; s++) {
+    uint64_t start = bench_now_ns();
+    for (uint64_t k = 0; k < batch; k++)
+      bytes += bc->run();
+    uint64_t elapsed = bench_now_ns() - start;
+
+    total_ns += elapsed;
+    msgs += batch;
+  }
+
+  for (int s = 0; s < BENCH_LATENCY_SAMPLES; s++) {
+    uint64_t start = bench_now_ns();
+    bc->run();
+    uint64_t elapsed = bench_now_ns() - start;
+
+    samples[s] = elapsed > overhead ? (double)(elapsed - overhead) : 0;
+  }
+
+  qsort(samples, BENCH_LATENCY_SAMPLES, sizeof(double), bench_cmp_double);
+
+  double secs = total_ns / 1e9;
+  printf("{\"bench\":\"%s\",\"msgs\":%llu,\"bytes\":%llu,\"mb_s\":%.2f,"
+         "\"msgs_s\":%.0f,\"p50_ns\":%.1f,\"p99_ns\":%.1f}\n",
+      bc->name, (unsigned long long)msgs, (unsigned long long)bytes,
+      bytes / secs / 1e6, msgs / secs,
+      samples[BENCH_LATENCY_SAMPLES / 2], samples[(BENCH_LATENCY_SAMPLES * 99) / 100]);
+  fflush(stdout);
+}
+
+int main(int argc, char** argv)
+{
+  const char* filter = argc > 1 ? argv[1] : NULL;
+
+  for (size_t k = 0; k < BENCH_BLOB_SIZE; k++)
+    blob[k] = (em_byte_t)(k * 31);
+
+  for (size_t k = 0; k < sizeof(cases) / sizeof(cases[0]); k++) {
+    if (filter && !strstr(cases[k].name, filter))
+      continue;
+    bench_run(&cases[k]);
+  }
+
+  return EXIT_SUCCESS;
+}
@@ -1,85 +1,235 @@
 
+#include <string.h>
+
 #include "em_buffer.h"
 
 
-void buffer_init(buffer_t * data, em_byte_t *data_buffer, em_size_t data_len)
+EMPACK_API void buffer_init(buffer_t * data, em_byte_t *data_buffer, em_size_t data_len)
  {
    data->buf = data_buffer;
    data->len = data_len;
    data->pos = 0;
+   data->max = 0;
+   data->error = EM_OK;
+   data->error_pos = 0;
+   data->read_only = false;
+#ifdef EMPACK_STATS
+   buffer_stats_reset(data);
+#endif
  }
 
-int buffer_available(buffer_t * data) {
+EMPACK_API void buffer_view_init(buffer_view_t * view, const em_byte_t * data_buffer, em_size_t data_len) {
+  view->buf = data_buffer;
+  view->len = data_len;
+}
+
+EMPACK_API void buffer_view_reader(const buffer_view_t * view, buffer_t * reader, em_size_t offset) {
+  // every write path checks read_only first, so the const is safe to drop
+  buffer_init(reader, (em_byte_t *)view->buf, view->len);
+  reader->read_only = true;
+
+  if (offset > view->len) {
+    buffer_set_error(reader, EM_ERROR_EOF);
+    return;
+  }
+
+  reader->pos = offset;
+  reader->max = offset;
+}
+
+EMPACK_API void buffer_init_sub(buffer_t * data, const buffer_t * parent, em_size_t offset, em_size_t data_len) {
+  buffer_init(data, parent->buf + offset, data_len);
+  data->read_only = parent->read_only;
+}
+
+EMPACK_API void buffer_init_measure(buffer_t * data) {
+  buffer_init(data, NULL, (em_size_t)~(em_size_t)0);
+}
+
+EMPACK_API em_size_t buffer_available(buffer_t * data) {
   return data->len - data->pos;
 }
 
-int16_t buffer_read_byte(buffer_t * data) {
-  if (buffer_available(data) < 1)
+// compares in 64 bits so wire lengths are never truncated to em_size_t
+EMPACK_API bool buffer_fits(buffer_t * data, uint64_t length) {
+  return length <= (uint64_t)buffer_available(data);
+}
+
+// a measuring buffer has no memory to read back
+static bool buffer_unbacked(buffer_t * data) {
+  if (data->buf != NULL)
+    return false;
+
+  buffer_set_error(data, EM_ERROR_EOF);
+  return true;
+}
+
+EMPACK_API int16_t buffer_read_byte(buffer_t * data) {
+  if (data->error || buffer_unbacked(data))
     return -1;
 
+  if (buffer_available(data) < 1) {
+    EMPACK_STAT_BOUNDS(data);
+    buffer_set_error(data, EM_ERROR_EOF);
+    return -1;
+  }
+
   data->max = data->pos+1;
-  return data->buf[data->pos++];
+  return (uint8_t)data->buf[data->pos++];
 }
 
-int buffer_read(buffer_t * data, em_byte_t * buffer, em_size_t length) {
-  if (buffer_available(data) < length)
-        return -1;
+EMPACK_API em_size_t buffer_read(buffer_t * data, em_byte_t * buffer, em_size_t length) {
+  if (data->error || buffer_unbacked(data))
+    return 0;
+
+  if (buffer_available(data) < length) {
+    EMPACK_STAT_BOUNDS(data);
+    buffer_set_error(data, EM_ERROR_EOF);
+    return 0;
+  }
 
     for (em_size_t i=0; i < length; i++) {
       *(buffer+i) = *(data->buf + data->pos++);
     }
 
-    data->max = data->pos + 1;
+    data->max = data->pos;
 
     return length;
 }
 
-em_size_t buffer_write_byte(buffer_t * data, em_byte_t d) {
-    if (buffer_available(data) <= 0)
-      return -1;
+EMPACK_API em_size_t buffer_write_byte(buffer_t * data, em_byte_t d) {
+    if (data->error)
+      return 0;
+
+    if (data->read_only) {
+      buffer_set_error(data, EM_ERROR_READ_ONLY);
+      return 0;
+    }
+
+    if (buffer_available(data) == 0) {
+      EMPACK_STAT_BOUNDS(data);
+      buffer_set_error(data, EM_ERROR_OVERFLOW);
+      return 0;
+    }
 
     data->max = data->pos+1;
-    data->buf[data->pos++] = d;
+    if (data->buf != NULL)
+      data->buf[data->pos] = d;
+    data->pos++;
 
     return 1;
 };
 
-em_size_t buffer_write(buffer_t * data, em_byte_t* buffer, em_size_t data_len) {
-  if (buffer_available(data) <= 0)
-    return -1;
+EMPACK_API em_size_t buffer_write(buffer_t * data, em_byte_t* buffer, em_size_t data_len) {
+  if (data->error)
+    return 0;
+
+  if (data->read_only) {
+    buffer_set_error(data, EM_ERROR_READ_ONLY);
+    return 0;
+  }
 
-  for(em_size_t i=0; i < data_len; i++) {
-    data->buf[data->pos++] = buffer[i];
+  if (buffer_available(data) < data_len) {
+    EMPACK_STAT_BOUNDS(data);
+    buffer_set_error(data, EM_ERROR_OVERFLOW);
+    return 0;
   }
 
+  // a measuring buffer only counts; callers may copy from the same buffer
+  if (data->buf != NULL && data_len > 0)
+    memmove(data->buf + data->pos, buffer, data_len);
+
+  data->pos += data_len;
   data->max = data->pos;
 
-  return 1;
+  return data_len;
 };
 
-int buffer_peek(buffer_t * data) {
-  return data->buf[data->pos];
+EMPACK_API int buffer_peek(buffer_t * data) {
+  if (data->error || buffer_unbacked(data) || buffer_available(data) < 1)
+    return -1;
+
+  return (uint8_t)data->buf[data->pos];
 }
 
-void buffer_flush(buffer_t * data) {
+EMPACK_API void buffer_flush(buffer_t * data) {
   em_size_t i;
-  for (i = 0; i < data->len; ++i) {
+  if (data->read_only) {
+    buffer_set_error(data, EM_ERROR_READ_ONLY);
+    return;
+  }
+
+  // a measuring buffer claims ~0 bytes but has none to zero
+  for (i = 0; data->buf != NULL && i < data->len; ++i) {
     data->buf[i] = 0;
   }
   data->pos = 0;
   data->max = 0;
+  data->error = EM_OK;
+  data->error_pos = 0;
 }
 
-void buffer_clear(buffer_t * data) {
+EMPACK_API void buffer_clear(buffer_t * data) {
   buffer_flush(data);
 }
 
-void buffer_reset(buffer_t * data) {
+EMPACK_API void buffer_reset(buffer_t * data) {
   data->pos = 0;
 }
 
-void buffer_reset_all(buffer_t * data) {
+EMPACK_API void buffer_reset_all(buffer_t * data) {
         data->pos = 0;
         data->max = 0;
+        data->error = EM_OK;
+        data->error_pos = 0;
+}
+
+EMPACK_API void buffer_set_error(buffer_t * data, em_error_t error) {
+  if (data->error)
+    return;
+
+  data->error = error;
+  data->error_pos = data->pos;
+}
+
+EMPACK_API em_error_t buffer_error(buffer_t * data) {
+  return data->error;
 }
 
+EMPACK_API em_size_t buffer_error_pos(buffer_t * data) {
+  return data->error_pos;
+}
+
+EMPACK_API void buffer_savepoint(buffer_t * data, buffer_savepoint_t * sp) {
+  sp->pos = data->pos;
+  sp->max = data->max;
+  sp->error = data->error;
+  sp->error_pos = data->error_pos;
+}
+
+EMPACK_API void buffer_rollback(buffer_t * data, const buffer_savepoint_t * sp) {
+  data->pos = sp->pos;
+  data->max = sp->max;
+  data->error = sp->error;
+  data->error_pos = sp->error_pos;
+}
+
+EMPACK_API bool buffer_commit(buffer_t * data, const buffer_savepoint_t * sp) {
+  if (!data->error)
+    return true;
+
+  // an error latched before the savepoint stays, along with its position
+  if (data->error != sp->error)
+    buffer_rollback(data, sp);
+  return false;
+}
+
+#ifdef EMPACK_STATS
+EMPACK_API void buffer_stats_snapshot(buffer_t * data, struct empack_stats * stats) {
+  memcpy(stats, &data->stats, sizeof(*stats));
+}
+
+EMPACK_API void buffer_stats_reset(buffer_t * data) {
+  memset(&data->stats, 0, sizeof(data->stats));
+}
+#endif
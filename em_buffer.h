@@ -2,11 +2,18 @@
 #ifndef __EMPACK_BUFFER__
 #define __EMPACK_BUFFER__
 
+#include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
+// Buffer positions and lengths default to size_t so a buffer can span a
+// whole mmapped file. Embedded builds can shrink buffer_t by defining
+// EM_SIZE_TYPE as an unsigned 16 or 32 bit type, e.g.
+// -DEM_SIZE_TYPE=uint16_t. Lengths decoded from the wire are always
+// checked against `buffer_available` before they are narrowed.
 #ifndef EM_SIZE_TYPE
 #define EM_SIZE_TYPE
-typedef int em_size_t;
+typedef size_t em_size_t;
 #else
 typedef EM_SIZE_TYPE em_size_t;
 #endif
@@ -18,6 +25,118 @@ typedef char em_byte_t;
 typedef EM_BYTE_TYPE em_byte_t;
 #endif
 
+// ====================== Build Modes ============== //
+//
+// By default the buffer and msgpack primitives live in em_buffer.c and
+// empack.c and every read or write is an out-of-line call. Including
+// empack_inline.h instead defines EMPACK_HEADER_ONLY and pulls both files
+// into the including translation unit as `static inline` functions, so
+// the byte accessors, `empack_next_type` and the scalar readers and writers
+// inline into the caller's loops. The remaining modules keep linking
+// against libempack.a as usual.
+//
+// EMPACK_SMALL is the profile for microcontrollers: build the library
+// out of line with -Os and it shrinks the fixed-size tables the other
+// modules size from their EMPACK_* defaults. Explicit definitions win.
+//
+// EMPACK_NO_SIMD leaves out the x86 SSE4.2 and AVX2 paths for CRC32C and
+// UTF-8 validation and keeps only the portable code. EMPACK_SMALL sets it.
+
+#ifndef EMPACK_API
+#ifdef EMPACK_HEADER_ONLY
+#define EMPACK_API static inline
+#else
+#define EMPACK_API
+#endif
+#endif
+
+#ifdef EMPACK_SMALL
+#ifndef EMPACK_NO_SIMD
+#define EMPACK_NO_SIMD
+#endif
+#ifndef EMPACK_CURSOR_MAX_DEPTH
+#define EMPACK_CURSOR_MAX_DEPTH 4
+#endif
+#ifndef EMPACK_KEYDICT_MAX_KEYS
+#define EMPACK_KEYDICT_MAX_KEYS 32
+#endif
+#ifndef EMPACK_JSON_BUFF_SIZE
+#define EMPACK_JSON_BUFF_SIZE 32
+#endif
+#ifndef EMPACK_SKIP_MAX_DEPTH
+#define EMPACK_SKIP_MAX_DEPTH 16
+#endif
+#ifndef EMPACK_POOL_CLASSES
+#define EMPACK_POOL_CLASSES 3
+#endif
+#ifndef EMPACK_POOL_CACHE_SIZE
+#define EMPACK_POOL_CACHE_SIZE 4
+#endif
+#endif
+
+// ====================== Errors ============== //
+//
+// Errors are sticky: the first failure is recorded on the buffer together
+// with the position it happened at, and every later read or write on that
+// buffer fails immediately without touching memory. Callers can encode or
+// decode a whole message and check `buffer_error` once at the end.
+
+enum em_error {
+  EM_OK = 0,
+  EM_ERROR_EOF,      // read past the end of the buffer
+  EM_ERROR_OVERFLOW, // no room left to write
+  EM_ERROR_TYPE,     // the next value has a different type
+  EM_ERROR_TOO_BIG,  // the value does not fit the caller's storage
+  EM_ERROR_DEPTH,    // nesting deeper than a fixed-size stack allows
+  EM_ERROR_UTF8,     // a strict string read found invalid UTF-8
+  EM_ERROR_CORRUPT,  // a record's checksum doesn't match
+  EM_ERROR_READ_ONLY, // a write through a reader of a shared view
+};
+
+typedef enum em_error em_error_t;
+
+// ====================== Stats ============== //
+//
+// Built with EMPACK_STATS, every buffer_t carries counters of the values it
+// encoded or decoded, broken down by msgpack type and by width (the fix*
+// forms, then 8/16/32/64 bit tags or length prefixes). Without it the
+// counters and every EMPACK_STAT_* hook compile to nothing.
+
+#ifdef EMPACK_STATS
+
+enum empack_stat_types {
+  EMPACK_STAT_NIL,
+  EMPACK_STAT_BOOL,
+  EMPACK_STAT_UINT,
+  EMPACK_STAT_SINT,
+  EMPACK_STAT_FLOAT,
+  EMPACK_STAT_STRING,
+  EMPACK_STAT_BIN,
+  EMPACK_STAT_EXT,
+  EMPACK_STAT_ARRAY,
+  EMPACK_STAT_MAP,
+  EMPACK_STAT_TYPES,
+};
+
+enum empack_stat_widths {
+  EMPACK_STAT_FIX,
+  EMPACK_STAT_8,
+  EMPACK_STAT_16,
+  EMPACK_STAT_32,
+  EMPACK_STAT_64,
+  EMPACK_STAT_WIDTHS,
+};
+
+struct empack_stats {
+  uint64_t values[EMPACK_STAT_TYPES][EMPACK_STAT_WIDTHS];
+  uint64_t bytes[EMPACK_STAT_TYPES];
+  uint64_t bounds_failures;
+  uint32_t depth;
+  uint32_t max_depth;
+};
+
+#endif // EMPACK_STATS
+
 // ====================== Buffer ============== //
 
 #ifdef __cplusplus
@@ -29,30 +148,118 @@ struct byte_buff {
   em_size_t pos;
   em_size_t max;
   em_size_t len;
+  em_error_t error;
+  em_size_t error_pos;
+  bool read_only;
+#ifdef EMPACK_STATS
+  struct empack_stats stats;
+#endif
 };
 
 typedef struct byte_buff buffer_t;
 
-void buffer_init(buffer_t* data, em_byte_t* data_buffer, em_size_t data_len);
+// ====================== Savepoints ============== //
+//
+// A savepoint records where a buffer stood before a message was started.
+// Rolling back to it drops everything written since, along with any error
+// latched since, so a writer can encode optimistically into a shared batch
+// buffer: when a message runs out of room, roll back to the last complete
+// one, flush the batch and write the message again. `buffer_commit` does
+// the check and the rollback in one call. Stats counters are not rolled
+// back.
 
-int buffer_available(buffer_t* data);
+struct buffer_savepoint {
+  em_size_t pos;
+  em_size_t max;
+  em_error_t error;
+  em_size_t error_pos;
+};
+
+typedef struct buffer_savepoint buffer_savepoint_t;
+
+// ====================== Views ============== //
+//
+// A view is read-only storage shared between threads: a loaded document
+// or an mmapped snapshot. It holds no position, so it never changes once
+// made. Each thread reads it through its own buffer_t from
+// `buffer_view_reader`, which carries only that reader's position, error
+// and stats; every empack_read_*, skip and cursor call takes one as is.
+// Readers never write through `buf`, so no locks or copies are needed:
+// a reader is marked read-only, and any write, clear or in-place edit on
+// it latches EM_ERROR_READ_ONLY without touching the view's memory. Frame
+// payloads and index records taken from a reader stay read-only too.
+
+struct buffer_view {
+  const em_byte_t* buf;
+  em_size_t len;
+};
+
+typedef struct buffer_view buffer_view_t;
+
+EMPACK_API void buffer_init(buffer_t* data, em_byte_t* data_buffer, em_size_t data_len);
+
+EMPACK_API void buffer_view_init(buffer_view_t* view, const em_byte_t* data_buffer, em_size_t data_len);
+
+// a reader starting `offset` bytes in, latched at EOF past the end
+EMPACK_API void buffer_view_reader(const buffer_view_t* view, buffer_t* reader, em_size_t offset);
+
+// a buffer over `data_len` bytes of `parent` starting at `offset`, such as
+// a frame payload; it inherits the parent's read_only flag
+EMPACK_API void buffer_init_sub(buffer_t* data, const buffer_t* parent, em_size_t offset, em_size_t data_len);
+
+// A measuring buffer has no memory behind it: writes only advance `pos`,
+// so running the empack_write_* calls for a message over one gives its
+// exact encoded size. It can't be read from: reads and peeks latch
+// EM_ERROR_EOF.
+EMPACK_API void buffer_init_measure(buffer_t* data);
+
+EMPACK_API em_size_t buffer_available(buffer_t* data);
 
-int buffer_read(buffer_t* data, em_byte_t* buffer, int length);
+EMPACK_API bool buffer_fits(buffer_t* data, uint64_t length);
 
-int16_t buffer_read_byte(buffer_t* data);
+EMPACK_API em_size_t buffer_read(buffer_t* data, em_byte_t* buffer, em_size_t length);
 
-em_size_t buffer_write(buffer_t* data, em_byte_t* buffer, em_size_t data_len);
+EMPACK_API int16_t buffer_read_byte(buffer_t* data);
 
-em_size_t buffer_write_byte(buffer_t* data, em_byte_t byte);
+EMPACK_API em_size_t buffer_write(buffer_t* data, em_byte_t* buffer, em_size_t data_len);
 
-int buffer_peek(buffer_t* data);
+EMPACK_API em_size_t buffer_write_byte(buffer_t* data, em_byte_t byte);
 
-void buffer_flush(buffer_t* data);
+EMPACK_API int buffer_peek(buffer_t* data);
 
-void buffer_clear(buffer_t* data);
+EMPACK_API void buffer_flush(buffer_t* data);
 
-void buffer_reset(buffer_t* data);
+EMPACK_API void buffer_clear(buffer_t* data);
 
-void buffer_reset_all(buffer_t* data);
+EMPACK_API void buffer_reset(buffer_t* data);
+
+EMPACK_API void buffer_reset_all(buffer_t* data);
+
+EMPACK_API void buffer_set_error(buffer_t* data, em_error_t error);
+
+EMPACK_API em_error_t buffer_error(buffer_t* data);
+
+EMPACK_API em_size_t buffer_error_pos(buffer_t* data);
+
+EMPACK_API void buffer_savepoint(buffer_t* data, buffer_savepoint_t* sp);
+
+EMPACK_API void buffer_rollback(buffer_t* data, const buffer_savepoint_t* sp);
+
+// true only when the buffer holds no error; a new error since the savepoint
+// is rolled back, one latched before it is left for the caller to clear
+EMPACK_API bool buffer_commit(buffer_t* data, const buffer_savepoint_t* sp);
+
+#ifdef EMPACK_STATS
+EMPACK_API void buffer_stats_snapshot(buffer_t* data, struct empack_stats* stats);
+EMPACK_API void buffer_stats_reset(buffer_t* data);
+
+#define EMPACK_STAT_BOUNDS(s) ((s)->stats.bounds_failures++)
+#else
+#define EMPACK_STAT_BOUNDS(s) ((void)0)
+#endif
+
+#ifdef __cplusplus
+}
+#endif
 
 #endif
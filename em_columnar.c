@@ -0,0 +1,373 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_columnar.h"
+#include "empack.h"
+
+#define COLUMN_BITMAP_SIZE(rows) (((rows) + 7) / 8)
+
+void empack_columns_init(empack_columns_t* c, struct empack_column* columns, uint16_t count, uint32_t capacity)
+{
+  c->columns = columns;
+  c->count = count;
+  c->capacity = capacity;
+  c->rows = 0;
+}
+
+static void empack_column_set_null(struct empack_column* col, uint32_t row, bool null)
+{
+  if (null)
+    col->nulls[row >> 3] |= 1 << (row & 7);
+  else
+    col->nulls[row >> 3] &= ~(1 << (row & 7));
+}
+
+// records share one shape, so the i-th key usually belongs to the i-th column
+static struct empack_column* empack_columns_find(empack_columns_t* c, uint32_t hint, const char* key, uint32_t key_size)
+{
+  for (uint16_t i = 0; i < c->count; i++) {
+    struct empack_column* col = &c->columns[(hint + i) % c->count];
+    if (col->key_size == key_size && memcmp(col->key, key, key_size) == 0)
+      return col;
+  }
+  return NULL;
+}
+
+static bool empack_column_read_value(buffer_t* s, struct empack_column* col, uint32_t row)
+{
+  empack_type_t type = empack_next_type(s);
+  bool ok;
+
+  if (type == EMPACK_NIL)
+    return empack_read_nil(s);
+
+  switch (col->type) {
+  case EMPACK_COLUMN_INT:
+    ok = (type == EMPACK_SINT || type == EMPACK_UINT)
+        && empack_read_sint(s, (em_byte_t*)&((int64_t*)col->values)[row], 8);
+    break;
+
+  case EMPACK_COLUMN_FLOAT:
+    ok = type == EMPACK_FLOAT && empack_read_float(s, &((float*)col->values)[row]);
+    break;
+
+  case EMPACK_COLUMN_BOOL:
+    ok = type == EMPACK_BOOL && empack_read_bool(s, &((bool*)col->values)[row]);
+    break;
+
+  default:
+    ok = false;
+    break;
+  }
+
+  if (!ok) {
+    buffer_set_error(s, type == EMPACK_EMPTY ? EM_ERROR_EOF : EM_ERROR_TYPE);
+    return false;
+  }
+
+  empack_column_set_null(col, row, false);
+  return true;
+}
+
+bool empack_columns_read_record(buffer_t* s, empack_columns_t* c)
+{
+  uint32_t map_size;
+  uint32_t row = c->rows;
+
+  if (row >= c->capacity) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return false;
+  }
+
+  if (!empack_read_map_size(s, &map_size))
+    return false;
+
+  // missing keys read back as null, with a zero value so int deltas stay small
+  for (uint16_t i = 0; i < c->count; i++) {
+    struct empack_column* col = &c->columns[i];
+    empack_column_set_null(col, row, true);
+    if (col->type == EMPACK_COLUMN_INT)
+      ((int64_t*)col->values)[row] = 0;
+    else if (col->type == EMPACK_COLUMN_FLOAT)
+      ((float*)col->values)[row] = 0;
+    else
+      ((bool*)col->values)[row] = false;
+  }
+
+  for (uint32_t i = 0; i < map_size; i++) {
+    const char* key;
+    uint32_t key_size;
+    empack_type_t skip_type;
+
+    if (!empack_read_string_ref(s, &key, &key_size))
+      return false;
+
+    struct empack_column* col = empack_columns_find(c, i, key, key_size);
+
+    if (col == NULL) {
+      if (!empack_next_skip(s, &skip_type))
+        return false;
+    } else if (!empack_column_read_value(s, col, row)) {
+      return false;
+    }
+  }
+
+  c->rows++;
+  return true;
+}
+
+// reads records until the buffer or the columns run out, returns the rows added
+uint32_t empack_columns_transcode(buffer_t* s, empack_columns_t* c)
+{
+  uint32_t start = c->rows;
+
+  while (c->rows < c->capacity && buffer_available(s) > 0) {
+    if (!empack_columns_read_record(s, c))
+      break;
+  }
+
+  return c->rows - start;
+}
+
+void empack_columns_write_record(buffer_t* s, empack_columns_t* c, uint32_t row)
+{
+  uint32_t map_size = 0;
+
+  for (uint16_t i = 0; i < c->count; i++)
+    map_size += !EMPACK_COLUMN_IS_NULL(&c->columns[i], row);
+
+  empack_write_map_start(s, map_size);
+
+  for (uint16_t i = 0; i < c->count; i++) {
+    struct empack_column* col = &c->columns[i];
+    if (EMPACK_COLUMN_IS_NULL(col, row))
+      continue;
+
+    empack_write_string(s, (em_byte_t*)col->key, col->key_size);
+
+    if (col->type == EMPACK_COLUMN_INT)
+      empack_write_i64(s, ((int64_t*)col->values)[row]);
+    else if (col->type == EMPACK_COLUMN_FLOAT)
+      empack_write_float(s, ((float*)col->values)[row]);
+    else
+      empack_write_bool(s, ((bool*)col->values)[row]);
+  }
+}
+
+// ====================== Blocks ============== //
+
+static uint64_t empack_zigzag(uint64_t delta)
+{
+  return (delta << 1) ^ (0 - (delta >> 63));
+}
+
+static uint64_t empack_unzigzag(uint64_t z)
+{
+  return (z >> 1) ^ (0 - (z & 1));
+}
+
+static uint32_t empack_varint_size(uint64_t v)
+{
+  uint32_t n = 1;
+  while (v >= 0x80) {
+    v >>= 7;
+    n++;
+  }
+  return n;
+}
+
+static uint32_t empack_column_packed_size(struct empack_column* col, uint32_t rows)
+{
+  uint32_t size = 1 + COLUMN_BITMAP_SIZE(rows);
+  uint64_t prev = 0;
+
+  switch (col->type) {
+  case EMPACK_COLUMN_INT:
+    for (uint32_t r = 0; r < rows; r++) {
+      uint64_t v = (uint64_t)((int64_t*)col->values)[r];
+      size += empack_varint_size(empack_zigzag(v - prev));
+      prev = v;
+    }
+    break;
+  case EMPACK_COLUMN_FLOAT:
+    size += 4 * rows;
+    break;
+  default:
+    size += COLUMN_BITMAP_SIZE(rows);
+    break;
+  }
+
+  return size;
+}
+
+static void empack_column_pack(buffer_t* s, struct empack_column* col, uint32_t rows)
+{
+  uint64_t prev = 0;
+
+  buffer_write_byte(s, col->type);
+  if (rows > 0)
+    buffer_write(s, (em_byte_t*)col->nulls, COLUMN_BITMAP_SIZE(rows));
+
+  switch (col->type) {
+  case EMPACK_COLUMN_INT:
+    for (uint32_t r = 0; r < rows; r++) {
+      uint64_t v = (uint64_t)((int64_t*)col->values)[r];
+      uint64_t z = empack_zigzag(v - prev);
+      prev = v;
+      for (; z >= 0x80; z >>= 7)
+        buffer_write_byte(s, (z & 0x7F) | 0x80);
+      buffer_write_byte(s, z);
+    }
+    break;
+
+  case EMPACK_COLUMN_FLOAT:
+    for (uint32_t r = 0; r < rows; r++) {
+      uint32_t bits;
+      memcpy(&bits, &((float*)col->values)[r], 4);
+      for (int8_t i = 0; i < 32; i += 8)
+        buffer_write_byte(s, (bits >> i) & 0xFF);
+    }
+    break;
+
+  default:
+    for (uint32_t r = 0; r < rows; r += 8) {
+      em_byte_t bits = 0;
+      for (uint32_t i = 0; i < 8 && r + i < rows; i++)
+        bits |= ((bool*)col->values)[r + i] << i;
+      buffer_write_byte(s, bits);
+    }
+    break;
+  }
+}
+
+void empack_columns_write_block(buffer_t* s, empack_columns_t* c)
+{
+  empack_write_array_start(s, 1 + 2 * (uint32_t)c->count);
+  empack_write_u32(s, c->rows);
+
+  for (uint16_t i = 0; i < c->count; i++) {
+    struct empack_column* col = &c->columns[i];
+    empack_write_string(s, (em_byte_t*)col->key, col->key_size);
+    empack_write_bin_start(s, empack_column_packed_size(col, c->rows));
+    empack_column_pack(s, col, c->rows);
+  }
+}
+
+static bool empack_column_unpack(buffer_t* p, struct empack_column* col, uint32_t rows)
+{
+  uint64_t prev = 0;
+  int16_t b;
+
+  if (buffer_read_byte(p) != (int16_t)col->type) {
+    buffer_set_error(p, EM_ERROR_TYPE);
+    return false;
+  }
+
+  if (rows > 0 && buffer_read(p, (em_byte_t*)col->nulls, COLUMN_BITMAP_SIZE(rows)) == 0)
+    return false;
+
+  switch (col->type) {
+  case EMPACK_COLUMN_INT:
+    for (uint32_t r = 0; r < rows; r++) {
+      uint64_t z = 0;
+      uint8_t shift = 0;
+      do {
+        if ((b = buffer_read_byte(p)) < 0)
+          return false;
+        if (shift > 63) {
+          buffer_set_error(p, EM_ERROR_TYPE);
+          return false;
+        }
+        z |= (uint64_t)(b & 0x7F) << shift;
+        shift += 7;
+      } while (b & 0x80);
+      prev += empack_unzigzag(z);
+      ((int64_t*)col->values)[r] = (int64_t)prev;
+    }
+    break;
+
+  case EMPACK_COLUMN_FLOAT:
+    for (uint32_t r = 0; r < rows; r++) {
+      uint32_t bits = 0;
+      for (int8_t i = 0; i < 32; i += 8) {
+        if ((b = buffer_read_byte(p)) < 0)
+          return false;
+        bits |= (uint32_t)b << i;
+      }
+      memcpy(&((float*)col->values)[r], &bits, 4);
+    }
+    break;
+
+  default:
+    for (uint32_t r = 0; r < rows; r += 8) {
+      if ((b = buffer_read_byte(p)) < 0)
+        return false;
+      for (uint32_t i = 0; i < 8 && r + i < rows; i++)
+        ((bool*)col->values)[r + i] = (b >> i) & 1;
+    }
+    break;
+  }
+
+  return true;
+}
+
+bool empack_columns_read_block(buffer_t* s, empack_columns_t* c)
+{
+  uint32_t array_size;
+  uint64_t rows = 0;
+
+  if (!empack_read_array_size(s, &array_size))
+    return false;
+
+  if (array_size != 1 + 2 * (uint32_t)c->count) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  if (!empack_read_uint(s, (em_byte_t*)&rows, 8))
+    return false;
+
+  if (rows > c->capacity) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return false;
+  }
+
+  for (uint16_t i = 0; i < c->count; i++) {
+    struct empack_column* col = &c->columns[i];
+    const char* key;
+    uint32_t key_size, bin_size;
+    buffer_t payload;
+
+    if (!empack_read_string_ref(s, &key, &key_size) || !empack_read_bin_size(s, &bin_size))
+      return false;
+
+    if (key_size != col->key_size || memcmp(key, col->key, key_size) != 0) {
+      buffer_set_error(s, EM_ERROR_TYPE);
+      return false;
+    }
+
+    if (!buffer_fits(s, bin_size)) {
+      buffer_set_error(s, EM_ERROR_EOF);
+      return false;
+    }
+
+    buffer_init_sub(&payload, s, s->pos, bin_size);
+    s->pos += bin_size;
+    s->max = s->pos;
+
+    if (!empack_column_unpack(&payload, col, (uint32_t)rows)) {
+      buffer_set_error(s, buffer_error(&payload));
+      return false;
+    }
+  }
+
+  c->rows = (uint32_t)rows;
+  return true;
+}
@@ -0,0 +1,71 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_COLUMNAR__
+#define __EMPACK_COLUMNAR__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+#include "empack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== Columnar ============== //
+//
+// Transcodes a stream of same-shaped map records into one contiguous,
+// typed array per key plus a null bitmap, so scans over a few fields
+// touch only those fields. The caller owns the column storage: `values`
+// holds `capacity` int64_t, float or bool entries depending on `type`, and
+// `nulls` holds `capacity` bits, set where the record had nil or no entry
+// for the key. Keys not in the schema are skipped.
+//
+// `empack_columns_write_block` serializes the columns as a msgpack array
+// `[rows, key, bin, key, bin, ...]`. Each bin holds the column type, the
+// null bitmap and then the values: ints as zigzag varint deltas from the
+// previous row, floats as 4 little-endian bytes and bools as a bitmap.
+
+enum empack_column_type {
+  EMPACK_COLUMN_INT = 0,
+  EMPACK_COLUMN_FLOAT = 1,
+  EMPACK_COLUMN_BOOL = 2,
+};
+
+struct empack_column {
+  const char* key;
+  uint32_t key_size;
+  enum empack_column_type type;
+  void* values;
+  uint8_t* nulls;
+};
+
+struct empack_columns {
+  struct empack_column* columns;
+  uint16_t count;
+  uint32_t capacity;
+  uint32_t rows;
+};
+
+typedef struct empack_columns empack_columns_t;
+
+#define EMPACK_COLUMN_IS_NULL(col, row) (((col)->nulls[(row) >> 3] >> ((row) & 7)) & 1)
+
+void empack_columns_init(empack_columns_t* c, struct empack_column* columns, uint16_t count, uint32_t capacity);
+
+bool empack_columns_read_record(buffer_t* s, empack_columns_t* c);
+uint32_t empack_columns_transcode(buffer_t* s, empack_columns_t* c);
+void empack_columns_write_record(buffer_t* s, empack_columns_t* c, uint32_t row);
+
+void empack_columns_write_block(buffer_t* s, empack_columns_t* c);
+bool empack_columns_read_block(buffer_t* s, empack_columns_t* c);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,261 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_cursor.h"
+#include "empack.h"
+
+void empack_cursor_init(empack_cursor_t* c, buffer_t* s)
+{
+  c->s = s;
+  c->depth = 0;
+}
+
+bool empack_cursor_error(empack_cursor_t* c)
+{
+  return buffer_error(c->s) != EM_OK;
+}
+
+uint8_t empack_cursor_depth(empack_cursor_t* c)
+{
+  return c->depth;
+}
+
+// checks there is a value left to read in the innermost container
+static bool empack_cursor_begin(empack_cursor_t* c)
+{
+  if (buffer_error(c->s))
+    return false;
+
+  if (c->depth > 0 && c->stack[c->depth - 1].remaining == 0)
+    return false;
+
+  return true;
+}
+
+// accounts for one consumed value, or latches an error on the buffer
+static bool empack_cursor_end(empack_cursor_t* c, bool ok)
+{
+  if (!ok) {
+    buffer_set_error(c->s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  if (c->depth > 0)
+    c->stack[c->depth - 1].remaining--;
+
+  return true;
+}
+
+static bool empack_cursor_push(empack_cursor_t* c, uint64_t remaining, bool is_map)
+{
+  if (c->depth >= EMPACK_CURSOR_MAX_DEPTH) {
+    buffer_set_error(c->s, EM_ERROR_DEPTH);
+    return false;
+  }
+
+  c->stack[c->depth].remaining = remaining;
+  c->stack[c->depth].is_map = is_map;
+  c->depth++;
+  EMPACK_STAT_ENTER(c->s);
+  return true;
+}
+
+static bool empack_cursor_advance(buffer_t* s, uint32_t size, const em_byte_t** data)
+{
+  if (!buffer_fits(s, size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  *data = s->buf + s->pos;
+  s->pos += size;
+  s->max = s->pos;
+  return true;
+}
+
+empack_type_t empack_cursor_type(empack_cursor_t* c)
+{
+  if (!empack_cursor_begin(c))
+    return EMPACK_EMPTY;
+
+  return empack_next_type(c->s);
+}
+
+bool empack_cursor_has_next(empack_cursor_t* c)
+{
+  return empack_cursor_begin(c) && buffer_available(c->s) > 0;
+}
+
+bool empack_cursor_skip(empack_cursor_t* c)
+{
+  empack_type_t skip_type;
+
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_next_skip(c->s, &skip_type));
+}
+
+bool empack_cursor_enter_array(empack_cursor_t* c, uint32_t* array_size)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  if (!empack_cursor_end(c, empack_read_array_size(c->s, array_size)))
+    return false;
+
+  return empack_cursor_push(c, *array_size, false);
+}
+
+bool empack_cursor_enter_map(empack_cursor_t* c, uint32_t* map_size)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  if (!empack_cursor_end(c, empack_read_map_size(c->s, map_size)))
+    return false;
+
+  return empack_cursor_push(c, 2 * (uint64_t)*map_size, true);
+}
+
+bool empack_cursor_leave(empack_cursor_t* c)
+{
+  if (buffer_error(c->s) || c->depth == 0)
+    return false;
+
+  while (c->stack[c->depth - 1].remaining > 0) {
+    if (!empack_cursor_skip(c))
+      return false;
+  }
+
+  c->depth--;
+  EMPACK_STAT_LEAVE(c->s);
+  return true;
+}
+
+bool empack_cursor_find_key(empack_cursor_t* c, const char* key, uint32_t key_size)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  if (c->depth == 0 || !c->stack[c->depth - 1].is_map) {
+    buffer_set_error(c->s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  struct empack_cursor_frame* frame = &c->stack[c->depth - 1];
+
+  // the value of the previous key was never read
+  if ((frame->remaining & 1) && !empack_cursor_skip(c))
+    return false;
+
+  while (frame->remaining >= 2) {
+    const em_byte_t* str;
+    uint32_t str_size;
+
+    if (empack_cursor_type(c) == EMPACK_STRING) {
+      if (!empack_cursor_read_string(c, (const char**)&str, &str_size))
+        return false;
+      if (str_size == key_size && memcmp(str, key, key_size) == 0)
+        return true;
+    } else if (!empack_cursor_skip(c)) {
+      return false;
+    }
+
+    if (!empack_cursor_skip(c))
+      return false;
+  }
+
+  return false;
+}
+
+bool empack_cursor_read_nil(empack_cursor_t* c)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_read_nil(c->s));
+}
+
+bool empack_cursor_read_bool(empack_cursor_t* c, bool* b)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_read_bool(c->s, b));
+}
+
+bool empack_cursor_read_uint(empack_cursor_t* c, uint64_t* u)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_read_uint(c->s, (em_byte_t*)u, 8));
+}
+
+bool empack_cursor_read_sint(empack_cursor_t* c, int64_t* i)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_read_sint(c->s, (em_byte_t*)i, 8));
+}
+
+bool empack_cursor_read_float(empack_cursor_t* c, float* f)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_read_float(c->s, f));
+}
+
+bool empack_cursor_read_string(empack_cursor_t* c, const char** str, uint32_t* str_size)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_read_string_ref(c->s, str, str_size));
+}
+
+bool empack_cursor_read_bin(empack_cursor_t* c, const em_byte_t** bin, uint32_t* bin_size)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  bool ok = empack_read_bin_size(c->s, bin_size)
+      && empack_cursor_advance(c->s, *bin_size, bin);
+
+  if (ok)
+    EMPACK_STAT_PAYLOAD(c->s, BIN, *bin_size);
+
+  return empack_cursor_end(c, ok);
+}
+
+bool empack_cursor_read_ext(empack_cursor_t* c, int8_t* ext_type, const em_byte_t** data, uint32_t* ext_size)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  bool ok = empack_read_ext_size(c->s, ext_type, ext_size)
+      && empack_cursor_advance(c->s, *ext_size, data);
+
+  if (ok)
+    EMPACK_STAT_PAYLOAD(c->s, EXT, *ext_size);
+
+  return empack_cursor_end(c, ok);
+}
+
+bool empack_cursor_read_timestamp(empack_cursor_t* c, int64_t* seconds, uint32_t* nanoseconds)
+{
+  if (!empack_cursor_begin(c))
+    return false;
+
+  return empack_cursor_end(c, empack_read_timestamp(c->s, seconds, nanoseconds));
+}
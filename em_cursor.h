@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_CURSOR__
+#define __EMPACK_CURSOR__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+#include "empack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef EMPACK_CURSOR_MAX_DEPTH
+#define EMPACK_CURSOR_MAX_DEPTH 8
+#endif
+
+// ====================== Cursor ============== //
+//
+// Forward-only, on-demand reader over a buffer_t. Containers are entered
+// with `empack_cursor_enter_*` and closed with `empack_cursor_leave`, which
+// skips whatever children were not consumed. Looking up a map key skips any
+// value the caller left unread. Each frame only tracks how many values are
+// left, so the cursor never allocates and its size is fixed at compile time.
+//
+// Errors are latched on the underlying buffer (see `buffer_error`), so once
+// a read fails every later call returns false.
+
+struct empack_cursor_frame {
+  uint64_t remaining;
+  bool is_map;
+};
+
+struct empack_cursor {
+  buffer_t* s;
+  uint8_t depth;
+  struct empack_cursor_frame stack[EMPACK_CURSOR_MAX_DEPTH];
+};
+
+typedef struct empack_cursor empack_cursor_t;
+
+void empack_cursor_init(empack_cursor_t* c, buffer_t* s);
+
+bool empack_cursor_error(empack_cursor_t* c);
+uint8_t empack_cursor_depth(empack_cursor_t* c);
+
+empack_type_t empack_cursor_type(empack_cursor_t* c);
+bool empack_cursor_has_next(empack_cursor_t* c);
+bool empack_cursor_skip(empack_cursor_t* c);
+
+bool empack_cursor_enter_array(empack_cursor_t* c, uint32_t* array_size);
+bool empack_cursor_enter_map(empack_cursor_t* c, uint32_t* map_size);
+bool empack_cursor_leave(empack_cursor_t* c);
+
+bool empack_cursor_find_key(empack_cursor_t* c, const char* key, uint32_t key_size);
+
+bool empack_cursor_read_nil(empack_cursor_t* c);
+bool empack_cursor_read_bool(empack_cursor_t* c, bool* b);
+bool empack_cursor_read_uint(empack_cursor_t* c, uint64_t* u);
+bool empack_cursor_read_sint(empack_cursor_t* c, int64_t* i);
+bool empack_cursor_read_float(empack_cursor_t* c, float* f);
+bool empack_cursor_read_string(empack_cursor_t* c, const char** str, uint32_t* str_size);
+bool empack_cursor_read_bin(empack_cursor_t* c, const em_byte_t** bin, uint32_t* bin_size);
+bool empack_cursor_read_ext(empack_cursor_t* c, int8_t* ext_type, const em_byte_t** data, uint32_t* ext_size);
+bool empack_cursor_read_timestamp(empack_cursor_t* c, int64_t* seconds, uint32_t* nanoseconds);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
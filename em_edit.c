@@ -0,0 +1,314 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_edit.h"
+#include "empack.h"
+
+// where a path lands: the target span, or the end of the parent container
+// when the last key or index is missing
+struct empack_edit_loc {
+  em_size_t parent;
+  em_size_t parent_head;
+  uint32_t parent_count;
+  bool parent_map;
+  em_size_t entry;
+  em_size_t start;
+  em_size_t end;
+  bool found;
+};
+
+static bool empack_edit_fail(buffer_t* doc, buffer_t* r)
+{
+  buffer_set_error(doc, buffer_error(r));
+  return false;
+}
+
+// edits rewrite the document in place, which a view's reader must not do
+static bool empack_edit_writable(buffer_t* doc)
+{
+  if (doc->read_only && !buffer_error(doc))
+    buffer_set_error(doc, EM_ERROR_READ_ONLY);
+  return !buffer_error(doc);
+}
+
+static bool empack_edit_locate(buffer_t* doc, const empack_path_t* path, uint8_t depth, struct empack_edit_loc* loc)
+{
+  buffer_t r;
+  empack_type_t skip_type;
+
+  if (buffer_error(doc))
+    return false;
+
+  buffer_init(&r, doc->buf, doc->pos);
+  loc->parent_head = 0;
+
+  for (uint8_t d = 0; d < depth; d++) {
+    const empack_path_t* p = &path[d];
+    bool is_map = p->key != NULL;
+    uint32_t count, i;
+
+    loc->parent = r.pos;
+    if (is_map ? !empack_read_map_size(&r, &count) : !empack_read_array_size(&r, &count))
+      return empack_edit_fail(doc, &r);
+
+    loc->parent_head = r.pos - loc->parent;
+    loc->parent_count = count;
+    loc->parent_map = is_map;
+
+    for (i = 0; i < count; i++) {
+      bool match = !is_map && i == p->index;
+      loc->entry = r.pos;
+
+      if (is_map && empack_next_type(&r) == EMPACK_STRING) {
+        const char* key;
+        uint32_t key_size;
+        if (!empack_read_string_ref(&r, &key, &key_size))
+          return empack_edit_fail(doc, &r);
+        match = key_size == p->key_size && memcmp(key, p->key, key_size) == 0;
+      } else if (is_map && !empack_next_skip(&r, &skip_type)) {
+        return empack_edit_fail(doc, &r);
+      }
+
+      if (match)
+        break;
+
+      if (!empack_next_skip(&r, &skip_type))
+        return empack_edit_fail(doc, &r);
+    }
+
+    if (i == count) {
+      if (d + 1 < depth)
+        return false;
+      loc->entry = loc->start = loc->end = r.pos;
+      loc->found = false;
+      return true;
+    }
+  }
+
+  if (depth == 0)
+    loc->entry = r.pos;
+
+  loc->start = r.pos;
+  if (!empack_next_skip(&r, &skip_type))
+    return empack_edit_fail(doc, &r);
+
+  loc->end = r.pos;
+  loc->found = true;
+  return true;
+}
+
+// replaces doc[start..end) with room for `size` bytes, moving the tail once
+static em_byte_t* empack_edit_gap(buffer_t* doc, em_size_t start, em_size_t end, em_size_t size)
+{
+  em_size_t tail = doc->pos - end;
+
+  if (size > end - start && !buffer_fits(doc, size - (end - start))) {
+    buffer_set_error(doc, EM_ERROR_OVERFLOW);
+    return NULL;
+  }
+
+  memmove(doc->buf + start + size, doc->buf + end, tail);
+  doc->pos = start + size + tail;
+  doc->max = doc->pos;
+  return doc->buf + start;
+}
+
+// rewrites the parent count at its current width, widening only if needed
+static bool empack_edit_count(buffer_t* doc, struct empack_edit_loc* loc, uint32_t count)
+{
+  em_byte_t* p = doc->buf + loc->parent;
+  em_byte_t head[5];
+  buffer_t w;
+
+  if (loc->parent_head == 1 && count <= 15) {
+    p[0] = (p[0] & 0xF0) | count;
+    return true;
+  } else if (loc->parent_head == 3 && count <= UINT16_MAX) {
+    p[1] = count >> 8;
+    p[2] = count & 0xFF;
+    return true;
+  } else if (loc->parent_head == 5) {
+    for (int8_t i = 0; i < 4; i++)
+      p[1 + i] = (count >> (24 - 8 * i)) & 0xFF;
+    return true;
+  }
+
+  buffer_init(&w, head, sizeof(head));
+  if (loc->parent_map)
+    empack_write_map_start(&w, count);
+  else
+    empack_write_array_start(&w, count);
+
+  p = empack_edit_gap(doc, loc->parent, loc->parent + loc->parent_head, w.pos);
+  if (p == NULL)
+    return false;
+
+  memcpy(p, head, w.pos);
+  return true;
+}
+
+static bool empack_edit_put(buffer_t* doc, const empack_path_t* path, uint8_t depth, struct empack_edit_loc* loc,
+    const em_byte_t* value, em_size_t size)
+{
+  em_byte_t head[5];
+  buffer_t w;
+  em_byte_t* p;
+
+  if (loc->found) {
+    if (loc->end - loc->start == size) {
+      memcpy(doc->buf + loc->start, value, size);
+      return true;
+    }
+
+    p = empack_edit_gap(doc, loc->start, loc->end, size);
+    if (p != NULL)
+      memcpy(p, value, size);
+    return p != NULL;
+  }
+
+  const empack_path_t* last = &path[depth - 1];
+
+  // arrays only grow at the end
+  if (!loc->parent_map && last->index != loc->parent_count)
+    return false;
+
+  // key header, key bytes and value go into one gap at the end of the parent
+  em_size_t key_size = loc->parent_map ? last->key_size : 0;
+  buffer_init(&w, head, sizeof(head));
+  if (loc->parent_map)
+    empack_write_string_start(&w, key_size);
+
+  p = empack_edit_gap(doc, loc->start, loc->start, w.pos + key_size + size);
+  if (p == NULL)
+    return false;
+
+  memcpy(p, head, w.pos);
+  if (key_size > 0)
+    memcpy(p + w.pos, last->key, key_size);
+  memcpy(p + w.pos + key_size, value, size);
+
+  return empack_edit_count(doc, loc, loc->parent_count + 1);
+}
+
+bool empack_edit_find(buffer_t* doc, const empack_path_t* path, uint8_t depth, em_size_t* start, em_size_t* end)
+{
+  struct empack_edit_loc loc;
+
+  if (!empack_edit_locate(doc, path, depth, &loc) || !loc.found)
+    return false;
+
+  *start = loc.start;
+  *end = loc.end;
+  return true;
+}
+
+bool empack_edit_set(buffer_t* doc, const empack_path_t* path, uint8_t depth, const em_byte_t* value, em_size_t size)
+{
+  struct empack_edit_loc loc;
+
+  if (!empack_edit_writable(doc))
+    return false;
+
+  if (!empack_edit_locate(doc, path, depth, &loc))
+    return false;
+
+  return empack_edit_put(doc, path, depth, &loc, value, size);
+}
+
+bool empack_edit_delete(buffer_t* doc, const empack_path_t* path, uint8_t depth)
+{
+  struct empack_edit_loc loc;
+
+  if (!empack_edit_writable(doc))
+    return false;
+
+  if (depth == 0 || !empack_edit_locate(doc, path, depth, &loc) || !loc.found)
+    return false;
+
+  // a map entry goes with its key, and a smaller count always fits
+  empack_edit_gap(doc, loc.entry, loc.end, 0);
+  return empack_edit_count(doc, &loc, loc.parent_count - 1);
+}
+
+// overwrites an encoded int with `v` at the same width, if it fits there
+static bool empack_edit_patch_int(buffer_t* doc, struct empack_edit_loc* loc, bool negative, uint64_t v)
+{
+  em_byte_t* p;
+  uint8_t tag, width;
+  int64_t i = (int64_t)v;
+
+  // a missing key's start can sit at the end of the document
+  if (!loc->found)
+    return false;
+
+  p = doc->buf + loc->start;
+  tag = p[0];
+  width = loc->end - loc->start - 1;
+
+  if (tag < 0x80 || tag >= 0xE0) {
+    if (negative ? i < -32 : v >= 0x80)
+      return false;
+    p[0] = v & 0xFF;
+    return true;
+  } else if (tag >= 0xCC && tag <= 0xCF) {
+    if (negative || (width < 8 && v >> (8 * width) != 0))
+      return false;
+  } else if (tag >= 0xD0 && tag <= 0xD3) {
+    int64_t limit = width < 8 ? (int64_t)1 << (8 * width - 1) : INT64_MAX;
+    if (negative ? width < 8 && i < -limit : v > (uint64_t)limit - (width < 8))
+      return false;
+  } else {
+    return false;
+  }
+
+  for (uint8_t n = 0; n < width; n++)
+    p[width - n] = (v >> (8 * n)) & 0xFF;
+  return true;
+}
+
+bool empack_edit_set_uint(buffer_t* doc, const empack_path_t* path, uint8_t depth, uint64_t u)
+{
+  struct empack_edit_loc loc;
+  em_byte_t value[9];
+  buffer_t w;
+
+  if (!empack_edit_writable(doc))
+    return false;
+
+  if (!empack_edit_locate(doc, path, depth, &loc))
+    return false;
+
+  if (empack_edit_patch_int(doc, &loc, false, u))
+    return true;
+
+  buffer_init(&w, value, sizeof(value));
+  empack_write_u64(&w, u);
+  return empack_edit_put(doc, path, depth, &loc, value, w.pos);
+}
+
+bool empack_edit_set_sint(buffer_t* doc, const empack_path_t* path, uint8_t depth, int64_t i)
+{
+  struct empack_edit_loc loc;
+  em_byte_t value[9];
+  buffer_t w;
+
+  if (!empack_edit_writable(doc))
+    return false;
+
+  if (!empack_edit_locate(doc, path, depth, &loc))
+    return false;
+
+  if (empack_edit_patch_int(doc, &loc, i < 0, (uint64_t)i))
+    return true;
+
+  buffer_init(&w, value, sizeof(value));
+  empack_write_i64(&w, i);
+  return empack_edit_put(doc, path, depth, &loc, value, w.pos);
+}
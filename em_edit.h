@@ -0,0 +1,61 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_EDIT__
+#define __EMPACK_EDIT__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+#include "empack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== Edit ============== //
+//
+// Updates one value of an encoded document without re-encoding the rest.
+// The document is `doc->buf[0..doc->pos)`, as the writers leave it, and
+// `doc->len` is the room it may grow into.
+//
+// A path is a list of map keys and array indexes from the root. A new
+// value with the same encoded width is copied over the old one in place;
+// otherwise the tail of the document is moved once to fit it. Setting a
+// missing map key, or the array index one past the end, appends the entry
+// and bumps the container count, widening its header only when the count
+// no longer fits. Values are passed already encoded.
+//
+// A missing path returns false without an error. Malformed documents,
+// paths through scalars, running out of room and edits through a view's
+// reader latch the sticky error.
+
+struct empack_path {
+  const char* key;
+  uint32_t key_size;
+  uint32_t index;
+};
+
+typedef struct empack_path empack_path_t;
+
+// a NULL key selects an array element by index
+#define EMPACK_PATH_KEY(k) { (k), sizeof(k) - 1, 0 }
+#define EMPACK_PATH_INDEX(i) { NULL, 0, (i) }
+
+bool empack_edit_find(buffer_t* doc, const empack_path_t* path, uint8_t depth, em_size_t* start, em_size_t* end);
+
+bool empack_edit_set(buffer_t* doc, const empack_path_t* path, uint8_t depth, const em_byte_t* value, em_size_t size);
+bool empack_edit_delete(buffer_t* doc, const empack_path_t* path, uint8_t depth);
+
+// patch ints at their existing width when the new value fits
+bool empack_edit_set_uint(buffer_t* doc, const empack_path_t* path, uint8_t depth, uint64_t u);
+bool empack_edit_set_sint(buffer_t* doc, const empack_path_t* path, uint8_t depth, int64_t i);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,56 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_ext.h"
+#include "empack.h"
+
+void empack_ext_table_init(empack_ext_table_t* table)
+{
+  memset(table, 0, sizeof(*table));
+}
+
+void empack_ext_register(empack_ext_table_t* table, int8_t ext_type, empack_ext_decoder_t decode, void* ctx)
+{
+  struct empack_ext_entry* entry = &table->entries[(uint8_t)ext_type];
+  entry->decode = decode;
+  entry->ctx = ctx;
+}
+
+// Reads the next ext value and hands its payload to the registered decoder.
+// An ext type without a decoder is skipped and false is returned without
+// setting an error; a decoder returning false latches EM_ERROR_TYPE.
+bool empack_ext_dispatch(empack_ext_table_t* table, buffer_t* s, int8_t* ext_type)
+{
+  uint32_t ext_size;
+
+  if (!empack_read_ext_size(s, ext_type, &ext_size))
+    return false;
+
+  if (!buffer_fits(s, ext_size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  const em_byte_t* data = s->buf + s->pos;
+  s->pos += ext_size;
+  s->max = s->pos;
+  EMPACK_STAT_PAYLOAD(s, EXT, ext_size);
+
+  struct empack_ext_entry* entry = &table->entries[(uint8_t)*ext_type];
+  if (entry->decode == NULL)
+    return false;
+
+  if (!entry->decode(entry->ctx, *ext_type, data, ext_size)) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,48 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_EXT__
+#define __EMPACK_EXT__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+#include "empack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== Ext Table ============== //
+//
+// Maps every ext type id (-128..127) to a decode callback. Dispatch indexes
+// the table directly by the type byte, so looking up a decoder is O(1). The
+// callback gets the ext payload in place, without a copy.
+
+typedef bool (*empack_ext_decoder_t)(void* ctx, int8_t ext_type, const em_byte_t* data, uint32_t size);
+
+struct empack_ext_entry {
+  empack_ext_decoder_t decode;
+  void* ctx;
+};
+
+struct empack_ext_table {
+  struct empack_ext_entry entries[256];
+};
+
+typedef struct empack_ext_table empack_ext_table_t;
+
+void empack_ext_table_init(empack_ext_table_t* table);
+
+void empack_ext_register(empack_ext_table_t* table, int8_t ext_type, empack_ext_decoder_t decode, void* ctx);
+
+bool empack_ext_dispatch(empack_ext_table_t* table, buffer_t* s, int8_t* ext_type);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
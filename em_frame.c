@@ -0,0 +1,303 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_frame.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EMPACK_NO_SIMD)
+#define EMPACK_CRC_X86
+#include <immintrin.h>
+#endif
+
+// ====================== CRC32C ============== //
+
+#define CRC32C_POLY 0x82F63B78u
+
+static uint32_t crc_tables[8][256];
+static int crc_tables_state;
+
+#if defined(EMPACK_CRC_X86) && defined(__x86_64__)
+// the hardware path runs three streams over blocks this long, then
+// shifts the partial CRCs into place with the zeros tables
+#define CRC_LONG 8192
+#define CRC_SHORT 256
+
+static uint32_t crc_long[4][256];
+static uint32_t crc_short[4][256];
+
+static uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec)
+{
+  uint32_t sum = 0;
+  for (; vec; vec >>= 1, mat++) {
+    if (vec & 1)
+      sum ^= *mat;
+  }
+  return sum;
+}
+
+static void gf2_matrix_square(uint32_t* square, const uint32_t* mat)
+{
+  for (int n = 0; n < 32; n++)
+    square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+// tables that advance a CRC over `len` zero bytes, len a power of two
+static void empack_crc32c_zeros(uint32_t zeros[4][256], size_t len)
+{
+  uint32_t even[32], odd[32];
+  uint32_t row = 1;
+
+  odd[0] = CRC32C_POLY;
+  for (int n = 1; n < 32; n++, row <<= 1)
+    odd[n] = row;
+
+  gf2_matrix_square(even, odd);
+  gf2_matrix_square(odd, even);
+
+  // odd advances 4 bits; each pass squares it up to len bytes
+  for (len <<= 1; len > 1; len >>= 2) {
+    gf2_matrix_square(even, odd);
+    if (len == 2) {
+      memcpy(odd, even, sizeof(odd));
+      break;
+    }
+    gf2_matrix_square(odd, even);
+  }
+
+  for (uint32_t n = 0; n < 256; n++) {
+    zeros[0][n] = gf2_matrix_times(odd, n);
+    zeros[1][n] = gf2_matrix_times(odd, n << 8);
+    zeros[2][n] = gf2_matrix_times(odd, n << 16);
+    zeros[3][n] = gf2_matrix_times(odd, n << 24);
+  }
+}
+
+static uint32_t empack_crc32c_shift(uint32_t zeros[4][256], uint32_t crc)
+{
+  return zeros[0][crc & 0xFF] ^ zeros[1][crc >> 8 & 0xFF] ^ zeros[2][crc >> 16 & 0xFF] ^ zeros[3][crc >> 24];
+}
+#endif
+
+// built on first use; racing callers wait for whoever got there first
+static void empack_crc32c_tables(void)
+{
+  int state = 0;
+
+  if (__atomic_load_n(&crc_tables_state, __ATOMIC_ACQUIRE) == 2)
+    return;
+
+  if (!__atomic_compare_exchange_n(&crc_tables_state, &state, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+    while (__atomic_load_n(&crc_tables_state, __ATOMIC_ACQUIRE) != 2)
+      ;
+    return;
+  }
+
+  for (uint32_t i = 0; i < 256; i++) {
+    uint32_t crc = i;
+    for (int k = 0; k < 8; k++)
+      crc = crc & 1 ? crc >> 1 ^ CRC32C_POLY : crc >> 1;
+    crc_tables[0][i] = crc;
+  }
+
+  for (uint32_t i = 0; i < 256; i++) {
+    for (int k = 1; k < 8; k++)
+      crc_tables[k][i] = crc_tables[k - 1][i] >> 8 ^ crc_tables[0][crc_tables[k - 1][i] & 0xFF];
+  }
+
+#if defined(EMPACK_CRC_X86) && defined(__x86_64__)
+  empack_crc32c_zeros(crc_long, CRC_LONG);
+  empack_crc32c_zeros(crc_short, CRC_SHORT);
+#endif
+  __atomic_store_n(&crc_tables_state, 2, __ATOMIC_RELEASE);
+}
+
+static uint32_t empack_crc32c_sw(uint32_t crc, const uint8_t* p, size_t size)
+{
+  empack_crc32c_tables();
+
+  for (; size >= 8; p += 8, size -= 8) {
+    uint32_t lo = crc ^ ((uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24);
+    uint32_t hi = (uint32_t)p[4] | (uint32_t)p[5] << 8 | (uint32_t)p[6] << 16 | (uint32_t)p[7] << 24;
+
+    crc = crc_tables[7][lo & 0xFF] ^ crc_tables[6][lo >> 8 & 0xFF]
+      ^ crc_tables[5][lo >> 16 & 0xFF] ^ crc_tables[4][lo >> 24]
+      ^ crc_tables[3][hi & 0xFF] ^ crc_tables[2][hi >> 8 & 0xFF]
+      ^ crc_tables[1][hi >> 16 & 0xFF] ^ crc_tables[0][hi >> 24];
+  }
+
+  while (size--)
+    crc = crc_tables[0][(crc ^ *p++) & 0xFF] ^ crc >> 8;
+
+  return crc;
+}
+
+#ifdef EMPACK_CRC_X86
+__attribute__((target("sse4.2")))
+static uint32_t empack_crc32c_hw(uint32_t crc, const uint8_t* p, size_t size)
+{
+#ifdef __x86_64__
+  // the instruction has a latency of three, so keep three in flight
+  empack_crc32c_tables();
+
+  for (size_t block = CRC_LONG; block >= CRC_SHORT; block = block == CRC_LONG ? CRC_SHORT : 0) {
+    uint32_t (*zeros)[256] = block == CRC_LONG ? crc_long : crc_short;
+
+    for (; size >= 3 * block; p += 3 * block, size -= 3 * block) {
+      uint64_t c0 = crc, c1 = 0, c2 = 0, w;
+
+      for (size_t i = 0; i < block; i += 8) {
+        memcpy(&w, p + i, 8);
+        c0 = _mm_crc32_u64(c0, w);
+        memcpy(&w, p + block + i, 8);
+        c1 = _mm_crc32_u64(c1, w);
+        memcpy(&w, p + 2 * block + i, 8);
+        c2 = _mm_crc32_u64(c2, w);
+      }
+
+      crc = empack_crc32c_shift(zeros, (uint32_t)c0) ^ (uint32_t)c1;
+      crc = empack_crc32c_shift(zeros, crc) ^ (uint32_t)c2;
+    }
+  }
+
+  uint64_t crc64 = crc;
+  for (; size >= 8; p += 8, size -= 8) {
+    uint64_t w;
+    memcpy(&w, p, 8);
+    crc64 = _mm_crc32_u64(crc64, w);
+  }
+  crc = (uint32_t)crc64;
+#endif
+
+  for (; size >= 4; p += 4, size -= 4) {
+    uint32_t w;
+    memcpy(&w, p, 4);
+    crc = _mm_crc32_u32(crc, w);
+  }
+
+  while (size--)
+    crc = _mm_crc32_u8(crc, *p++);
+
+  return crc;
+}
+#endif
+
+uint32_t empack_crc32c(uint32_t crc, const em_byte_t* data, size_t size)
+{
+  crc = ~crc;
+
+#ifdef EMPACK_CRC_X86
+  if (__builtin_cpu_supports("sse4.2"))
+    return ~empack_crc32c_hw(crc, (const uint8_t*)data, size);
+#endif
+
+  return ~empack_crc32c_sw(crc, (const uint8_t*)data, size);
+}
+
+// ====================== Frames ============== //
+
+static void empack_frame_store32(em_byte_t* p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++, v >>= 8)
+    p[i] = (em_byte_t)(v & 0xFF);
+}
+
+static uint32_t empack_frame_load32(const em_byte_t* p)
+{
+  return (uint32_t)(uint8_t)p[0] | (uint32_t)(uint8_t)p[1] << 8 | (uint32_t)(uint8_t)p[2] << 16
+    | (uint32_t)(uint8_t)p[3] << 24;
+}
+
+// the crc runs over the length and type, then the payload
+static uint32_t empack_frame_crc(const em_byte_t* header, const em_byte_t* payload, uint32_t size)
+{
+  return empack_crc32c(empack_crc32c(0, header, 5), payload, size);
+}
+
+void empack_frame_begin(buffer_t* s, empack_frame_t* frame, uint8_t type)
+{
+  em_byte_t header[EMPACK_FRAME_HEADER] = { 0 };
+
+  frame->start = s->pos;
+  frame->type = type;
+  buffer_write(s, header, EMPACK_FRAME_HEADER);
+}
+
+void empack_frame_end(buffer_t* s, empack_frame_t* frame)
+{
+  if (buffer_error(s))
+    return;
+
+  uint64_t size = (uint64_t)(s->pos - frame->start) - EMPACK_FRAME_HEADER;
+  if (size > UINT32_MAX) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return;
+  }
+
+  // a measuring buffer has nothing to patch
+  if (s->buf == NULL)
+    return;
+
+  em_byte_t* header = s->buf + frame->start;
+  empack_frame_store32(header, (uint32_t)size);
+  header[4] = (em_byte_t)frame->type;
+  empack_frame_store32(header + 5, empack_frame_crc(header, header + EMPACK_FRAME_HEADER, (uint32_t)size));
+}
+
+void empack_frame_write(buffer_t* s, uint8_t type, const em_byte_t* payload, uint32_t size)
+{
+  empack_frame_t frame;
+
+  empack_frame_begin(s, &frame, type);
+  if (!buffer_fits(s, size))
+    buffer_set_error(s, EM_ERROR_OVERFLOW);
+  buffer_write(s, (em_byte_t*)payload, size);
+  empack_frame_end(s, &frame);
+}
+
+bool empack_frame_next(buffer_t* s, uint8_t* type, buffer_t* payload)
+{
+  if (buffer_error(s) || buffer_available(s) == 0)
+    return false;
+
+  if (buffer_available(s) < EMPACK_FRAME_HEADER) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  const em_byte_t* header = s->buf + s->pos;
+  uint32_t size = empack_frame_load32(header);
+
+  if (!buffer_fits(s, (uint64_t)EMPACK_FRAME_HEADER + size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  if (empack_frame_crc(header, header + EMPACK_FRAME_HEADER, size) != empack_frame_load32(header + 5)) {
+    buffer_set_error(s, EM_ERROR_CORRUPT);
+    return false;
+  }
+
+  *type = (uint8_t)header[4];
+  buffer_init_sub(payload, s, s->pos + EMPACK_FRAME_HEADER, (em_size_t)size);
+  s->pos += EMPACK_FRAME_HEADER + (em_size_t)size;
+  s->max = s->pos;
+  return true;
+}
+
+bool empack_frame_verify(buffer_t* s, uint64_t* count)
+{
+  buffer_t payload;
+  uint8_t type;
+
+  *count = 0;
+  while (empack_frame_next(s, &type, &payload))
+    (*count)++;
+
+  return !buffer_error(s);
+}
@@ -0,0 +1,64 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_FRAME__
+#define __EMPACK_FRAME__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#define EMPACK_FRAME_HEADER 9
+
+// ====================== Record Framing ============== //
+//
+// Checksummed records for logs and files. Each frame is a 9 byte header,
+// then the payload:
+//
+//   | length: u32 LE | type: u8 | crc: u32 LE | payload |
+//
+// The CRC32C covers the length, the type and the payload, so a torn
+// length is caught as well as a flipped payload bit. The type is free for
+// the caller; 0 when unused.
+//
+// Write a frame by bracketing ordinary empack_write_* calls between
+// `empack_frame_begin` and `empack_frame_end`, which patches the header
+// in place. Read frames back one at a time with `empack_frame_next`, or
+// check a whole buffer with `empack_frame_verify`. A bad checksum latches
+// EM_ERROR_CORRUPT with pos left at the start of the frame; a frame cut
+// short latches EM_ERROR_EOF.
+//
+// The CRC uses the SSE4.2 crc32 instruction when the CPU has it and
+// slicing-by-8 tables otherwise.
+
+struct empack_frame {
+  em_size_t start;
+  uint8_t type;
+};
+
+typedef struct empack_frame empack_frame_t;
+
+uint32_t empack_crc32c(uint32_t crc, const em_byte_t* data, size_t size);
+
+void empack_frame_begin(buffer_t* s, empack_frame_t* frame, uint8_t type);
+void empack_frame_end(buffer_t* s, empack_frame_t* frame);
+void empack_frame_write(buffer_t* s, uint8_t type, const em_byte_t* payload, uint32_t size);
+
+bool empack_frame_next(buffer_t* s, uint8_t* type, buffer_t* payload);
+
+// checks every frame from pos to the end, counting the good ones
+bool empack_frame_verify(buffer_t* s, uint64_t* count);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
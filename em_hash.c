@@ -0,0 +1,527 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <float.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_hash.h"
+#include "empack.h"
+
+// token kinds, in the order values sort by
+enum empack_token_kind {
+  TOKEN_NIL,
+  TOKEN_BOOL,
+  TOKEN_INT,
+  TOKEN_FLOAT,
+  TOKEN_STRING,
+  TOKEN_BIN,
+  TOKEN_EXT,
+  TOKEN_ARRAY,
+  TOKEN_MAP,
+};
+
+// one header with its value normalized: ints as 64 bits (sign extended when
+// negative), floats as double bits, and lengths or counts in `u`
+struct empack_token {
+  uint8_t kind;
+  bool negative;
+  int8_t ext_type;
+  uint64_t u;
+  const em_byte_t* data;
+  em_size_t head_size;
+};
+
+#define CANONICAL_NAN 0x7FF8000000000000ull
+
+static bool empack_token_load(buffer_t* s, uint8_t width, uint64_t* v)
+{
+  *v = 0;
+  for (uint8_t i = 0; i < width; i++) {
+    int16_t b = buffer_read_byte(s);
+    if (b < 0)
+      return false;
+    *v = *v << 8 | (uint8_t)b;
+  }
+  return true;
+}
+
+static bool empack_token_read(buffer_t* s, struct empack_token* t)
+{
+  em_size_t start = s->pos;
+  int16_t tag = buffer_read_byte(s);
+  uint8_t width = 0;
+  uint64_t size = 0;
+  bool payload = false;
+  bool ext = false;
+
+  if (tag < 0)
+    return false;
+
+  t->negative = false;
+  t->u = 0;
+  t->data = NULL;
+
+  if (tag < 0x80) {
+    t->kind = TOKEN_INT;
+    t->u = tag;
+  } else if (tag >= 0xE0) {
+    t->kind = TOKEN_INT;
+    t->negative = true;
+    t->u = (uint64_t)(int64_t)(int8_t)tag;
+  } else if ((tag & 0xE0) == 0xA0) {
+    t->kind = TOKEN_STRING;
+    size = tag & 0x1F;
+    payload = true;
+  } else if ((tag & 0xF0) == 0x90) {
+    t->kind = TOKEN_ARRAY;
+    t->u = tag & 0x0F;
+  } else if ((tag & 0xF0) == 0x80) {
+    t->kind = TOKEN_MAP;
+    t->u = tag & 0x0F;
+  } else {
+    switch (tag) {
+    case 0xC0:
+      t->kind = TOKEN_NIL;
+      break;
+    case 0xC2:
+    case 0xC3:
+      t->kind = TOKEN_BOOL;
+      t->u = tag & 1;
+      break;
+    case 0xC4:
+    case 0xC5:
+    case 0xC6:
+      t->kind = TOKEN_BIN;
+      width = 1 << (tag - 0xC4);
+      payload = true;
+      break;
+    case 0xC7:
+    case 0xC8:
+    case 0xC9:
+      t->kind = TOKEN_EXT;
+      width = 1 << (tag - 0xC7);
+      payload = ext = true;
+      break;
+    case 0xCA:
+    case 0xCB:
+      t->kind = TOKEN_FLOAT;
+      break;
+    case 0xCC:
+    case 0xCD:
+    case 0xCE:
+    case 0xCF:
+      t->kind = TOKEN_INT;
+      if (!empack_token_load(s, 1 << (tag - 0xCC), &t->u))
+        return false;
+      break;
+    case 0xD0:
+    case 0xD1:
+    case 0xD2:
+    case 0xD3:
+      t->kind = TOKEN_INT;
+      width = 1 << (tag - 0xD0);
+      if (!empack_token_load(s, width, &t->u))
+        return false;
+      if (width < 8 && (t->u >> (8 * width - 1)) & 1)
+        t->u |= ~0ull << (8 * width);
+      t->negative = (int64_t)t->u < 0;
+      width = 0;
+      break;
+    case 0xD4:
+    case 0xD5:
+    case 0xD6:
+    case 0xD7:
+    case 0xD8:
+      t->kind = TOKEN_EXT;
+      size = 1 << (tag - 0xD4);
+      payload = ext = true;
+      break;
+    case 0xD9:
+    case 0xDA:
+    case 0xDB:
+      t->kind = TOKEN_STRING;
+      width = 1 << (tag - 0xD9);
+      payload = true;
+      break;
+    case 0xDC:
+    case 0xDD:
+      t->kind = TOKEN_ARRAY;
+      width = tag == 0xDC ? 2 : 4;
+      break;
+    case 0xDE:
+    case 0xDF:
+      t->kind = TOKEN_MAP;
+      width = tag == 0xDE ? 2 : 4;
+      break;
+    default:
+      buffer_set_error(s, EM_ERROR_TYPE);
+      return false;
+    }
+  }
+
+  if (t->kind == TOKEN_FLOAT) {
+    uint64_t bits;
+    double d;
+    if (!empack_token_load(s, tag == 0xCA ? 4 : 8, &bits))
+      return false;
+    if (tag == 0xCA) {
+      uint32_t f32 = (uint32_t)bits;
+      float f;
+      memcpy(&f, &f32, 4);
+      d = f;
+    } else {
+      memcpy(&d, &bits, 8);
+    }
+    memcpy(&t->u, &d, 8);
+    if (d != d)
+      t->u = CANONICAL_NAN;
+  } else if (width > 0 && !empack_token_load(s, width, payload ? &size : &t->u)) {
+    return false;
+  }
+
+  if (ext) {
+    int16_t ext_type = buffer_read_byte(s);
+    if (ext_type < 0)
+      return false;
+    t->ext_type = (int8_t)ext_type;
+  }
+
+  t->head_size = s->pos - start;
+
+  if (payload) {
+    if (!buffer_fits(s, size)) {
+      buffer_set_error(s, EM_ERROR_EOF);
+      return false;
+    }
+    t->u = size;
+    t->data = s->buf + s->pos;
+    s->pos += size;
+    s->max = s->pos;
+  }
+
+  return true;
+}
+
+static uint8_t empack_token_store(em_byte_t* p, uint8_t tag, uint64_t v, uint8_t width)
+{
+  p[0] = tag;
+  for (uint8_t i = 0; i < width; i++)
+    p[width - i] = (v >> (8 * i)) & 0xFF;
+  return 1 + width;
+}
+
+static uint8_t empack_token_sized(em_byte_t* p, uint8_t tag8, uint64_t size)
+{
+  if (size <= UINT8_MAX)
+    return empack_token_store(p, tag8, size, 1);
+  if (size <= UINT16_MAX)
+    return empack_token_store(p, tag8 + 1, size, 2);
+  return empack_token_store(p, tag8 + 2, size, 4);
+}
+
+// writes the shortest encoding of a token's header, the same form the
+// empack writers produce
+static uint8_t empack_token_head(const struct empack_token* t, em_byte_t* p)
+{
+  int64_t i = (int64_t)t->u;
+  uint8_t n;
+
+  switch (t->kind) {
+  case TOKEN_NIL:
+    return empack_token_store(p, 0xC0, 0, 0);
+
+  case TOKEN_BOOL:
+    return empack_token_store(p, 0xC2 | t->u, 0, 0);
+
+  case TOKEN_INT:
+    if (!t->negative) {
+      if (t->u < 0x80)
+        return empack_token_store(p, t->u, 0, 0);
+      if (t->u <= UINT8_MAX)
+        return empack_token_store(p, 0xCC, t->u, 1);
+      if (t->u <= UINT16_MAX)
+        return empack_token_store(p, 0xCD, t->u, 2);
+      if (t->u <= UINT32_MAX)
+        return empack_token_store(p, 0xCE, t->u, 4);
+      return empack_token_store(p, 0xCF, t->u, 8);
+    }
+    if (i >= -32)
+      return empack_token_store(p, (uint8_t)i, 0, 0);
+    if (i >= INT8_MIN)
+      return empack_token_store(p, 0xD0, t->u, 1);
+    if (i >= INT16_MIN)
+      return empack_token_store(p, 0xD1, t->u, 2);
+    if (i >= INT32_MIN)
+      return empack_token_store(p, 0xD2, t->u, 4);
+    return empack_token_store(p, 0xD3, t->u, 8);
+
+  case TOKEN_FLOAT: {
+    double d;
+    memcpy(&d, &t->u, 8);
+    // infinities narrow, finite values only when exact; nan was made
+    // canonical when it was read and stays a float64
+    bool narrow = (d > FLT_MAX || d < -FLT_MAX) ? d - d != 0 : (double)(float)d == d;
+    if (narrow) {
+      float f = (float)d;
+      uint32_t f32;
+      memcpy(&f32, &f, 4);
+      return empack_token_store(p, 0xCA, f32, 4);
+    }
+    return empack_token_store(p, 0xCB, t->u, 8);
+  }
+
+  case TOKEN_STRING:
+    if (t->u <= 31)
+      return empack_token_store(p, 0xA0 | t->u, 0, 0);
+    return empack_token_sized(p, 0xD9, t->u);
+
+  case TOKEN_BIN:
+    return empack_token_sized(p, 0xC4, t->u);
+
+  case TOKEN_EXT:
+    switch (t->u) {
+    case 1:
+      n = empack_token_store(p, 0xD4, 0, 0);
+      break;
+    case 2:
+      n = empack_token_store(p, 0xD5, 0, 0);
+      break;
+    case 4:
+      n = empack_token_store(p, 0xD6, 0, 0);
+      break;
+    case 8:
+      n = empack_token_store(p, 0xD7, 0, 0);
+      break;
+    case 16:
+      n = empack_token_store(p, 0xD8, 0, 0);
+      break;
+    default:
+      n = empack_token_sized(p, 0xC7, t->u);
+      break;
+    }
+    p[n] = t->ext_type;
+    return n + 1;
+
+  case TOKEN_ARRAY:
+    if (t->u <= 15)
+      return empack_token_store(p, 0x90 | t->u, 0, 0);
+    return empack_token_store(p, t->u <= UINT16_MAX ? 0xDC : 0xDD, t->u, t->u <= UINT16_MAX ? 2 : 4);
+
+  default:
+    if (t->u <= 15)
+      return empack_token_store(p, 0x80 | t->u, 0, 0);
+    return empack_token_store(p, t->u <= UINT16_MAX ? 0xDE : 0xDF, t->u, t->u <= UINT16_MAX ? 2 : 4);
+  }
+}
+
+static uint64_t empack_token_children(const struct empack_token* t)
+{
+  if (t->kind == TOKEN_ARRAY)
+    return t->u;
+  if (t->kind == TOKEN_MAP)
+    return 2 * t->u;
+  return 0;
+}
+
+// ====================== Hash ============== //
+//
+// wyhash style: 16 byte blocks folded with a 64x64->128 bit multiply. The
+// hasher buffers partial blocks, so the result only depends on the bytes
+// fed, not on how they were split.
+
+#define HASH_P0 0xa0761d6478bd642full
+#define HASH_P1 0xe7037ed1a0b428dbull
+#define HASH_P2 0x8ebc6af09c88c6e3ull
+
+struct empack_hasher {
+  uint64_t h;
+  uint64_t total;
+  em_byte_t tail[16];
+  uint8_t n;
+};
+
+static uint64_t empack_mum(uint64_t a, uint64_t b)
+{
+#ifdef __SIZEOF_INT128__
+  __uint128_t r = (__uint128_t)a * b;
+  return (uint64_t)r ^ (uint64_t)(r >> 64);
+#else
+  uint64_t ha = a >> 32, la = (uint32_t)a, hb = b >> 32, lb = (uint32_t)b;
+  uint64_t rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+  uint64_t t = rl + (rm0 << 32);
+  uint64_t lo = t + (rm1 << 32);
+  uint64_t hi = ha * hb + (rm0 >> 32) + (rm1 >> 32) + (t < rl) + (lo < t);
+  return lo ^ hi;
+#endif
+}
+
+static uint64_t empack_load_le64(const em_byte_t* p)
+{
+  uint64_t v = 0;
+  for (int8_t i = 7; i >= 0; i--)
+    v = v << 8 | (uint8_t)p[i];
+  return v;
+}
+
+static void empack_hasher_block(struct empack_hasher* h, const em_byte_t* p)
+{
+  h->h = empack_mum(empack_load_le64(p) ^ HASH_P1, empack_load_le64(p + 8) ^ h->h);
+}
+
+static void empack_hasher_update(struct empack_hasher* h, const em_byte_t* p, em_size_t n)
+{
+  h->total += n;
+
+  if (h->n > 0) {
+    while (n > 0 && h->n < 16) {
+      h->tail[h->n++] = *p++;
+      n--;
+    }
+    if (h->n < 16)
+      return;
+    empack_hasher_block(h, h->tail);
+    h->n = 0;
+  }
+
+  for (; n >= 16; p += 16, n -= 16)
+    empack_hasher_block(h, p);
+
+  memcpy(h->tail, p, n);
+  h->n = n;
+}
+
+static uint64_t empack_hasher_final(struct empack_hasher* h)
+{
+  memset(h->tail + h->n, 0, 16 - h->n);
+  empack_hasher_block(h, h->tail);
+  return empack_mum(h->h ^ HASH_P0, h->total ^ HASH_P2);
+}
+
+// Hashes the canonical bytes of the next value. Canonical stretches of the
+// input, including every string and bin payload, are fed straight from the
+// buffer; only headers that are not in their shortest form are re-encoded.
+bool empack_hash(buffer_t* s, uint64_t seed, uint64_t* hash)
+{
+  struct empack_hasher h = { seed ^ HASH_P0, 0, { 0 }, 0 };
+  struct empack_token t;
+  em_byte_t head[16];
+  em_size_t run = s->pos;
+  uint64_t remaining = 1;
+
+  while (remaining-- > 0) {
+    em_size_t start = s->pos;
+    if (!empack_token_read(s, &t))
+      return false;
+
+    uint8_t n = empack_token_head(&t, head);
+    if (n != t.head_size || memcmp(head, s->buf + start, n) != 0) {
+      empack_hasher_update(&h, s->buf + run, start - run);
+      empack_hasher_update(&h, head, n);
+      run = start + t.head_size;
+    }
+
+    remaining += empack_token_children(&t);
+  }
+
+  empack_hasher_update(&h, s->buf + run, s->pos - run);
+  *hash = empack_hasher_final(&h);
+  return true;
+}
+
+// ====================== Compare ============== //
+
+static int empack_token_compare(const struct empack_token* a, const struct empack_token* b)
+{
+  if (a->kind != b->kind)
+    return a->kind < b->kind ? -1 : 1;
+
+  switch (a->kind) {
+  case TOKEN_INT:
+    if (a->negative != b->negative)
+      return a->negative ? -1 : 1;
+    if (a->u != b->u)
+      return a->negative ? ((int64_t)a->u < (int64_t)b->u ? -1 : 1) : (a->u < b->u ? -1 : 1);
+    return 0;
+
+  case TOKEN_FLOAT: {
+    double da, db;
+    memcpy(&da, &a->u, 8);
+    memcpy(&db, &b->u, 8);
+    if (da < db)
+      return -1;
+    if (da > db)
+      return 1;
+    // nan and signed zeros fall back to the bits, matching the hash
+    return a->u == b->u ? 0 : a->u < b->u ? -1 : 1;
+  }
+
+  case TOKEN_EXT:
+    if (a->ext_type != b->ext_type)
+      return a->ext_type < b->ext_type ? -1 : 1;
+    // fallthrough
+  case TOKEN_STRING:
+  case TOKEN_BIN: {
+    int r = memcmp(a->data, b->data, a->u < b->u ? a->u : b->u);
+    if (r != 0)
+      return r < 0 ? -1 : 1;
+    return a->u == b->u ? 0 : a->u < b->u ? -1 : 1;
+  }
+
+  default:
+    return a->u == b->u ? 0 : a->u < b->u ? -1 : 1;
+  }
+}
+
+static void empack_skip_values(buffer_t* s, uint64_t count)
+{
+  empack_type_t skip_type;
+
+  while (count-- > 0 && empack_next_skip(s, &skip_type))
+    ;
+}
+
+// Containers order by size first and then element by element. On a
+// difference both buffers still end up past their whole value.
+int empack_compare(buffer_t* a, buffer_t* b)
+{
+  struct empack_token ta, tb;
+  uint64_t remaining = 1;
+
+  while (remaining-- > 0) {
+    if (!empack_token_read(a, &ta) || !empack_token_read(b, &tb))
+      return 0;
+
+    int r = empack_token_compare(&ta, &tb);
+    if (r != 0) {
+      empack_skip_values(a, remaining + empack_token_children(&ta));
+      empack_skip_values(b, remaining + empack_token_children(&tb));
+      return r;
+    }
+
+    remaining += empack_token_children(&ta);
+  }
+
+  return 0;
+}
+
+bool empack_equal(buffer_t* a, buffer_t* b)
+{
+  buffer_t ea = *a, eb = *b;
+  empack_type_t skip_type;
+
+  // identical encodings are equal without walking the tokens
+  if (empack_next_skip(&ea, &skip_type) && empack_next_skip(&eb, &skip_type)
+      && ea.pos - a->pos == eb.pos - b->pos
+      && memcmp(a->buf + a->pos, b->buf + b->pos, ea.pos - a->pos) == 0) {
+    *a = ea;
+    *b = eb;
+    return true;
+  }
+
+  return empack_compare(a, b) == 0 && !buffer_error(a) && !buffer_error(b);
+}
@@ -0,0 +1,40 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_HASH__
+#define __EMPACK_HASH__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+#include "empack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== Hash / Compare ============== //
+//
+// Work on encoded values in place, so a cache can key on msgpack payloads.
+// Every value is judged by its canonical form: the shortest encoding of
+// each int, float, length and count, which is what the empack writers
+// emit. So a uint32 holding 5 equals a fixint 5, and a float64 holding 0.5
+// equals a float32 0.5. Ints and floats are still distinct types, and
+// map entries are compared in encoded order.
+//
+// Each call consumes one value from each buffer. Malformed input latches
+// the usual sticky error; `empack_compare` then returns 0 and
+// `empack_equal` returns false.
+
+bool empack_hash(buffer_t* s, uint64_t seed, uint64_t* hash);
+bool empack_equal(buffer_t* a, buffer_t* b);
+int empack_compare(buffer_t* a, buffer_t* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
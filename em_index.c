@@ -0,0 +1,386 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_cursor.h"
+#include "em_index.h"
+#include "empack.h"
+
+#define INDEX_MAGIC "EMIX"
+#define INDEX_VERSION 1
+
+bool empack_index_record_key(buffer_t* data, const char* key, uint32_t key_size, int64_t* value)
+{
+  buffer_t rec = *data;
+  empack_cursor_t c;
+  uint32_t map_size, nanoseconds;
+  uint64_t u;
+
+  empack_cursor_init(&c, &rec);
+
+  if (!empack_cursor_enter_map(&c, &map_size) || !empack_cursor_find_key(&c, key, key_size))
+    return false;
+
+  switch (empack_cursor_type(&c)) {
+  case EMPACK_UINT:
+    if (!empack_cursor_read_uint(&c, &u) || u > INT64_MAX)
+      return false;
+    *value = (int64_t)u;
+    return true;
+  case EMPACK_SINT:
+    return empack_cursor_read_sint(&c, value);
+  case EMPACK_EXT:
+    return empack_cursor_read_timestamp(&c, value, &nanoseconds);
+  default:
+    return false;
+  }
+}
+
+// the key searches can binary search when no two block ranges overlap;
+// blocks without a keyed record don't break the ordering
+static void empack_index_order(empack_index_t* idx)
+{
+  int64_t last = INT64_MIN;
+
+  idx->sorted = idx->has_key;
+  for (uint64_t i = 0; i < idx->count; i++) {
+    if (idx->entries[i].min > idx->entries[i].max)
+      continue;
+    if (idx->entries[i].min < last)
+      idx->sorted = false;
+    last = idx->entries[i].max;
+  }
+}
+
+bool empack_index_build(empack_index_t* idx, buffer_t* data, uint32_t stride, const char* key, uint32_t key_size)
+{
+  uint64_t capacity = 0;
+  empack_type_t skip_type;
+
+  memset(idx, 0, sizeof(*idx));
+
+  if (stride == 0 || key_size > EMPACK_INDEX_KEY_MAX)
+    return false;
+
+  idx->stride = stride;
+  idx->has_key = key != NULL;
+  if (key != NULL) {
+    memcpy(idx->key, key, key_size);
+    idx->key_size = key_size;
+  }
+
+  while (data->pos < data->len) {
+    if (idx->records % stride == 0) {
+      if (idx->count == capacity) {
+        capacity = capacity ? capacity * 2 : 64;
+        struct empack_index_entry* grown = realloc(idx->entries, capacity * sizeof(*grown));
+        if (grown == NULL) {
+          empack_index_free(idx);
+          return false;
+        }
+        idx->entries = grown;
+      }
+
+      idx->entries[idx->count].offset = data->pos;
+      idx->entries[idx->count].min = INT64_MAX;
+      idx->entries[idx->count].max = INT64_MIN;
+      idx->count++;
+    }
+
+    struct empack_index_entry* e = &idx->entries[idx->count - 1];
+    int64_t value;
+
+    if (idx->has_key && empack_index_record_key(data, idx->key, idx->key_size, &value)) {
+      e->min = value < e->min ? value : e->min;
+      e->max = value > e->max ? value : e->max;
+    }
+
+    if (!empack_next_skip(data, &skip_type)) {
+      empack_index_free(idx);
+      return false;
+    }
+    idx->records++;
+  }
+
+  idx->size = data->len;
+  empack_index_order(idx);
+  return true;
+}
+
+void empack_index_free(empack_index_t* idx)
+{
+  free(idx->entries);
+  idx->entries = NULL;
+  idx->count = 0;
+}
+
+// ====================== Sidecar ============== //
+
+bool empack_index_save(empack_index_t* idx, const char* path)
+{
+  uint64_t fields = idx->has_key ? 3 : 1;
+  size_t need = 64 + idx->key_size + (size_t)(idx->count * fields * 9);
+  em_byte_t* mem;
+  buffer_t b;
+  bool ok;
+
+  if ((size_t)(em_size_t)need != need || idx->count * fields > UINT32_MAX)
+    return false;
+
+  if ((mem = malloc(need)) == NULL)
+    return false;
+
+  buffer_init(&b, mem, (em_size_t)need);
+  empack_write_array_start(&b, 7);
+  empack_write_string(&b, (em_byte_t*)INDEX_MAGIC, 4);
+  empack_write_u8(&b, INDEX_VERSION);
+  empack_write_u32(&b, idx->stride);
+  empack_write_u64(&b, idx->records);
+  empack_write_u64(&b, idx->size);
+  if (idx->has_key)
+    empack_write_string(&b, (em_byte_t*)idx->key, idx->key_size);
+  else
+    empack_write_nil(&b);
+
+  empack_write_array_start(&b, (uint32_t)(idx->count * fields));
+  for (uint64_t i = 0; i < idx->count; i++) {
+    empack_write_u64(&b, idx->entries[i].offset);
+    if (idx->has_key) {
+      empack_write_i64(&b, idx->entries[i].min);
+      empack_write_i64(&b, idx->entries[i].max);
+    }
+  }
+
+  FILE* f = fopen(path, "wb");
+  ok = f != NULL && !buffer_error(&b) && fwrite(mem, 1, b.pos, f) == b.pos;
+  if (f != NULL)
+    ok = fclose(f) == 0 && ok;
+
+  free(mem);
+  return ok;
+}
+
+static bool empack_index_parse(empack_index_t* idx, buffer_t* b)
+{
+  uint32_t size, count, str_size;
+  uint64_t u;
+  const char* str;
+
+  if (!empack_read_array_size(b, &size) || size != 7)
+    return false;
+
+  if (!empack_read_string_ref(b, &str, &str_size) || str_size != 4 || memcmp(str, INDEX_MAGIC, 4) != 0)
+    return false;
+
+  if (!empack_read_uint(b, (em_byte_t*)&u, 8) || u != INDEX_VERSION)
+    return false;
+
+  if (!empack_read_uint(b, (em_byte_t*)&u, 8) || u == 0 || u > UINT32_MAX)
+    return false;
+  idx->stride = (uint32_t)u;
+
+  if (!empack_read_uint(b, (em_byte_t*)&idx->records, 8) || !empack_read_uint(b, (em_byte_t*)&idx->size, 8))
+    return false;
+
+  if (empack_next_type(b) == EMPACK_NIL) {
+    empack_read_nil(b);
+  } else {
+    if (!empack_read_string_ref(b, &str, &str_size) || str_size > EMPACK_INDEX_KEY_MAX)
+      return false;
+    memcpy(idx->key, str, str_size);
+    idx->key_size = str_size;
+    idx->has_key = true;
+  }
+
+  uint32_t fields = idx->has_key ? 3 : 1;
+  if (!empack_read_array_size(b, &count) || count % fields != 0)
+    return false;
+
+  idx->count = count / fields;
+  if (idx->count != (idx->records + idx->stride - 1) / idx->stride)
+    return false;
+
+  idx->entries = malloc((size_t)idx->count * sizeof(*idx->entries) + 1);
+  if (idx->entries == NULL)
+    return false;
+
+  for (uint64_t i = 0; i < idx->count; i++) {
+    struct empack_index_entry* e = &idx->entries[i];
+    e->min = INT64_MAX;
+    e->max = INT64_MIN;
+
+    if (!empack_read_uint(b, (em_byte_t*)&e->offset, 8))
+      return false;
+    if (idx->has_key && (!empack_read_sint(b, (em_byte_t*)&e->min, 8) || !empack_read_sint(b, (em_byte_t*)&e->max, 8)))
+      return false;
+  }
+
+  empack_index_order(idx);
+  return true;
+}
+
+bool empack_index_load(empack_index_t* idx, const char* path)
+{
+  FILE* f = fopen(path, "rb");
+  em_byte_t* mem = NULL;
+  buffer_t b;
+  long len;
+  bool ok = false;
+
+  memset(idx, 0, sizeof(*idx));
+
+  if (f == NULL)
+    return false;
+
+  if (fseek(f, 0, SEEK_END) == 0 && (len = ftell(f)) > 0 && fseek(f, 0, SEEK_SET) == 0
+      && (size_t)(em_size_t)len == (size_t)len && (mem = malloc((size_t)len)) != NULL
+      && fread(mem, 1, (size_t)len, f) == (size_t)len) {
+    buffer_init(&b, mem, (em_size_t)len);
+    ok = empack_index_parse(idx, &b);
+  }
+
+  fclose(f);
+  free(mem);
+
+  if (!ok)
+    empack_index_free(idx);
+  return ok;
+}
+
+// ====================== Seeking ============== //
+
+static bool empack_index_block(empack_index_t* idx, buffer_t* data, uint64_t block)
+{
+  if (idx->entries[block].offset > data->len) {
+    buffer_set_error(data, EM_ERROR_EOF);
+    return false;
+  }
+
+  data->pos = (em_size_t)idx->entries[block].offset;
+  return true;
+}
+
+bool empack_index_seek(empack_index_t* idx, buffer_t* data, uint64_t record)
+{
+  empack_type_t skip_type;
+
+  if (buffer_error(data) || record >= idx->records)
+    return false;
+
+  if (!empack_index_block(idx, data, record / idx->stride))
+    return false;
+
+  for (uint32_t n = record % idx->stride; n > 0; n--) {
+    if (!empack_next_skip(data, &skip_type))
+      return false;
+  }
+
+  return true;
+}
+
+bool empack_index_seek_key(empack_index_t* idx, buffer_t* data, int64_t key)
+{
+  empack_type_t skip_type;
+  uint64_t block = 0;
+
+  if (buffer_error(data) || !idx->has_key)
+    return false;
+
+  // find a start block at or before the first one whose max reaches the
+  // key, stepping over blocks that hold no keyed record
+  if (idx->sorted) {
+    uint64_t lo = 0, hi = idx->count;
+    while (lo < hi) {
+      uint64_t mid = lo + (hi - lo) / 2, m = mid;
+      while (m < hi && idx->entries[m].min > idx->entries[m].max)
+        m++;
+      if (m < hi && idx->entries[m].max < key)
+        lo = m + 1;
+      else
+        hi = mid;
+    }
+    block = lo;
+  }
+
+  for (; block < idx->count; block++) {
+    if (idx->entries[block].max < key)
+      continue;
+
+    if (!empack_index_block(idx, data, block))
+      return false;
+
+    uint64_t first = block * idx->stride;
+    uint64_t last = first + idx->stride < idx->records ? first + idx->stride : idx->records;
+
+    for (uint64_t n = first; n < last; n++) {
+      int64_t value;
+      if (empack_index_record_key(data, idx->key, idx->key_size, &value) && value >= key)
+        return true;
+      if (!empack_next_skip(data, &skip_type))
+        return false;
+    }
+  }
+
+  return false;
+}
+
+void empack_index_scan_init(empack_index_scan_t* scan, empack_index_t* idx, buffer_t* data, int64_t lo, int64_t hi)
+{
+  scan->idx = idx;
+  scan->data = data;
+  scan->lo = lo;
+  scan->hi = hi;
+  scan->record = 0;
+}
+
+bool empack_index_scan_next(empack_index_scan_t* scan, buffer_t* record)
+{
+  empack_index_t* idx = scan->idx;
+  buffer_t* data = scan->data;
+  empack_type_t skip_type;
+
+  if (!idx->has_key)
+    return false;
+
+  while (scan->record < idx->records && !buffer_error(data)) {
+    if (scan->record % idx->stride == 0) {
+      struct empack_index_entry* e = &idx->entries[scan->record / idx->stride];
+
+      if (idx->sorted && e->min <= e->max && e->min > scan->hi)
+        break;
+
+      if (e->max < scan->lo || e->min > scan->hi) {
+        scan->record += idx->stride;
+        continue;
+      }
+
+      if (!empack_index_block(idx, data, scan->record / idx->stride))
+        return false;
+    }
+
+    em_size_t start = data->pos;
+    int64_t value;
+    bool match = empack_index_record_key(data, idx->key, idx->key_size, &value) && value >= scan->lo
+      && value <= scan->hi;
+
+    if (!empack_next_skip(data, &skip_type))
+      return false;
+    scan->record++;
+
+    if (match) {
+      buffer_init_sub(record, data, start, data->pos - start);
+      return true;
+    }
+  }
+
+  scan->record = idx->records;
+  return false;
+}
@@ -0,0 +1,100 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_INDEX__
+#define __EMPACK_INDEX__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef EMPACK_INDEX_KEY_MAX
+#define EMPACK_INDEX_KEY_MAX 64
+#endif
+
+// ====================== Record Index ============== //
+//
+// Sparse index over a file of back-to-back msgpack records, kept in a
+// sidecar file. Every `stride` records the index stores the byte offset
+// of the block's first record and, when built with a key, the min and max
+// of that map key across the block. Keys are read from top level maps as
+// ints or timestamp ext seconds; records without one are left out of the
+// range and never match a key search.
+//
+// `empack_index_seek` jumps to record N by skipping at most stride - 1
+// records. When the block ranges don't overlap (a log ordered by its
+// timestamp) the key searches binary search the blocks, otherwise they
+// test every block's range; either way only blocks that can hold a match
+// are parsed.
+//
+// The sidecar is itself msgpack:
+// ["EMIX", 1, stride, records, size, key or nil, [offset, (min, max), ...]].
+// `size` is the byte length the index was built against, for callers
+// that want to spot a stale sidecar.
+
+struct empack_index_entry {
+  uint64_t offset;
+  int64_t min;
+  int64_t max;
+};
+
+struct empack_index {
+  uint32_t stride;
+  uint64_t records;
+  uint64_t size;
+  bool has_key;
+  bool sorted;
+  char key[EMPACK_INDEX_KEY_MAX];
+  uint32_t key_size;
+  struct empack_index_entry* entries;
+  uint64_t count;
+};
+
+typedef struct empack_index empack_index_t;
+
+// reads the key of the record at data->pos without moving it
+bool empack_index_record_key(buffer_t* data, const char* key, uint32_t key_size, int64_t* value);
+
+// indexes the records from data->pos to data->len, leaving pos at the end;
+// a NULL key builds an offsets-only index
+bool empack_index_build(empack_index_t* idx, buffer_t* data, uint32_t stride, const char* key, uint32_t key_size);
+void empack_index_free(empack_index_t* idx);
+
+bool empack_index_save(empack_index_t* idx, const char* path);
+bool empack_index_load(empack_index_t* idx, const char* path);
+
+// move data->pos to the start of a record
+bool empack_index_seek(empack_index_t* idx, buffer_t* data, uint64_t record);
+bool empack_index_seek_key(empack_index_t* idx, buffer_t* data, int64_t key);
+
+// ====================== Range Scan ============== //
+//
+// Yields each record whose key lies in [lo, hi] as a buffer_t view,
+// skipping whole blocks whose range can't match.
+
+struct empack_index_scan {
+  empack_index_t* idx;
+  buffer_t* data;
+  int64_t lo;
+  int64_t hi;
+  uint64_t record;
+};
+
+typedef struct empack_index_scan empack_index_scan_t;
+
+void empack_index_scan_init(empack_index_scan_t* scan, empack_index_t* idx, buffer_t* data, int64_t lo, int64_t hi);
+bool empack_index_scan_next(empack_index_scan_t* scan, buffer_t* record);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,145 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_intern.h"
+#include "empack.h"
+
+static uint64_t empack_intern_hash(const char* str, uint32_t size)
+{
+  uint64_t h = 0x9E3779B97F4A7C15ull ^ size;
+  uint64_t w;
+
+  for (; size >= 8; str += 8, size -= 8) {
+    memcpy(&w, str, 8);
+    h = (h ^ w) * 0xBF58476D1CE4E5B9ull;
+    h ^= h >> 31;
+  }
+
+  w = 0;
+  memcpy(&w, str, size);
+  h = (h ^ w) * 0x94D049BB133111EBull;
+  return h ^ h >> 29;
+}
+
+bool empack_intern_init(empack_intern_t* t, uint32_t capacity)
+{
+  memset(t, 0, sizeof(*t));
+
+  if (capacity < 4 || (capacity & (capacity - 1)) != 0)
+    return false;
+
+  t->slots = calloc(capacity, sizeof(*t->slots));
+  t->mask = capacity - 1;
+  return t->slots != NULL;
+}
+
+void empack_intern_destroy(empack_intern_t* t)
+{
+  if (t->slots != NULL) {
+    for (uint32_t i = 0; i <= t->mask; i++)
+      free(t->slots[i]);
+  }
+
+  free(t->slots);
+  t->slots = NULL;
+}
+
+static bool empack_intern_match(const empack_intern_entry_t* e, uint64_t hash, const char* str, uint32_t size)
+{
+  return e->hash == hash && e->size == size && memcmp(e->str, str, size) == 0;
+}
+
+// the copy stays private to this thread until its slot CAS wins
+static empack_intern_entry_t* empack_intern_new(empack_intern_t* t, uint64_t hash, const char* str, uint32_t size)
+{
+  uint32_t capacity = t->mask + 1;
+  empack_intern_entry_t* e;
+
+  if (__atomic_add_fetch(&t->count, 1, __ATOMIC_RELAXED) <= capacity - capacity / 4
+      && (e = malloc(sizeof(*e) + size + 1)) != NULL) {
+    e->hash = hash;
+    e->size = size;
+    memcpy(e->str, str, size);
+    e->str[size] = '\0';
+    return e;
+  }
+
+  __atomic_sub_fetch(&t->count, 1, __ATOMIC_RELAXED);
+  return NULL;
+}
+
+const empack_intern_entry_t* empack_intern_find(empack_intern_t* t, const char* str, uint32_t size)
+{
+  uint64_t hash = empack_intern_hash(str, size);
+
+  for (uint32_t i = (uint32_t)hash & t->mask;; i = (i + 1) & t->mask) {
+    empack_intern_entry_t* e = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+
+    if (e == NULL)
+      return NULL;
+    if (empack_intern_match(e, hash, str, size))
+      return e;
+  }
+}
+
+const empack_intern_entry_t* empack_intern(empack_intern_t* t, const char* str, uint32_t size)
+{
+  uint64_t hash = empack_intern_hash(str, size);
+  empack_intern_entry_t* fresh = NULL;
+
+  for (uint32_t i = (uint32_t)hash & t->mask;; i = (i + 1) & t->mask) {
+    empack_intern_entry_t* e = __atomic_load_n(&t->slots[i], __ATOMIC_ACQUIRE);
+
+    if (e == NULL) {
+      if (fresh == NULL && (fresh = empack_intern_new(t, hash, str, size)) == NULL)
+        return NULL;
+      fresh->id = i;
+      if (__atomic_compare_exchange_n(&t->slots[i], &e, fresh, false, __ATOMIC_RELEASE, __ATOMIC_ACQUIRE))
+        return fresh;
+      // lost the slot, e is whoever won it
+    }
+
+    if (empack_intern_match(e, hash, str, size)) {
+      if (fresh != NULL) {
+        __atomic_sub_fetch(&t->count, 1, __ATOMIC_RELAXED);
+        free(fresh);
+      }
+      return e;
+    }
+  }
+}
+
+const empack_intern_entry_t* empack_intern_get(empack_intern_t* t, uint32_t id)
+{
+  if (id > t->mask)
+    return NULL;
+
+  return __atomic_load_n(&t->slots[id], __ATOMIC_ACQUIRE);
+}
+
+bool empack_read_string_intern(buffer_t* s, empack_intern_t* t, const empack_intern_entry_t** entry)
+{
+  const char* str;
+  uint32_t str_size;
+
+  *entry = NULL;
+
+  if (!empack_read_string_ref(s, &str, &str_size))
+    return false;
+
+  *entry = empack_intern(t, str, str_size);
+  if (*entry == NULL) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return false;
+  }
+
+  return true;
+}
@@ -0,0 +1,66 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_INTERN__
+#define __EMPACK_INTERN__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== String Interning ============== //
+//
+// Deduplicates decoded strings. Each distinct string is stored once, NUL
+// terminated, and gets a stable entry pointer and an integer id below the
+// capacity, so interned strings compare with `==`. `empack_read_string_intern` hashes
+// the payload where it sits in the buffer, so a string already in the
+// table costs no copy or allocation.
+//
+// Lookups are lock-free and never wait; inserts claim a slot with a CAS,
+// so any number of threads can share a table. The capacity is a power of
+// two fixed at init and the table takes up to 3/4 of it; once full,
+// inserts fail and the read latches EM_ERROR_TOO_BIG. Entries live until
+// `empack_intern_destroy`. An entry's id is the slot it was published in,
+// so ids are sparse but never reused, and `empack_intern_get` is one load.
+// A thread that loses the race to insert a string frees its copy before
+// anyone else could have seen it.
+
+struct empack_intern_entry {
+  uint64_t hash;
+  uint32_t id;
+  uint32_t size;
+  char str[];
+};
+
+struct empack_intern {
+  struct empack_intern_entry** slots;
+  uint32_t mask;
+  uint32_t count;
+};
+
+typedef struct empack_intern empack_intern_t;
+typedef struct empack_intern_entry empack_intern_entry_t;
+
+bool empack_intern_init(empack_intern_t* t, uint32_t capacity);
+void empack_intern_destroy(empack_intern_t* t);
+
+// find, or insert on a miss; NULL when the table is full
+const empack_intern_entry_t* empack_intern(empack_intern_t* t, const char* str, uint32_t size);
+const empack_intern_entry_t* empack_intern_find(empack_intern_t* t, const char* str, uint32_t size);
+const empack_intern_entry_t* empack_intern_get(empack_intern_t* t, uint32_t id);
+
+bool empack_read_string_intern(buffer_t* s, empack_intern_t* t, const empack_intern_entry_t** entry);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,194 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_keydict.h"
+#include "empack.h"
+
+#define KEYDICT_INDEX_SIZE (2 * EMPACK_KEYDICT_MAX_KEYS)
+
+// FNV-1a, good enough to spread short ascii keys over the index
+static uint32_t empack_keydict_hash(const char* key, uint32_t key_size)
+{
+  uint32_t h = 2166136261u;
+  for (uint32_t i = 0; i < key_size; i++) {
+    h ^= (uint8_t)key[i];
+    h *= 16777619u;
+  }
+  return h;
+}
+
+void empack_keydict_init(empack_keydict_t* d, bool int_ids)
+{
+  memset(d->index, 0, sizeof(d->index));
+  d->count = 0;
+  d->int_ids = int_ids;
+}
+
+// index slots hold id + 1, zero marks an empty slot
+static uint16_t* empack_keydict_slot(empack_keydict_t* d, const char* key, uint32_t key_size)
+{
+  uint32_t i = empack_keydict_hash(key, key_size) % KEYDICT_INDEX_SIZE;
+
+  for (;;) {
+    uint16_t* slot = &d->index[i];
+    if (*slot == 0)
+      return slot;
+
+    struct empack_keydict_entry* e = &d->keys[*slot - 1];
+    if (e->size == key_size && memcmp(e->key, key, key_size) == 0)
+      return slot;
+
+    i = (i + 1) % KEYDICT_INDEX_SIZE;
+  }
+}
+
+int32_t empack_keydict_find(empack_keydict_t* d, const char* key, uint32_t key_size)
+{
+  return (int32_t)*empack_keydict_slot(d, key, key_size) - 1;
+}
+
+int32_t empack_keydict_add(empack_keydict_t* d, const char* key, uint32_t key_size)
+{
+  uint16_t* slot = empack_keydict_slot(d, key, key_size);
+
+  if (*slot != 0)
+    return *slot - 1;
+
+  if (d->count >= EMPACK_KEYDICT_MAX_KEYS)
+    return -1;
+
+  d->keys[d->count].key = key;
+  d->keys[d->count].size = key_size;
+  *slot = ++d->count;
+  return d->count - 1;
+}
+
+static uint32_t empack_keydict_str_header(uint32_t size)
+{
+  return size <= 31 ? 1 : size <= UINT8_MAX ? 2 : size <= UINT16_MAX ? 3 : 5;
+}
+
+// the dictionary is an ext holding a msgpack array of the keys in id order
+void empack_keydict_write(buffer_t* s, empack_keydict_t* d)
+{
+  uint32_t size = d->count <= 15 ? 1 : 3;
+
+  for (uint16_t i = 0; i < d->count; i++)
+    size += empack_keydict_str_header(d->keys[i].size) + d->keys[i].size;
+
+  empack_write_ext_start(s, EMPACK_EXT_KEYDICT, size);
+  empack_write_array_start(s, d->count);
+
+  for (uint16_t i = 0; i < d->count; i++)
+    empack_write_string(s, (em_byte_t*)d->keys[i].key, d->keys[i].size);
+}
+
+bool empack_keydict_read(buffer_t* s, empack_keydict_t* d)
+{
+  int8_t ext_type;
+  uint32_t ext_size, count = 0;
+  buffer_t payload;
+
+  if (!empack_read_ext_size(s, &ext_type, &ext_size))
+    return false;
+
+  if (ext_type != EMPACK_EXT_KEYDICT) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  if (!buffer_fits(s, ext_size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  buffer_init_sub(&payload, s, s->pos, ext_size);
+  s->pos += ext_size;
+  s->max = s->pos;
+
+  empack_keydict_init(d, d->int_ids);
+
+  if (!empack_read_array_size(&payload, &count) || count > EMPACK_KEYDICT_MAX_KEYS) {
+    buffer_set_error(s, count > EMPACK_KEYDICT_MAX_KEYS ? EM_ERROR_TOO_BIG : EM_ERROR_TYPE);
+    return false;
+  }
+
+  for (uint32_t i = 0; i < count; i++) {
+    const char* key;
+    uint32_t key_size;
+
+    if (!empack_read_string_ref(&payload, &key, &key_size)) {
+      buffer_set_error(s, buffer_error(&payload));
+      return false;
+    }
+
+    empack_keydict_add(d, key, key_size);
+  }
+
+  return true;
+}
+
+void empack_write_key(buffer_t* s, empack_keydict_t* d, const char* key, uint32_t key_size)
+{
+  int32_t id = empack_keydict_find(d, key, key_size);
+  em_byte_t ref[2] = { id >> 8, id & 0xFF };
+
+  if (id < 0)
+    empack_write_string(s, (em_byte_t*)key, key_size);
+  else if (d->int_ids)
+    empack_write_u16(s, id);
+  else if (id <= UINT8_MAX)
+    empack_write_ext(s, EMPACK_EXT_KEYREF, &ref[1], 1);
+  else
+    empack_write_ext(s, EMPACK_EXT_KEYREF, ref, 2);
+}
+
+bool empack_read_key(buffer_t* s, empack_keydict_t* d, const char** key, uint32_t* key_size, int32_t* key_id)
+{
+  uint64_t id = 0;
+  int8_t ext_type;
+  uint32_t ext_size;
+  em_byte_t ref[2];
+
+  switch (empack_next_type(s)) {
+  case EMPACK_STRING:
+    *key_id = -1;
+    return empack_read_string_ref(s, key, key_size);
+
+  case EMPACK_UINT:
+    if (!empack_read_uint(s, (em_byte_t*)&id, 8))
+      return false;
+    break;
+
+  case EMPACK_EXT:
+    if (!empack_read_ext_sz(s, &ext_type, ref, sizeof(ref), &ext_size))
+      return false;
+    if (ext_type != EMPACK_EXT_KEYREF || ext_size == 0) {
+      buffer_set_error(s, EM_ERROR_TYPE);
+      return false;
+    }
+    id = ext_size == 1 ? (uint8_t)ref[0] : ((uint8_t)ref[0] << 8 | (uint8_t)ref[1]);
+    break;
+
+  default:
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  if (id >= d->count) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  *key_id = (int32_t)id;
+  *key = d->keys[id].key;
+  *key_size = d->keys[id].size;
+  return true;
+}
@@ -0,0 +1,76 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_KEYDICT__
+#define __EMPACK_KEYDICT__
+
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+#include "empack.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef EMPACK_KEYDICT_MAX_KEYS
+#define EMPACK_KEYDICT_MAX_KEYS 128
+#endif
+
+// ext type ids used for key references and for the dictionary itself
+#ifndef EMPACK_EXT_KEYREF
+#define EMPACK_EXT_KEYREF 100
+#endif
+
+#ifndef EMPACK_EXT_KEYDICT
+#define EMPACK_EXT_KEYDICT 101
+#endif
+
+// ====================== Key Dictionary ============== //
+//
+// Shared table of map keys. `empack_write_key` writes a key found in the
+// dictionary as a reference to its id: a fixext1/fixext2 of type
+// EMPACK_EXT_KEYREF, or a plain uint when `int_ids` is set and both sides
+// know maps never use integer keys. Unknown keys are written as strings.
+// `empack_read_key` accepts either form and returns the key text along
+// with its id (-1 for a plain string key), so callers can match on ids.
+//
+// The dictionary can be agreed out of band by adding the same keys in the
+// same order on both sides, or sent once at the start of a stream with
+// `empack_keydict_write` and loaded with `empack_keydict_read`. The
+// dictionary only stores pointers: added keys must outlive it, and a
+// dictionary read from a buffer points into that buffer.
+
+struct empack_keydict_entry {
+  const char* key;
+  uint32_t size;
+};
+
+struct empack_keydict {
+  struct empack_keydict_entry keys[EMPACK_KEYDICT_MAX_KEYS];
+  uint16_t index[2 * EMPACK_KEYDICT_MAX_KEYS];
+  uint16_t count;
+  bool int_ids;
+};
+
+typedef struct empack_keydict empack_keydict_t;
+
+void empack_keydict_init(empack_keydict_t* d, bool int_ids);
+
+int32_t empack_keydict_add(empack_keydict_t* d, const char* key, uint32_t key_size);
+int32_t empack_keydict_find(empack_keydict_t* d, const char* key, uint32_t key_size);
+
+void empack_keydict_write(buffer_t* s, empack_keydict_t* d);
+bool empack_keydict_read(buffer_t* s, empack_keydict_t* d);
+
+void empack_write_key(buffer_t* s, empack_keydict_t* d, const char* key, uint32_t key_size);
+bool empack_read_key(buffer_t* s, empack_keydict_t* d, const char** key, uint32_t* key_size, int32_t* key_id);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,223 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+#include "em_buffer.h"
+#include "em_pool.h"
+
+#define POOL_HUGE_PAGE (2u << 20)
+
+static em_byte_t* empack_pool_slab(size_t* size, bool huge_pages, bool* mapped)
+{
+  *mapped = false;
+
+#ifdef __linux__
+  if (huge_pages) {
+    size_t rounded = (*size + POOL_HUGE_PAGE - 1) & ~(size_t)(POOL_HUGE_PAGE - 1);
+    void* p = MAP_FAILED;
+
+#ifdef MAP_HUGETLB
+    p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+#endif
+    // without reserved huge pages, ask for transparent ones instead
+    if (p == MAP_FAILED) {
+      p = mmap(NULL, rounded, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+#ifdef MADV_HUGEPAGE
+      if (p != MAP_FAILED)
+        madvise(p, rounded, MADV_HUGEPAGE);
+#endif
+    }
+
+    if (p != MAP_FAILED) {
+      *size = rounded;
+      *mapped = true;
+      return p;
+    }
+  }
+#else
+  (void)huge_pages;
+#endif
+
+  return malloc(*size);
+}
+
+bool empack_pool_init(empack_pool_t* pool, uint32_t blocks_per_class, bool huge_pages)
+{
+  memset(pool, 0, sizeof(*pool));
+
+  for (uint8_t i = 0; i < EMPACK_POOL_CLASSES; i++) {
+    struct empack_pool_class* c = &pool->classes[i];
+
+    c->block_size = 1u << (EMPACK_POOL_MIN_SHIFT + i);
+    c->blocks = blocks_per_class;
+    c->slab_size = (size_t)c->block_size * blocks_per_class;
+    c->slab = empack_pool_slab(&c->slab_size, huge_pages, &c->mapped);
+    c->next = malloc(sizeof(uint32_t) * blocks_per_class);
+
+    if (c->slab == NULL || c->next == NULL) {
+      empack_pool_destroy(pool);
+      return false;
+    }
+
+    // links hold index + 1 so zero ends the stack
+    for (uint32_t n = 0; n < blocks_per_class; n++)
+      c->next[n] = n + 1 < blocks_per_class ? n + 2 : 0;
+    c->head = blocks_per_class > 0 ? 1 : 0;
+  }
+
+  return true;
+}
+
+void empack_pool_destroy(empack_pool_t* pool)
+{
+  for (uint8_t i = 0; i < EMPACK_POOL_CLASSES; i++) {
+    struct empack_pool_class* c = &pool->classes[i];
+
+#ifdef __linux__
+    if (c->mapped)
+      munmap(c->slab, c->slab_size);
+    else
+#endif
+      free(c->slab);
+
+    free(c->next);
+    c->slab = NULL;
+    c->next = NULL;
+  }
+}
+
+// the head packs a tag that changes on every swap above the index + 1, so
+// a stale pop can't succeed after the same block was popped and pushed back
+static bool empack_pool_pop(struct empack_pool_class* c, uint32_t* index)
+{
+  uint64_t head = __atomic_load_n(&c->head, __ATOMIC_ACQUIRE);
+  uint64_t next;
+
+  do {
+    if ((uint32_t)head == 0) {
+      __atomic_add_fetch(&c->exhausted, 1, __ATOMIC_RELAXED);
+      return false;
+    }
+    next = ((head >> 32) + 1) << 32 | __atomic_load_n(&c->next[(uint32_t)head - 1], __ATOMIC_RELAXED);
+  } while (!__atomic_compare_exchange_n(&c->head, &head, next, true, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+  *index = (uint32_t)head - 1;
+
+  uint32_t used = __atomic_add_fetch(&c->in_use, 1, __ATOMIC_RELAXED);
+  uint32_t high = __atomic_load_n(&c->high_water, __ATOMIC_RELAXED);
+  while (used > high && !__atomic_compare_exchange_n(&c->high_water, &high, used, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+    ;
+
+  return true;
+}
+
+static void empack_pool_push(struct empack_pool_class* c, uint32_t index)
+{
+  uint64_t head = __atomic_load_n(&c->head, __ATOMIC_RELAXED);
+  uint64_t next;
+
+  do {
+    __atomic_store_n(&c->next[index], (uint32_t)head, __ATOMIC_RELAXED);
+    next = ((head >> 32) + 1) << 32 | (index + 1);
+  } while (!__atomic_compare_exchange_n(&c->head, &head, next, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+
+  __atomic_sub_fetch(&c->in_use, 1, __ATOMIC_RELAXED);
+}
+
+bool empack_pool_acquire(empack_pool_t* pool, empack_pool_cache_t* cache, buffer_t* buf, size_t size)
+{
+  uint32_t index;
+  uint8_t i = 0;
+
+  buffer_init(buf, NULL, 0);
+
+  while (i < EMPACK_POOL_CLASSES && pool->classes[i].block_size < size)
+    i++;
+
+  if (i == EMPACK_POOL_CLASSES) {
+    buffer_set_error(buf, EM_ERROR_TOO_BIG);
+    return false;
+  }
+
+  struct empack_pool_class* c = &pool->classes[i];
+
+  if (cache != NULL && cache->count[i] > 0) {
+    index = cache->blocks[i][--cache->count[i]];
+  } else if (!empack_pool_pop(c, &index)) {
+    buffer_set_error(buf, EM_ERROR_OVERFLOW);
+    return false;
+  }
+
+  // compact builds can't address a whole 64k block, use what fits
+  em_size_t len = (em_size_t)c->block_size;
+  if ((size_t)len != c->block_size)
+    len = (em_size_t)~(em_size_t)0;
+
+  buffer_init(buf, c->slab + (size_t)index * c->block_size, len);
+  return true;
+}
+
+void empack_pool_release(empack_pool_t* pool, empack_pool_cache_t* cache, buffer_t* buf)
+{
+  for (uint8_t i = 0; i < EMPACK_POOL_CLASSES; i++) {
+    struct empack_pool_class* c = &pool->classes[i];
+    uintptr_t p = (uintptr_t)buf->buf;
+    uintptr_t base = (uintptr_t)c->slab;
+
+    if (p < base || p - base >= (uintptr_t)c->block_size * c->blocks)
+      continue;
+
+    uint32_t index = (p - base) / c->block_size;
+
+    if (cache == NULL) {
+      empack_pool_push(c, index);
+    } else {
+      // spill half the cache so alternating acquire/release stays local
+      if (cache->count[i] == EMPACK_POOL_CACHE_SIZE) {
+        while (cache->count[i] > EMPACK_POOL_CACHE_SIZE / 2)
+          empack_pool_push(c, cache->blocks[i][--cache->count[i]]);
+      }
+      cache->blocks[i][cache->count[i]++] = index;
+    }
+    break;
+  }
+
+  buffer_init(buf, NULL, 0);
+}
+
+void empack_pool_cache_init(empack_pool_cache_t* cache)
+{
+  memset(cache->count, 0, sizeof(cache->count));
+}
+
+void empack_pool_cache_flush(empack_pool_t* pool, empack_pool_cache_t* cache)
+{
+  for (uint8_t i = 0; i < EMPACK_POOL_CLASSES; i++) {
+    while (cache->count[i] > 0)
+      empack_pool_push(&pool->classes[i], cache->blocks[i][--cache->count[i]]);
+  }
+}
+
+void empack_pool_stats_snapshot(empack_pool_t* pool, struct empack_pool_stats stats[EMPACK_POOL_CLASSES])
+{
+  for (uint8_t i = 0; i < EMPACK_POOL_CLASSES; i++) {
+    struct empack_pool_class* c = &pool->classes[i];
+    stats[i].block_size = c->block_size;
+    stats[i].blocks = c->blocks;
+    stats[i].in_use = __atomic_load_n(&c->in_use, __ATOMIC_RELAXED);
+    stats[i].high_water = __atomic_load_n(&c->high_water, __ATOMIC_RELAXED);
+    stats[i].exhausted = __atomic_load_n(&c->exhausted, __ATOMIC_RELAXED);
+  }
+}
@@ -0,0 +1,106 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_POOL__
+#define __EMPACK_POOL__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// size classes run from 1 << EMPACK_POOL_MIN_SHIFT up, doubling each time
+#ifndef EMPACK_POOL_MIN_SHIFT
+#define EMPACK_POOL_MIN_SHIFT 12
+#endif
+
+#ifndef EMPACK_POOL_CLASSES
+#define EMPACK_POOL_CLASSES 5
+#endif
+
+#ifndef EMPACK_POOL_CACHE_SIZE
+#define EMPACK_POOL_CACHE_SIZE 16
+#endif
+
+#if defined(__cplusplus)
+#define EMPACK_POOL_THREAD_LOCAL thread_local
+#elif __STDC_VERSION__ >= 201112L
+#define EMPACK_POOL_THREAD_LOCAL _Thread_local
+#else
+#define EMPACK_POOL_THREAD_LOCAL __thread
+#endif
+
+// ====================== Buffer Pool ============== //
+//
+// Fixed-size blocks for scratch buffers, carved out of one slab per size
+// class at init. Each class keeps its free blocks on a lock-free stack
+// (an index plus an ABA tag, swapped with one CAS), so any thread can
+// acquire and release. On Linux the slabs can be backed by huge pages.
+//
+// A cache holds a few free blocks per class for one thread; with it,
+// acquire and release are a local pop and push that only touch the shared
+// stack to refill or spill. Declare one per thread, for instance as
+// `static EMPACK_POOL_THREAD_LOCAL empack_pool_cache_t cache;`, and flush it
+// before the thread exits. Passing a NULL cache goes to the shared stack.
+//
+// Acquire hands back a buffer_init'ed buffer over the block. When no block
+// fits the buffer is left empty with EM_ERROR_TOO_BIG or EM_ERROR_OVERFLOW
+// latched, so writes into it fail like any other full buffer.
+
+struct empack_pool_class {
+  em_byte_t* slab;
+  size_t slab_size;
+  bool mapped;
+  uint32_t block_size;
+  uint32_t blocks;
+  uint32_t* next;
+  uint64_t head;
+  uint32_t in_use;
+  uint32_t high_water;
+  uint64_t exhausted;
+};
+
+struct empack_pool {
+  struct empack_pool_class classes[EMPACK_POOL_CLASSES];
+};
+
+struct empack_pool_cache {
+  uint32_t count[EMPACK_POOL_CLASSES];
+  uint32_t blocks[EMPACK_POOL_CLASSES][EMPACK_POOL_CACHE_SIZE];
+};
+
+// blocks out of the shared stack, counting those parked in thread caches
+struct empack_pool_stats {
+  uint32_t block_size;
+  uint32_t blocks;
+  uint32_t in_use;
+  uint32_t high_water;
+  uint64_t exhausted;
+};
+
+typedef struct empack_pool empack_pool_t;
+typedef struct empack_pool_cache empack_pool_cache_t;
+
+bool empack_pool_init(empack_pool_t* pool, uint32_t blocks_per_class, bool huge_pages);
+void empack_pool_destroy(empack_pool_t* pool);
+
+bool empack_pool_acquire(empack_pool_t* pool, empack_pool_cache_t* cache, buffer_t* buf, size_t size);
+void empack_pool_release(empack_pool_t* pool, empack_pool_cache_t* cache, buffer_t* buf);
+
+void empack_pool_cache_init(empack_pool_cache_t* cache);
+void empack_pool_cache_flush(empack_pool_t* pool, empack_pool_cache_t* cache);
+
+void empack_pool_stats_snapshot(empack_pool_t* pool, struct empack_pool_stats stats[EMPACK_POOL_CLASSES]);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
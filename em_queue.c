@@ -0,0 +1,150 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#define _DEFAULT_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef __unix__
+#include <sched.h>
+#endif
+
+#include "em_buffer.h"
+#include "em_queue.h"
+
+// every frame starts with its payload length and its span in the ring
+#define QUEUE_HEADER 8
+#define QUEUE_SKIP UINT32_MAX
+#define QUEUE_ALIGN(n) (((n) + 7) & ~(uint64_t)7)
+
+// frame headers store lengths and spans in 32 bits, with UINT32_MAX as skip
+#define QUEUE_MAX_CAPACITY ((uint64_t)1 << 31)
+
+bool empack_queue_init(empack_queue_t* q, em_byte_t* storage, size_t capacity, bool multi_producer)
+{
+  memset(q, 0, sizeof(*q));
+
+  if (capacity < QUEUE_HEADER || (capacity & (capacity - 1)) != 0 || (uint64_t)capacity > QUEUE_MAX_CAPACITY)
+    return false;
+
+  q->buf = storage;
+  q->mask = capacity - 1;
+  q->multi_producer = multi_producer;
+  return true;
+}
+
+static void empack_queue_header(em_byte_t* p, uint32_t len, uint32_t span)
+{
+  memcpy(p, &len, 4);
+  memcpy(p + 4, &span, 4);
+}
+
+bool empack_queue_reserve(empack_queue_t* q, empack_queue_slot_t* slot, em_size_t size)
+{
+  uint64_t cap = (uint64_t)q->mask + 1;
+  uint64_t need = QUEUE_ALIGN(QUEUE_HEADER + (uint64_t)size);
+  uint64_t start, frame, end;
+
+  buffer_init(&slot->buf, NULL, 0);
+
+  if (need > cap) {
+    buffer_set_error(&slot->buf, EM_ERROR_TOO_BIG);
+    return false;
+  }
+
+  // the lone producer's publish moves the claim back, so only one slot
+  // may be out at a time
+  if (!q->multi_producer && q->reserved) {
+    buffer_set_error(&slot->buf, EM_ERROR_OVERFLOW);
+    return false;
+  }
+
+  start = __atomic_load_n(&q->claim, __ATOMIC_RELAXED);
+
+  do {
+    uint64_t off = start & q->mask;
+
+    // a frame that would straddle the end of the ring starts over at the front
+    frame = off + need > cap ? start + (cap - off) : start;
+    end = frame + need;
+
+    if (end - __atomic_load_n(&q->head, __ATOMIC_ACQUIRE) > cap) {
+      buffer_set_error(&slot->buf, EM_ERROR_OVERFLOW);
+      return false;
+    }
+
+    if (!q->multi_producer) {
+      q->claim = end;
+      q->reserved = true;
+      break;
+    }
+  } while (!__atomic_compare_exchange_n(&q->claim, &start, end, true, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+  slot->start = start;
+  slot->frame = frame;
+  slot->end = end;
+  buffer_init(&slot->buf, q->buf + (frame & q->mask) + QUEUE_HEADER, need - QUEUE_HEADER);
+  return true;
+}
+
+void empack_queue_publish(empack_queue_t* q, empack_queue_slot_t* slot)
+{
+  uint32_t len = buffer_error(&slot->buf) ? QUEUE_SKIP : (uint32_t)slot->buf.pos;
+  uint64_t end = slot->end;
+
+  if (slot->start != slot->frame)
+    empack_queue_header(q->buf + (slot->start & q->mask), QUEUE_SKIP, slot->frame - slot->start);
+
+  // a lone producer hands back the room it reserved but didn't use
+  if (!q->multi_producer) {
+    if (len != QUEUE_SKIP) {
+      end = slot->frame + QUEUE_ALIGN(QUEUE_HEADER + (uint64_t)len);
+      q->claim = end;
+    }
+    q->reserved = false;
+  }
+
+  empack_queue_header(q->buf + (slot->frame & q->mask), len, end - slot->frame);
+
+  if (q->multi_producer) {
+    while (__atomic_load_n(&q->publish, __ATOMIC_ACQUIRE) != slot->start) {
+#ifdef __unix__
+      sched_yield();
+#endif
+    }
+  }
+
+  __atomic_store_n(&q->publish, end, __ATOMIC_RELEASE);
+  buffer_init(&slot->buf, NULL, 0);
+}
+
+// fills `frames` with views of published frames, valid until the release
+uint32_t empack_queue_dequeue(empack_queue_t* q, buffer_t* frames, uint32_t max_frames)
+{
+  uint64_t published = __atomic_load_n(&q->publish, __ATOMIC_ACQUIRE);
+  uint32_t n = 0;
+
+  while (n < max_frames && q->read < published) {
+    em_byte_t* p = q->buf + (q->read & q->mask);
+    uint32_t len, span;
+
+    memcpy(&len, p, 4);
+    memcpy(&span, p + 4, 4);
+
+    if (len != QUEUE_SKIP)
+      buffer_init(&frames[n++], p + QUEUE_HEADER, len);
+
+    q->read += span;
+  }
+
+  return n;
+}
+
+void empack_queue_release(empack_queue_t* q)
+{
+  __atomic_store_n(&q->head, q->read, __ATOMIC_RELEASE);
+}
@@ -0,0 +1,79 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_QUEUE__
+#define __EMPACK_QUEUE__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef EMPACK_QUEUE_CACHE_LINE
+#define EMPACK_QUEUE_CACHE_LINE 64
+#endif
+
+// ====================== Message Queue ============== //
+//
+// Ring of msgpack frames over caller storage, for handing messages between
+// threads without copies or allocation. A producer reserves room for a
+// frame, encodes straight into the slot's buffer with the empack_write_*
+// calls and publishes it; the consumer dequeues batches of frames as
+// buffer_t views into the ring and releases them once done.
+//
+// Frames are contiguous: one that would straddle the end of the ring
+// starts over at the front and the gap is skipped. The capacity must be a
+// power of two no larger than 2 GiB, and the storage 8 byte aligned.
+//
+// There is one consumer. Without `multi_producer` there is one producer
+// and it holds at most one reservation at a time: publishing hands back
+// the room the frame didn't use, so reserving again before publishing
+// fails with EM_ERROR_OVERFLOW. With `multi_producer` set, producers claim
+// space with a CAS and publish in claim order, so a producer may briefly
+// wait on one that reserved before it. A slot whose buffer latched an
+// error is published as padding and never delivered.
+
+struct empack_queue {
+  em_byte_t* buf;
+  size_t mask;
+  bool multi_producer;
+  char pad0[EMPACK_QUEUE_CACHE_LINE];
+  uint64_t claim;
+  bool reserved;
+  char pad1[EMPACK_QUEUE_CACHE_LINE - sizeof(uint64_t) - sizeof(bool)];
+  uint64_t publish;
+  char pad2[EMPACK_QUEUE_CACHE_LINE - sizeof(uint64_t)];
+  uint64_t head;
+  uint64_t read;
+};
+
+struct empack_queue_slot {
+  buffer_t buf;
+  uint64_t start;
+  uint64_t frame;
+  uint64_t end;
+};
+
+typedef struct empack_queue empack_queue_t;
+typedef struct empack_queue_slot empack_queue_slot_t;
+
+bool empack_queue_init(empack_queue_t* q, em_byte_t* storage, size_t capacity, bool multi_producer);
+
+bool empack_queue_reserve(empack_queue_t* q, empack_queue_slot_t* slot, em_size_t size);
+void empack_queue_publish(empack_queue_t* q, empack_queue_slot_t* slot);
+
+uint32_t empack_queue_dequeue(empack_queue_t* q, buffer_t* frames, uint32_t max_frames);
+void empack_queue_release(empack_queue_t* q);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,146 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
+
+#include "em_buffer.h"
+#include "em_ring.h"
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+// maps one memfd twice inside a single reservation, so the second copy
+// mirrors the first byte for byte
+static em_byte_t* empack_ring_mirror(size_t capacity)
+{
+  int fd = memfd_create("empack_ring", MFD_CLOEXEC);
+  em_byte_t* base = MAP_FAILED;
+
+  if (fd < 0)
+    return NULL;
+
+  if (ftruncate(fd, capacity) == 0)
+    base = mmap(NULL, 2 * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+  if (base != MAP_FAILED
+      && (mmap(base, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED
+          || mmap(base + capacity, capacity, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_FIXED, fd, 0) == MAP_FAILED)) {
+    munmap(base, 2 * capacity);
+    base = MAP_FAILED;
+  }
+
+  close(fd);
+  return base == MAP_FAILED ? NULL : base;
+}
+#endif
+
+bool empack_ring_init(empack_ring_t* r, size_t capacity)
+{
+  r->read = 0;
+  r->write = 0;
+  r->mirrored = false;
+  r->buf = NULL;
+
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  size_t page = (size_t)sysconf(_SC_PAGESIZE);
+  size_t rounded = (capacity + page - 1) / page * page;
+
+  r->buf = empack_ring_mirror(rounded);
+  if (r->buf != NULL) {
+    r->capacity = rounded;
+    r->mirrored = true;
+    return true;
+  }
+#endif
+
+  r->capacity = capacity;
+  r->buf = malloc(capacity);
+  return r->buf != NULL;
+}
+
+void empack_ring_destroy(empack_ring_t* r)
+{
+#if defined(__linux__) && defined(MFD_CLOEXEC)
+  if (r->mirrored)
+    munmap(r->buf, 2 * r->capacity);
+  else
+#endif
+    free(r->buf);
+
+  r->buf = NULL;
+}
+
+size_t empack_ring_size(empack_ring_t* r)
+{
+  return r->write - r->read;
+}
+
+em_byte_t* empack_ring_write_ptr(empack_ring_t* r, size_t* space)
+{
+  if (!r->mirrored) {
+    // move the tail only once the free room at the front outgrows the end
+    if (r->read == r->write) {
+      r->read = r->write = 0;
+    } else if (r->capacity - r->write < r->read) {
+      memmove(r->buf, r->buf + r->read, r->write - r->read);
+      r->write -= r->read;
+      r->read = 0;
+    }
+    *space = r->capacity - r->write;
+  } else {
+    *space = r->capacity - (r->write - r->read);
+  }
+
+  return r->buf + r->write;
+}
+
+void empack_ring_produce(empack_ring_t* r, size_t count)
+{
+  r->write += count;
+}
+
+// views are capped at what em_size_t can address
+static em_size_t empack_ring_len(size_t len)
+{
+  em_size_t n = (em_size_t)len;
+  return (size_t)n == len ? n : (em_size_t)~(em_size_t)0;
+}
+
+void empack_ring_writer(empack_ring_t* r, buffer_t* b)
+{
+  size_t space;
+  em_byte_t* p = empack_ring_write_ptr(r, &space);
+
+  buffer_init(b, p, empack_ring_len(space));
+}
+
+void empack_ring_commit(empack_ring_t* r, buffer_t* b)
+{
+  if (!buffer_error(b))
+    empack_ring_produce(r, b->pos);
+}
+
+void empack_ring_reader(empack_ring_t* r, buffer_t* b)
+{
+  buffer_init(b, r->buf + r->read, empack_ring_len(r->write - r->read));
+}
+
+void empack_ring_consume(empack_ring_t* r, buffer_t* b)
+{
+  r->read += b->pos;
+
+  if (r->mirrored && r->read >= r->capacity) {
+    r->read -= r->capacity;
+    r->write -= r->capacity;
+  }
+}
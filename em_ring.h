@@ -0,0 +1,65 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_RING__
+#define __EMPACK_RING__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== Stream Ring ============== //
+//
+// Circular byte buffer for long-lived streams. On Linux the ring's pages
+// are mapped twice, back to back, so the unread bytes and the free space
+// are always contiguous in memory even when they wrap: `empack_ring_reader`
+// gives a plain buffer_t view that the empack_read_* calls parse
+// unchanged, and nothing is ever moved. The capacity is rounded up to the
+// page size.
+//
+// Where the mirror can't be set up the ring falls back to one flat
+// buffer and moves the unread tail to the front only when the free space
+// at the end runs out, rather than after every message.
+//
+// Typical use: fill from `empack_ring_write_ptr` + `empack_ring_produce`
+// or an `empack_ring_writer` buffer, parse whole messages off a reader
+// view, set its pos back to the start of a partial message, and hand it to
+// `empack_ring_consume`.
+
+struct empack_ring {
+  em_byte_t* buf;
+  size_t capacity;
+  size_t read;
+  size_t write;
+  bool mirrored;
+};
+
+typedef struct empack_ring empack_ring_t;
+
+bool empack_ring_init(empack_ring_t* r, size_t capacity);
+void empack_ring_destroy(empack_ring_t* r);
+
+size_t empack_ring_size(empack_ring_t* r);
+
+em_byte_t* empack_ring_write_ptr(empack_ring_t* r, size_t* space);
+void empack_ring_produce(empack_ring_t* r, size_t count);
+
+void empack_ring_writer(empack_ring_t* r, buffer_t* b);
+void empack_ring_commit(empack_ring_t* r, buffer_t* b);
+
+void empack_ring_reader(empack_ring_t* r, buffer_t* b);
+void empack_ring_consume(empack_ring_t* r, buffer_t* b);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,535 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#define _GNU_SOURCE
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define EMPACK_SORT_POSIX
+#include <pthread.h>
+#include <unistd.h>
+#endif
+
+#include "em_buffer.h"
+#include "em_index.h"
+#include "em_sort.h"
+#include "empack.h"
+
+// slices smaller than this aren't worth a thread
+#define SORT_MIN_SLICE 1024
+#define SORT_INSERTION 16
+
+// records without the key sort after every keyed one
+struct empack_sort_entry {
+  int64_t key;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t missing;
+};
+
+// what a spilled run stores ahead of each record
+struct empack_sort_header {
+  int64_t key;
+  uint32_t size;
+  uint32_t missing;
+};
+
+struct empack_sort_list {
+  struct empack_sort_entry* entries;
+  size_t count;
+  size_t capacity;
+};
+
+static bool empack_sort_before(const struct empack_sort_entry* a, const struct empack_sort_entry* b)
+{
+  if (a->missing != b->missing)
+    return a->missing < b->missing;
+  return a->key < b->key;
+}
+
+// ====================== In Memory ============== //
+
+// merges [lo, mid) and [mid, hi) of src into dst, left first on ties
+static void empack_sort_merge(const struct empack_sort_entry* src, struct empack_sort_entry* dst, size_t lo,
+    size_t mid, size_t hi)
+{
+  size_t i = lo, j = mid, k = lo;
+
+  while (i < mid && j < hi)
+    dst[k++] = empack_sort_before(&src[j], &src[i]) ? src[j++] : src[i++];
+
+  memcpy(dst + k, src + i, (mid - i) * sizeof(*dst));
+  k += mid - i;
+  memcpy(dst + k, src + j, (hi - j) * sizeof(*dst));
+}
+
+// stable bottom-up merge sort, tmp as long as e
+static void empack_sort_range(struct empack_sort_entry* e, struct empack_sort_entry* tmp, size_t n)
+{
+  struct empack_sort_entry *src = e, *dst = tmp, *swap;
+
+  for (size_t lo = 0; lo < n; lo += SORT_INSERTION) {
+    size_t hi = lo + SORT_INSERTION < n ? lo + SORT_INSERTION : n;
+    for (size_t i = lo + 1; i < hi; i++) {
+      struct empack_sort_entry x = e[i];
+      size_t j = i;
+      for (; j > lo && empack_sort_before(&x, &e[j - 1]); j--)
+        e[j] = e[j - 1];
+      e[j] = x;
+    }
+  }
+
+  for (size_t width = SORT_INSERTION; width < n; width *= 2) {
+    for (size_t lo = 0; lo < n; lo += 2 * width) {
+      size_t mid = lo + width < n ? lo + width : n;
+      size_t hi = lo + 2 * width < n ? lo + 2 * width : n;
+      empack_sort_merge(src, dst, lo, mid, hi);
+    }
+    swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != e)
+    memcpy(e, src, n * sizeof(*e));
+}
+
+struct empack_sort_task {
+  struct empack_sort_entry* src;
+  struct empack_sort_entry* dst;
+  size_t lo;
+  size_t mid;
+  size_t hi;
+  bool merge;
+};
+
+static void* empack_sort_task_run(void* arg)
+{
+  struct empack_sort_task* t = arg;
+
+  if (t->merge)
+    empack_sort_merge(t->src, t->dst, t->lo, t->mid, t->hi);
+  else
+    empack_sort_range(t->src + t->lo, t->dst + t->lo, t->hi - t->lo);
+  return NULL;
+}
+
+// runs the tasks in parallel, falling back to the calling thread
+static void empack_sort_tasks(struct empack_sort_task* tasks, uint32_t count)
+{
+#ifdef EMPACK_SORT_POSIX
+  pthread_t threads[EMPACK_SORT_MAX_THREADS];
+  bool started[EMPACK_SORT_MAX_THREADS] = { false };
+
+  for (uint32_t i = 1; i < count; i++)
+    started[i] = pthread_create(&threads[i], NULL, empack_sort_task_run, &tasks[i]) == 0;
+
+  empack_sort_task_run(&tasks[0]);
+
+  for (uint32_t i = 1; i < count; i++) {
+    if (started[i])
+      pthread_join(threads[i], NULL);
+    else
+      empack_sort_task_run(&tasks[i]);
+  }
+#else
+  for (uint32_t i = 0; i < count; i++)
+    empack_sort_task_run(&tasks[i]);
+#endif
+}
+
+// each thread sorts a slice, then rounds of parallel merges join them
+static bool empack_sort_list_sort(struct empack_sort_list* list, uint32_t threads)
+{
+  struct empack_sort_task tasks[EMPACK_SORT_MAX_THREADS];
+  size_t bounds[EMPACK_SORT_MAX_THREADS + 1];
+  struct empack_sort_entry *src = list->entries, *dst, *swap;
+  size_t n = list->count;
+
+  if (n < 2)
+    return true;
+
+  if ((dst = malloc(n * sizeof(*dst))) == NULL)
+    return false;
+
+  threads = threads < EMPACK_SORT_MAX_THREADS ? threads : EMPACK_SORT_MAX_THREADS;
+  threads = threads < n / SORT_MIN_SLICE ? threads : (uint32_t)(n / SORT_MIN_SLICE);
+  threads = threads > 0 ? threads : 1;
+
+  for (uint32_t i = 0; i <= threads; i++)
+    bounds[i] = n / threads * i + (n % threads) * i / threads;
+
+  for (uint32_t i = 0; i < threads; i++)
+    tasks[i] = (struct empack_sort_task) { src, dst, bounds[i], 0, bounds[i + 1], false };
+  empack_sort_tasks(tasks, threads);
+
+  for (uint32_t width = 1; width < threads; width *= 2) {
+    uint32_t count = 0;
+
+    for (uint32_t i = 0; i < threads; i += 2 * width) {
+      uint32_t mid = i + width < threads ? i + width : threads;
+      uint32_t hi = i + 2 * width < threads ? i + 2 * width : threads;
+      tasks[count++] = (struct empack_sort_task) { src, dst, bounds[i], bounds[mid], bounds[hi], true };
+    }
+    empack_sort_tasks(tasks, count);
+
+    swap = src;
+    src = dst;
+    dst = swap;
+  }
+
+  if (src != list->entries) {
+    memcpy(list->entries, src, n * sizeof(*src));
+    dst = src;
+  }
+
+  free(dst);
+  return true;
+}
+
+// reads the key and extent of each record from data->pos; with `partial`
+// a record cut off by the end of the data is left for the next call
+static bool empack_sort_scan(buffer_t* data, const empack_sort_options_t* opts, struct empack_sort_list* list,
+    bool partial)
+{
+  empack_type_t skip_type;
+
+  list->count = 0;
+
+  while (data->pos < data->len) {
+    em_size_t start = data->pos;
+    struct empack_sort_entry* e;
+
+    if (list->count == list->capacity) {
+      size_t capacity = list->capacity ? list->capacity * 2 : 1024;
+      struct empack_sort_entry* grown = realloc(list->entries, capacity * sizeof(*grown));
+      if (grown == NULL)
+        return false;
+      list->entries = grown;
+      list->capacity = capacity;
+    }
+
+    e = &list->entries[list->count];
+    e->missing = !empack_index_record_key(data, opts->key, opts->key_size, &e->key);
+    if (e->missing)
+      e->key = 0;
+
+    // a record cut between two values ends the skip without an error
+    if (!empack_next_skip(data, &skip_type)) {
+      if (!partial || (buffer_error(data) != EM_OK && buffer_error(data) != EM_ERROR_EOF))
+        return false;
+      data->pos = start;
+      return true;
+    }
+
+    if ((uint64_t)(data->pos - start) > UINT32_MAX)
+      return false;
+
+    e->offset = start;
+    e->size = (uint32_t)(data->pos - start);
+    list->count++;
+  }
+
+  return true;
+}
+
+bool empack_sort_buffer(buffer_t* in, buffer_t* out, const empack_sort_options_t* opts)
+{
+  struct empack_sort_list list = { NULL, 0, 0 };
+  em_size_t start = in->pos;
+  bool ok;
+
+  if (buffer_error(in) || buffer_error(out))
+    return false;
+
+  if (!buffer_fits(out, in->len - start)) {
+    buffer_set_error(out, EM_ERROR_OVERFLOW);
+    return false;
+  }
+
+  ok = empack_sort_scan(in, opts, &list, false) && empack_sort_list_sort(&list, opts->threads);
+
+  for (size_t i = 0; ok && i < list.count; i++)
+    buffer_write(out, in->buf + list.entries[i].offset, list.entries[i].size);
+
+  free(list.entries);
+  return ok && !buffer_error(out);
+}
+
+// ====================== Runs ============== //
+
+static FILE* empack_sort_tmp(const char* dir)
+{
+#ifdef EMPACK_SORT_POSIX
+  if (dir != NULL) {
+    size_t len = strlen(dir) + sizeof("/empack_sort_XXXXXX");
+    char* path = malloc(len);
+    FILE* f = NULL;
+    int fd;
+
+    if (path == NULL)
+      return NULL;
+
+    snprintf(path, len, "%s/empack_sort_XXXXXX", dir);
+    if ((fd = mkstemp(path)) >= 0) {
+      // unlinked right away, so the run goes when it's closed
+      unlink(path);
+      if ((f = fdopen(fd, "w+b")) == NULL)
+        close(fd);
+    }
+
+    free(path);
+    return f;
+  }
+#else
+  (void)dir;
+#endif
+
+  return tmpfile();
+}
+
+static bool empack_sort_emit(FILE* f, const em_byte_t* base, struct empack_sort_list* list, bool headers)
+{
+  for (size_t i = 0; i < list->count; i++) {
+    struct empack_sort_entry* e = &list->entries[i];
+    struct empack_sort_header h = { e->key, e->size, e->missing };
+
+    if (headers && fwrite(&h, sizeof(h), 1, f) != 1)
+      return false;
+    if (fwrite(base + e->offset, 1, e->size, f) != e->size)
+      return false;
+  }
+
+  return true;
+}
+
+struct empack_sort_reader {
+  FILE* f;
+  struct empack_sort_entry head;
+  em_byte_t* record;
+  size_t capacity;
+};
+
+// loads the run's next record, false at the end or on an error
+static bool empack_sort_reader_next(struct empack_sort_reader* r, bool* ok)
+{
+  struct empack_sort_header h;
+
+  if (fread(&h, sizeof(h), 1, r->f) != 1) {
+    *ok = *ok && !ferror(r->f);
+    return false;
+  }
+
+  if (h.size > r->capacity) {
+    em_byte_t* grown = realloc(r->record, h.size);
+    if (grown == NULL) {
+      *ok = false;
+      return false;
+    }
+    r->record = grown;
+    r->capacity = h.size;
+  }
+
+  if (fread(r->record, 1, h.size, r->f) != h.size) {
+    *ok = false;
+    return false;
+  }
+
+  r->head.key = h.key;
+  r->head.size = h.size;
+  r->head.missing = h.missing;
+  return true;
+}
+
+// orders by key, then by run so equal keys keep their input order
+static bool empack_sort_reader_before(struct empack_sort_reader* readers, uint32_t a, uint32_t b)
+{
+  if (empack_sort_before(&readers[a].head, &readers[b].head))
+    return true;
+  return !empack_sort_before(&readers[b].head, &readers[a].head) && a < b;
+}
+
+static void empack_sort_sift(struct empack_sort_reader* readers, uint32_t* heap, uint32_t n, uint32_t i)
+{
+  for (;;) {
+    uint32_t least = i, l = 2 * i + 1, r = 2 * i + 2, t;
+
+    if (l < n && empack_sort_reader_before(readers, heap[l], heap[least]))
+      least = l;
+    if (r < n && empack_sort_reader_before(readers, heap[r], heap[least]))
+      least = r;
+    if (least == i)
+      return;
+
+    t = heap[i];
+    heap[i] = heap[least];
+    heap[least] = t;
+    i = least;
+  }
+}
+
+// k-way merges the runs into out, with headers when out is another run
+static bool empack_sort_merge_runs(FILE** runs, uint32_t count, FILE* out, bool headers)
+{
+  struct empack_sort_reader readers[EMPACK_SORT_FANIN];
+  uint32_t heap[EMPACK_SORT_FANIN];
+  uint32_t n = 0;
+  bool ok = true;
+
+  for (uint32_t i = 0; i < count; i++) {
+    readers[i] = (struct empack_sort_reader) { runs[i], { 0, 0, 0, 0 }, NULL, 0 };
+    if (empack_sort_reader_next(&readers[i], &ok))
+      heap[n++] = i;
+  }
+
+  for (uint32_t i = n / 2; i-- > 0;)
+    empack_sort_sift(readers, heap, n, i);
+
+  while (ok && n > 0) {
+    struct empack_sort_reader* r = &readers[heap[0]];
+    struct empack_sort_header h = { r->head.key, r->head.size, r->head.missing };
+
+    if (headers && fwrite(&h, sizeof(h), 1, out) != 1)
+      ok = false;
+    if (fwrite(r->record, 1, r->head.size, out) != r->head.size)
+      ok = false;
+
+    if (!empack_sort_reader_next(r, &ok))
+      heap[0] = heap[--n];
+    empack_sort_sift(readers, heap, n, 0);
+  }
+
+  for (uint32_t i = 0; i < count; i++)
+    free(readers[i].record);
+  return ok;
+}
+
+static bool empack_sort_push(FILE*** runs, size_t* count, size_t* capacity, FILE* run)
+{
+  if (*count == *capacity) {
+    size_t grown_capacity = *capacity ? *capacity * 2 : 16;
+    FILE** grown = realloc(*runs, grown_capacity * sizeof(*grown));
+    if (grown == NULL)
+      return false;
+    *runs = grown;
+    *capacity = grown_capacity;
+  }
+
+  (*runs)[(*count)++] = run;
+  return true;
+}
+
+// ====================== Files ============== //
+
+bool empack_sort_file(const char* in_path, const char* out_path, const empack_sort_options_t* opts)
+{
+  struct empack_sort_list list = { NULL, 0, 0 };
+  size_t limit = (em_size_t)~(em_size_t)0;
+  size_t capacity = opts->run_size ? opts->run_size : EMPACK_SORT_RUN_SIZE;
+  size_t have = 0, count = 0, runs_capacity = 0;
+  FILE *in, *out = NULL, *run;
+  FILE** runs = NULL;
+  em_byte_t* mem = NULL;
+  bool ok = false, eof = false, done = false, spilled = false;
+  buffer_t b;
+
+  // each run is read through a buffer_t
+  capacity = capacity < limit ? capacity : limit;
+
+  if ((in = fopen(in_path, "rb")) == NULL)
+    return false;
+
+  mem = malloc(capacity);
+
+  while (mem != NULL && !eof) {
+    have += fread(mem + have, 1, capacity - have, in);
+    eof = have < capacity;
+    if (ferror(in))
+      break;
+
+    buffer_init(&b, mem, (em_size_t)have);
+    if (!empack_sort_scan(&b, opts, &list, !eof))
+      break;
+
+    // a record longer than a run gets a bigger one
+    if (list.count == 0 && !eof) {
+      em_byte_t* grown = capacity < limit ? realloc(mem, capacity < limit / 2 ? capacity * 2 : limit) : NULL;
+      if (grown == NULL)
+        break;
+      mem = grown;
+      capacity = capacity < limit / 2 ? capacity * 2 : limit;
+      continue;
+    }
+
+    if (!empack_sort_list_sort(&list, opts->threads))
+      break;
+
+    // everything fit in one run, so there's nothing to spill
+    if (eof && count == 0) {
+      ok = (out = fopen(out_path, "wb")) != NULL && empack_sort_emit(out, mem, &list, false);
+      done = true;
+      break;
+    }
+
+    if ((run = empack_sort_tmp(opts->tmp_dir)) == NULL)
+      break;
+    if (!empack_sort_push(&runs, &count, &runs_capacity, run)) {
+      fclose(run);
+      break;
+    }
+    if (!empack_sort_emit(run, mem, &list, true) || fflush(run) != 0)
+      break;
+    rewind(run);
+
+    memmove(mem, mem + b.pos, have - b.pos);
+    have -= b.pos;
+    spilled = eof;
+  }
+
+  free(mem);
+  free(list.entries);
+  fclose(in);
+
+  ok = done ? ok : spilled;
+
+  // merge passes until one more reaches the output
+  while (ok && !done && count > EMPACK_SORT_FANIN) {
+    size_t merged = 0;
+
+    for (size_t i = 0; i < count; i += EMPACK_SORT_FANIN) {
+      uint32_t k = (uint32_t)(count - i < EMPACK_SORT_FANIN ? count - i : EMPACK_SORT_FANIN);
+
+      // once a pass fails its remaining runs are just closed
+      run = ok ? empack_sort_tmp(opts->tmp_dir) : NULL;
+      ok = run != NULL && empack_sort_merge_runs(runs + i, k, run, true) && fflush(run) == 0;
+      for (uint32_t j = 0; j < k; j++)
+        fclose(runs[i + j]);
+
+      // slots before i are free again
+      if (run != NULL) {
+        rewind(run);
+        runs[merged++] = run;
+      }
+    }
+
+    count = merged;
+  }
+
+  if (ok && !done)
+    ok = (out = fopen(out_path, "wb")) != NULL && empack_sort_merge_runs(runs, (uint32_t)count, out, false);
+
+  for (size_t i = 0; i < count; i++)
+    fclose(runs[i]);
+  free(runs);
+
+  if (out != NULL)
+    ok = fclose(out) == 0 && ok;
+  return ok;
+}
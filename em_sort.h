@@ -0,0 +1,68 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_SORT__
+#define __EMPACK_SORT__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#ifndef EMPACK_SORT_RUN_SIZE
+#define EMPACK_SORT_RUN_SIZE ((size_t)256 << 20)
+#endif
+
+#ifndef EMPACK_SORT_FANIN
+#define EMPACK_SORT_FANIN 64
+#endif
+
+#ifndef EMPACK_SORT_MAX_THREADS
+#define EMPACK_SORT_MAX_THREADS 64
+#endif
+
+// ====================== External Sort ============== //
+//
+// Sorts a file of back-to-back msgpack records by a top level map key,
+// read the same way as `empack_index_build` reads it: ints or timestamp
+// ext seconds. Records without the key keep their input order after all
+// the keyed ones, and records with equal keys keep theirs too.
+//
+// The input is read `run_size` bytes at a time. Each record's key is read
+// once into a (key, offset) array, which is merge sorted by `threads`
+// threads; the records are then copied out in order, as opaque byte
+// ranges, to a temporary run file. The runs are k-way merged into the
+// output, EMPACK_SORT_FANIN at a time, with extra passes when there are
+// more. An input that fits in one run is sorted without spilling.
+//
+// Runs go to tmpfile() unless `tmp_dir` is set (POSIX only). Peak memory
+// is about run_size plus 48 bytes per record in a run. Threads use
+// pthreads, so link with -pthread.
+
+struct empack_sort_options {
+  const char* key;
+  uint32_t key_size;
+  size_t run_size;     // 0 for EMPACK_SORT_RUN_SIZE
+  uint32_t threads;    // 0 or 1 sorts on the calling thread
+  const char* tmp_dir; // NULL for tmpfile()
+};
+
+typedef struct empack_sort_options empack_sort_options_t;
+
+// sorts the records from in->pos to in->len into out
+bool empack_sort_buffer(buffer_t* in, buffer_t* out, const empack_sort_options_t* opts);
+
+bool empack_sort_file(const char* in_path, const char* out_path, const empack_sort_options_t* opts);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
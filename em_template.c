@@ -0,0 +1,139 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <float.h>
+#include <math.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "em_template.h"
+
+void empack_fragment_begin(buffer_t* s, empack_fragment_t* f)
+{
+  f->data = NULL;
+  f->start = s->pos;
+  f->size = 0;
+}
+
+void empack_fragment_end(buffer_t* s, empack_fragment_t* f)
+{
+  f->size = s->pos - f->start;
+  f->data = s->buf != NULL ? s->buf + f->start : NULL;
+}
+
+void empack_write_fragment(buffer_t* s, const empack_fragment_t* f)
+{
+  // one captured on a measuring buffer has a size but no bytes, which
+  // only another measuring buffer can take
+  if (f->data == NULL && f->size > 0 && s->buf != NULL)
+    buffer_set_error(s, EM_ERROR_EOF);
+
+  if (!buffer_fits(s, f->size))
+    buffer_set_error(s, EM_ERROR_OVERFLOW);
+
+  buffer_write(s, (em_byte_t*)f->data, f->size);
+}
+
+// payload width of a slot from its tag
+static uint8_t empack_slot_width(uint8_t tag)
+{
+  switch (tag) {
+  case EMPACK_SLOT_U8:
+  case EMPACK_SLOT_I8:
+    return 1;
+  case EMPACK_SLOT_U16:
+  case EMPACK_SLOT_I16:
+    return 2;
+  case EMPACK_SLOT_U32:
+  case EMPACK_SLOT_I32:
+  case EMPACK_SLOT_FLOAT:
+    return 4;
+  default:
+    return 8;
+  }
+}
+
+void empack_write_slot(buffer_t* s, const empack_fragment_t* f, empack_slot_t* slot, empack_slot_type_t type)
+{
+  em_byte_t p[9] = { 0 };
+
+  slot->offset = s->pos - f->start;
+  p[0] = (em_byte_t)type;
+  buffer_write(s, p, 1 + empack_slot_width(type));
+}
+
+static void empack_slot_store(em_byte_t* p, uint64_t v, uint8_t width)
+{
+  for (int8_t i = width - 1; i >= 0; i--) {
+    p[i] = (em_byte_t)(v & 0xFF);
+    v >>= 8;
+  }
+}
+
+bool empack_slot_set_uint(em_byte_t* msg, const empack_slot_t* slot, uint64_t u)
+{
+  em_byte_t* p = msg + slot->offset;
+  uint8_t tag = (uint8_t)p[0];
+  uint8_t width = empack_slot_width(tag);
+
+  if (tag >= EMPACK_SLOT_I8 && tag <= EMPACK_SLOT_I64)
+    return u <= INT64_MAX && empack_slot_set_sint(msg, slot, (int64_t)u);
+
+  if (tag < EMPACK_SLOT_U8 || tag > EMPACK_SLOT_U64 || (width < 8 && u >> (8 * width) != 0))
+    return false;
+
+  empack_slot_store(p + 1, u, width);
+  return true;
+}
+
+bool empack_slot_set_sint(em_byte_t* msg, const empack_slot_t* slot, int64_t i)
+{
+  em_byte_t* p = msg + slot->offset;
+  uint8_t tag = (uint8_t)p[0];
+  uint8_t width = empack_slot_width(tag);
+
+  if (tag >= EMPACK_SLOT_U8 && tag <= EMPACK_SLOT_U64)
+    return i >= 0 && empack_slot_set_uint(msg, slot, (uint64_t)i);
+
+  if (tag < EMPACK_SLOT_I8 || tag > EMPACK_SLOT_I64)
+    return false;
+
+  // fits when the bits above the slot are all copies of its sign bit
+  if (width < 8 && (i >> (8 * width - 1)) != 0 && (i >> (8 * width - 1)) != -1)
+    return false;
+
+  empack_slot_store(p + 1, (uint64_t)i, width);
+  return true;
+}
+
+bool empack_slot_set_double(em_byte_t* msg, const empack_slot_t* slot, double d)
+{
+  em_byte_t* p = msg + slot->offset;
+  uint64_t bits;
+  uint32_t fbits;
+  float f;
+
+  if ((uint8_t)p[0] == EMPACK_SLOT_DOUBLE) {
+    memcpy(&bits, &d, 8);
+    empack_slot_store(p + 1, bits, 8);
+    return true;
+  }
+
+  if ((uint8_t)p[0] == EMPACK_SLOT_FLOAT) {
+    // like the int setters, refuse what the slot can't hold; NaN passes
+    if (d == d && (d > FLT_MAX || d < -FLT_MAX) && d != INFINITY && d != -INFINITY)
+      return false;
+    f = (float)d;
+    if (d == d && (double)f != d)
+      return false;
+    memcpy(&fbits, &f, 4);
+    empack_slot_store(p + 1, fbits, 4);
+    return true;
+  }
+
+  return false;
+}
@@ -0,0 +1,86 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_TEMPLATE__
+#define __EMPACK_TEMPLATE__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== Fragments ============== //
+//
+// A fragment is a run of already encoded msgpack, such as a constant key,
+// a constant subtree or a whole message, captured once from ordinary
+// empack_write_* calls between `empack_fragment_begin` and
+// `empack_fragment_end`. It points into the buffer it was written to,
+// which must outlive it. `empack_write_fragment` appends it with a single
+// copy. A fragment captured on a measuring buffer only has a size: it can
+// be appended to another measuring buffer, and latches EM_ERROR_EOF on a
+// real one.
+
+struct empack_fragment {
+  const em_byte_t* data;
+  em_size_t start;
+  em_size_t size;
+};
+
+typedef struct empack_fragment empack_fragment_t;
+
+void empack_fragment_begin(buffer_t* s, empack_fragment_t* f);
+void empack_fragment_end(buffer_t* s, empack_fragment_t* f);
+
+void empack_write_fragment(buffer_t* s, const empack_fragment_t* f);
+
+// ====================== Templates ============== //
+//
+// A template is a fragment with fixed-width number slots in it. A slot is
+// written inside a fragment with `empack_write_slot` and holds zero until
+// patched. Patching rewrites only the slot's bytes, in the fragment itself
+// or in any copy of it: pass the address the copy starts at. A slot keeps
+// its width, so a value that doesn't fit it is refused.
+//
+// Typical use: capture the message once, then per send patch the slots and
+// send `f.data` as is, or `empack_write_fragment` it into an output buffer
+// and patch there.
+
+enum empack_slot_types {
+  EMPACK_SLOT_U8 = 0xCC,
+  EMPACK_SLOT_U16 = 0xCD,
+  EMPACK_SLOT_U32 = 0xCE,
+  EMPACK_SLOT_U64 = 0xCF,
+  EMPACK_SLOT_I8 = 0xD0,
+  EMPACK_SLOT_I16 = 0xD1,
+  EMPACK_SLOT_I32 = 0xD2,
+  EMPACK_SLOT_I64 = 0xD3,
+  EMPACK_SLOT_FLOAT = 0xCA,
+  EMPACK_SLOT_DOUBLE = 0xCB,
+};
+
+typedef enum empack_slot_types empack_slot_type_t;
+
+struct empack_slot {
+  em_size_t offset;
+};
+
+typedef struct empack_slot empack_slot_t;
+
+void empack_write_slot(buffer_t* s, const empack_fragment_t* f, empack_slot_t* slot, empack_slot_type_t type);
+
+bool empack_slot_set_uint(em_byte_t* msg, const empack_slot_t* slot, uint64_t u);
+bool empack_slot_set_sint(em_byte_t* msg, const empack_slot_t* slot, int64_t i);
+bool empack_slot_set_double(em_byte_t* msg, const empack_slot_t* slot, double d);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
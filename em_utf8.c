@@ -0,0 +1,377 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "em_buffer.h"
+#include "empack.h"
+#include "em_utf8.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__)) && !defined(EMPACK_NO_SIMD)
+#define EMPACK_UTF8_X86
+#include <immintrin.h>
+#endif
+
+// strings shorter than a vector go straight to the scalar loop
+#define UTF8_SIMD_MIN 16
+
+// ====================== Scalar ============== //
+
+static bool empack_utf8_scalar(em_byte_t* dst, const em_byte_t* src, size_t size)
+{
+  const uint8_t* p = (const uint8_t*)src;
+  size_t i = 0;
+
+  while (i < size) {
+    // skip runs of ASCII a word at a time
+    if (i + 8 <= size) {
+      uint64_t w;
+      memcpy(&w, p + i, 8);
+      if ((w & 0x8080808080808080ull) == 0) {
+        if (dst)
+          memcpy(dst + i, &w, 8);
+        i += 8;
+        continue;
+      }
+    }
+
+    uint8_t c = p[i];
+    size_t n;
+    uint32_t cp;
+
+    if (c < 0x80) {
+      n = 1;
+      cp = c;
+    } else if (c >= 0xC2 && c <= 0xDF) {
+      n = 2;
+      cp = c & 0x1F;
+    } else if (c >= 0xE0 && c <= 0xEF) {
+      n = 3;
+      cp = c & 0x0F;
+    } else if (c >= 0xF0 && c <= 0xF4) {
+      n = 4;
+      cp = c & 0x07;
+    } else {
+      return false;
+    }
+
+    if (size - i < n)
+      return false;
+
+    for (size_t k = 1; k < n; k++) {
+      if ((p[i + k] & 0xC0) != 0x80)
+        return false;
+      cp = cp << 6 | (p[i + k] & 0x3F);
+    }
+
+    if ((n == 3 && cp < 0x800) || (n == 4 && (cp < 0x10000 || cp > 0x10FFFF)) || (cp >= 0xD800 && cp <= 0xDFFF))
+      return false;
+
+    if (dst)
+      memcpy(dst + i, p + i, n);
+    i += n;
+  }
+
+  return true;
+}
+
+// ====================== Vector ============== //
+//
+// Lookup-table validation after Keiser and Lemire, "Validating UTF-8 In
+// Less Than One Instruction Per Byte": the high nibble of each byte and
+// both nibbles of the byte before it index three 16 entry tables whose
+// AND flags every two-byte error, and 3rd/4th continuation bytes are
+// checked against the lead two and three bytes back.
+
+#ifdef EMPACK_UTF8_X86
+
+#define TOO_SHORT (1 << 0)
+#define TOO_LONG (1 << 1)
+#define OVERLONG_3 (1 << 2)
+#define TOO_LARGE (1 << 3)
+#define SURROGATE (1 << 4)
+#define OVERLONG_2 (1 << 5)
+#define TOO_LARGE_1000 (1 << 6)
+#define OVERLONG_4 (1 << 6)
+#define TWO_CONTS (1 << 7)
+#define CARRY (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define UTF8_BYTE_1_HIGH                                                     \
+  TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG,      \
+    TOO_LONG, TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS,                    \
+    TOO_SHORT | OVERLONG_2, TOO_SHORT, TOO_SHORT | OVERLONG_3 | SURROGATE,   \
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define UTF8_BYTE_1_LOW                                                      \
+  CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, CARRY | OVERLONG_2, CARRY,   \
+    CARRY, CARRY | TOO_LARGE, CARRY | TOO_LARGE | TOO_LARGE_1000,            \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,  \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,  \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000,  \
+    CARRY | TOO_LARGE | TOO_LARGE_1000,                                      \
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE,                          \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define UTF8_BYTE_2_HIGH                                                     \
+  TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT,          \
+    TOO_SHORT, TOO_SHORT,                                                    \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE,              \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,               \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE,               \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+// a lead byte in the last three bytes of a block still needs continuations
+#define UTF8_INCOMPLETE(n) [(n) - 3] = 0xF0 - 1, [(n) - 2] = 0xE0 - 1, [(n) - 1] = 0xC0 - 1
+
+__attribute__((target("avx2")))
+static bool empack_utf8_avx2(em_byte_t* dst, const em_byte_t* src, size_t size)
+{
+  static const uint8_t b1h[32] = { UTF8_BYTE_1_HIGH, UTF8_BYTE_1_HIGH };
+  static const uint8_t b1l[32] = { UTF8_BYTE_1_LOW, UTF8_BYTE_1_LOW };
+  static const uint8_t b2h[32] = { UTF8_BYTE_2_HIGH, UTF8_BYTE_2_HIGH };
+  static const uint8_t incomplete[32] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF,
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, UTF8_INCOMPLETE(32)
+  };
+  const __m256i t1h = _mm256_loadu_si256((const __m256i*)b1h);
+  const __m256i t1l = _mm256_loadu_si256((const __m256i*)b1l);
+  const __m256i t2h = _mm256_loadu_si256((const __m256i*)b2h);
+  const __m256i tinc = _mm256_loadu_si256((const __m256i*)incomplete);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  __m256i prev = _mm256_setzero_si256();
+  __m256i prev_incomplete = _mm256_setzero_si256();
+  __m256i error = _mm256_setzero_si256();
+  uint8_t tail[32];
+  size_t i = 0;
+
+  while (i < size) {
+    __m256i in;
+
+    if (size - i >= 32) {
+      in = _mm256_loadu_si256((const __m256i*)(src + i));
+      if (dst)
+        _mm256_storeu_si256((__m256i*)(dst + i), in);
+    } else {
+      // pad the last block with zeros, which read as ASCII
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, src + i, size - i);
+      if (dst)
+        memcpy(dst + i, src + i, size - i);
+      in = _mm256_loadu_si256((const __m256i*)tail);
+    }
+    i += 32;
+
+    if (_mm256_movemask_epi8(in) == 0) {
+      error = _mm256_or_si256(error, prev_incomplete);
+      prev_incomplete = _mm256_setzero_si256();
+      prev = in;
+      continue;
+    }
+
+    __m256i shifted = _mm256_permute2x128_si256(prev, in, 0x21);
+    __m256i prev1 = _mm256_alignr_epi8(in, shifted, 15);
+    __m256i prev2 = _mm256_alignr_epi8(in, shifted, 14);
+    __m256i prev3 = _mm256_alignr_epi8(in, shifted, 13);
+
+    __m256i sc = _mm256_and_si256(
+      _mm256_and_si256(
+        _mm256_shuffle_epi8(t1h, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), nibble)),
+        _mm256_shuffle_epi8(t1l, _mm256_and_si256(prev1, nibble))),
+      _mm256_shuffle_epi8(t2h, _mm256_and_si256(_mm256_srli_epi16(in, 4), nibble)));
+
+    __m256i must23 = _mm256_or_si256(
+      _mm256_subs_epu8(prev2, _mm256_set1_epi8((char)(0xE0 - 0x80))),
+      _mm256_subs_epu8(prev3, _mm256_set1_epi8((char)(0xF0 - 0x80))));
+    __m256i must23_80 = _mm256_and_si256(must23, _mm256_set1_epi8((char)0x80));
+
+    error = _mm256_or_si256(error, _mm256_xor_si256(must23_80, sc));
+    prev_incomplete = _mm256_subs_epu8(in, tinc);
+    prev = in;
+  }
+
+  error = _mm256_or_si256(error, prev_incomplete);
+  return _mm256_testz_si256(error, error);
+}
+
+__attribute__((target("sse4.2")))
+static bool empack_utf8_sse4(em_byte_t* dst, const em_byte_t* src, size_t size)
+{
+  static const uint8_t b1h[16] = { UTF8_BYTE_1_HIGH };
+  static const uint8_t b1l[16] = { UTF8_BYTE_1_LOW };
+  static const uint8_t b2h[16] = { UTF8_BYTE_2_HIGH };
+  static const uint8_t incomplete[16] = {
+    0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF, UTF8_INCOMPLETE(16)
+  };
+  const __m128i t1h = _mm_loadu_si128((const __m128i*)b1h);
+  const __m128i t1l = _mm_loadu_si128((const __m128i*)b1l);
+  const __m128i t2h = _mm_loadu_si128((const __m128i*)b2h);
+  const __m128i tinc = _mm_loadu_si128((const __m128i*)incomplete);
+  const __m128i nibble = _mm_set1_epi8(0x0F);
+  __m128i prev = _mm_setzero_si128();
+  __m128i prev_incomplete = _mm_setzero_si128();
+  __m128i error = _mm_setzero_si128();
+  uint8_t tail[16];
+  size_t i = 0;
+
+  while (i < size) {
+    __m128i in;
+
+    if (size - i >= 16) {
+      in = _mm_loadu_si128((const __m128i*)(src + i));
+      if (dst)
+        _mm_storeu_si128((__m128i*)(dst + i), in);
+    } else {
+      memset(tail, 0, sizeof(tail));
+      memcpy(tail, src + i, size - i);
+      if (dst)
+        memcpy(dst + i, src + i, size - i);
+      in = _mm_loadu_si128((const __m128i*)tail);
+    }
+    i += 16;
+
+    if (_mm_movemask_epi8(in) == 0) {
+      error = _mm_or_si128(error, prev_incomplete);
+      prev_incomplete = _mm_setzero_si128();
+      prev = in;
+      continue;
+    }
+
+    __m128i prev1 = _mm_alignr_epi8(in, prev, 15);
+    __m128i prev2 = _mm_alignr_epi8(in, prev, 14);
+    __m128i prev3 = _mm_alignr_epi8(in, prev, 13);
+
+    __m128i sc = _mm_and_si128(
+      _mm_and_si128(
+        _mm_shuffle_epi8(t1h, _mm_and_si128(_mm_srli_epi16(prev1, 4), nibble)),
+        _mm_shuffle_epi8(t1l, _mm_and_si128(prev1, nibble))),
+      _mm_shuffle_epi8(t2h, _mm_and_si128(_mm_srli_epi16(in, 4), nibble)));
+
+    __m128i must23 = _mm_or_si128(
+      _mm_subs_epu8(prev2, _mm_set1_epi8((char)(0xE0 - 0x80))),
+      _mm_subs_epu8(prev3, _mm_set1_epi8((char)(0xF0 - 0x80))));
+    __m128i must23_80 = _mm_and_si128(must23, _mm_set1_epi8((char)0x80));
+
+    error = _mm_or_si128(error, _mm_xor_si128(must23_80, sc));
+    prev_incomplete = _mm_subs_epu8(in, tinc);
+    prev = in;
+  }
+
+  error = _mm_or_si128(error, prev_incomplete);
+  return _mm_testz_si128(error, error);
+}
+
+#endif // EMPACK_UTF8_X86
+
+static bool empack_utf8_check(em_byte_t* dst, const em_byte_t* src, size_t size)
+{
+#ifdef EMPACK_UTF8_X86
+  if (size >= UTF8_SIMD_MIN) {
+    if (__builtin_cpu_supports("avx2"))
+      return empack_utf8_avx2(dst, src, size);
+    if (__builtin_cpu_supports("sse4.2"))
+      return empack_utf8_sse4(dst, src, size);
+  }
+#endif
+  return empack_utf8_scalar(dst, src, size);
+}
+
+bool empack_utf8_valid(const em_byte_t* str, size_t size)
+{
+  return empack_utf8_check(NULL, str, size);
+}
+
+bool empack_utf8_copy(em_byte_t* dst, const em_byte_t* src, size_t size)
+{
+  return empack_utf8_check(dst, src, size);
+}
+
+bool empack_utf8_has_impl(empack_utf8_impl_t impl)
+{
+  switch (impl) {
+  case EMPACK_UTF8_SCALAR:
+    return true;
+#ifdef EMPACK_UTF8_X86
+  case EMPACK_UTF8_SSE4:
+    return __builtin_cpu_supports("sse4.2");
+  case EMPACK_UTF8_AVX2:
+    return __builtin_cpu_supports("avx2");
+#endif
+  default:
+    return false;
+  }
+}
+
+bool empack_utf8_valid_impl(empack_utf8_impl_t impl, const em_byte_t* str, size_t size)
+{
+  if (!empack_utf8_has_impl(impl))
+    return false;
+
+#ifdef EMPACK_UTF8_X86
+  if (impl == EMPACK_UTF8_AVX2)
+    return empack_utf8_avx2(NULL, str, size);
+  if (impl == EMPACK_UTF8_SSE4)
+    return empack_utf8_sse4(NULL, str, size);
+#endif
+  return empack_utf8_scalar(NULL, str, size);
+}
+
+// ====================== Readers ============== //
+
+// reads the header and checks the payload is there, leaving pos at it
+static bool empack_utf8_payload(buffer_t* s, uint32_t* str_size)
+{
+  if (!empack_read_string_size(s, str_size))
+    return false;
+
+  if (!buffer_fits(s, *str_size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  return true;
+}
+
+bool empack_read_string_utf8(buffer_t* s, char* str, uint32_t count_bytes, uint32_t* str_size)
+{
+  *str_size = 0;
+
+  if (!empack_utf8_payload(s, str_size))
+    return false;
+
+  if (*str_size > count_bytes) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return false;
+  }
+
+  if (!empack_utf8_copy((em_byte_t*)str, s->buf + s->pos, *str_size)) {
+    buffer_set_error(s, EM_ERROR_UTF8);
+    return false;
+  }
+
+  s->pos += *str_size;
+  s->max = s->pos;
+  EMPACK_STAT_PAYLOAD(s, STRING, *str_size);
+  return true;
+}
+
+bool empack_read_string_ref_utf8(buffer_t* s, const char** str, uint32_t* str_size)
+{
+  if (!empack_utf8_payload(s, str_size))
+    return false;
+
+  if (!empack_utf8_valid(s->buf + s->pos, *str_size)) {
+    buffer_set_error(s, EM_ERROR_UTF8);
+    return false;
+  }
+
+  *str = (const char*)(s->buf + s->pos);
+  s->pos += *str_size;
+  s->max = s->pos;
+  EMPACK_STAT_PAYLOAD(s, STRING, *str_size);
+  return true;
+}
@@ -0,0 +1,58 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_UTF8__
+#define __EMPACK_UTF8__
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "em_buffer.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// ====================== Strict Strings ============== //
+//
+// The plain string readers accept any bytes. The `_utf8` variants below
+// also check that the payload is well formed UTF-8 (no overlongs,
+// surrogates or code points past U+10FFFF) in the same pass that copies
+// or hands out the string, and latch EM_ERROR_UTF8 at the start of the
+// payload when it isn't.
+//
+// On x86 the check runs 32 bytes at a time with AVX2, or 16 with SSE4,
+// picked at run time; all-ASCII blocks only cost a load and a movemask.
+// Other targets and short strings use a scalar loop that skips ASCII 8
+// bytes at a time.
+
+bool empack_utf8_valid(const em_byte_t* str, size_t size);
+
+// copies `size` bytes to `dst`, validating them on the way
+bool empack_utf8_copy(em_byte_t* dst, const em_byte_t* src, size_t size);
+
+// Each validator by name, so tests and benchmarks can run one whatever
+// the CPU would pick. `empack_utf8_has_impl` says whether this build and
+// CPU have it; asking for one that isn't there returns false.
+enum empack_utf8_impl {
+  EMPACK_UTF8_SCALAR = 0,
+  EMPACK_UTF8_SSE4,
+  EMPACK_UTF8_AVX2,
+};
+
+typedef enum empack_utf8_impl empack_utf8_impl_t;
+
+bool empack_utf8_has_impl(empack_utf8_impl_t impl);
+bool empack_utf8_valid_impl(empack_utf8_impl_t impl, const em_byte_t* str, size_t size);
+
+bool empack_read_string_utf8(buffer_t* s, char* str, uint32_t count_bytes, uint32_t* str_size);
+bool empack_read_string_ref_utf8(buffer_t* s, const char** str, uint32_t* str_size);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
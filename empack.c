@@ -6,11 +6,12 @@
 #include <stddef.h>
 #include <stdint.h>
 #include <limits.h>
+#include <string.h>
 
 #include "em_buffer.h"
 #include "empack.h"
 
-empack_type_t empack_next_type(buffer_t* b)
+EMPACK_API empack_type_t empack_next_type(buffer_t* b)
 {
   int16_t msgpack_type = buffer_peek(b);
 
@@ -46,6 +47,9 @@ empack_type_t empack_next_type(buffer_t* b)
   case 0xD3:
     return EMPACK_SINT;
 
+  case 0xC7:
+  case 0xC8:
+  case 0xC9:
   case 0xD4:
   case 0xD5:
   case 0xD6:
@@ -71,14 +75,14 @@ empack_type_t empack_next_type(buffer_t* b)
   }
 
   if (msgpack_type >= 0xE0)
-    return EMPACK_UINT;
-  else if (msgpack_type < 0x80)
     return EMPACK_SINT;
-  else if (msgpack_type & 0xA0)
+  else if (msgpack_type < 0x80)
+    return EMPACK_UINT;
+  else if ((msgpack_type & 0xE0) == 0xA0)
     return EMPACK_STRING;
-  else if (msgpack_type & 0x80)
+  else if ((msgpack_type & 0xF0) == 0x80)
     return EMPACK_MAP;
-  else if (msgpack_type & 0x90)
+  else if ((msgpack_type & 0xF0) == 0x90)
     return EMPACK_ARRAY;
 
   return EMPACK_UNKNOWN;
@@ -87,125 +91,269 @@ empack_type_t empack_next_type(buffer_t* b)
 
 #define CONST(c) ((em_byte_t)c)
 
-bool empack_read_nil(buffer_t* s)
+static uint64_t empack_load_be(const em_byte_t* p, uint8_t count_bytes)
+{
+  uint64_t v = 0;
+  for (uint8_t i = 0; i < count_bytes; i++)
+    v = (v << 8) | (uint8_t)p[i];
+  return v;
+}
+
+static void empack_store_be(em_byte_t* p, uint64_t v, uint8_t count_bytes)
+{
+  for (int8_t i = count_bytes - 1; i >= 0; i--) {
+    p[i] = v & 0xFF;
+    v >>= 8;
+  }
+}
+
+EMPACK_API bool empack_read_nil(buffer_t* s)
 {
+  EMPACK_STAT_MARK(s);
   int32_t ret = buffer_read_byte(s);
   if (ret < 0)
     return false;
 
   em_byte_t mpack_byte = ret & 0xFF;
-  return mpack_byte == CONST(0xC0);
+  if (mpack_byte != CONST(0xC0)) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  EMPACK_STAT_SINCE(s);
+  return true;
 }
 
-bool empack_read_bool(buffer_t* s, bool* value)
+EMPACK_API bool empack_read_bool(buffer_t* s, bool* value)
 {
+  EMPACK_STAT_MARK(s);
   em_byte_t mpack_byte;
-  int read = buffer_read(s, &mpack_byte, 1);
+  em_size_t read = buffer_read(s, &mpack_byte, 1);
 
   if (read != 1)
     return false;
 
   *value = mpack_byte == CONST(0xC3);
 
-  return mpack_byte == CONST(0xC3) || mpack_byte == CONST(0xC2);
+  if (mpack_byte != CONST(0xC3) && mpack_byte != CONST(0xC2)) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  EMPACK_STAT_SINCE(s);
+  return true;
 }
 
-bool empack_read_sint(buffer_t* s, em_byte_t* b, uint8_t count_bytes)
+EMPACK_API bool empack_read_sint(buffer_t* s, em_byte_t* b, uint8_t count_bytes)
 {
-  em_byte_t mpack_byte;
+  EMPACK_STAT_MARK(s);
+  int16_t mpack_byte = buffer_read_byte(s);
   uint8_t read_size;
-  if (buffer_read(s, &mpack_byte, 1) != 1) {
+  if (mpack_byte < 0) {
     return false;
   }
-  if (mpack_byte < CONST(0x80)) {
-    return false;
-  } else if (mpack_byte >= CONST(0xE0)) {
+  if (mpack_byte < 0x80) {
+    b[0] = mpack_byte;
+    int8_t i;
+    for (i = count_bytes - 1; i >= 1; i--) {
+      b[i] = 0x00;
+    }
+    EMPACK_STAT_SINCE(s);
+    return true;
+  } else if (mpack_byte >= 0xE0) {
     b[0] = mpack_byte;
     int8_t i;
     for (i = count_bytes - 1; i >= 1; i--) {
       b[i] = 0xff;
     }
+    EMPACK_STAT_SINCE(s);
     return true;
-  } else if (mpack_byte == CONST(0xD0)) {
+  } else if (mpack_byte == 0xD0) {
     read_size = 1;
-  } else if (mpack_byte == CONST(0xD1)) {
+  } else if (mpack_byte == 0xD1) {
     read_size = 2;
-  } else if (mpack_byte == CONST(0xD2)) {
+  } else if (mpack_byte == 0xD2) {
     read_size = 4;
-  } else if (mpack_byte == CONST(0xD3)) {
+  } else if (mpack_byte == 0xD3) {
     read_size = 8;
+  } else if (mpack_byte >= 0xCC && mpack_byte <= 0xCF) {
+    // empack_write_i* sends non-negative values through the unsigned
+    // writers, so a uint is taken whenever it fits count_bytes signed
+    em_byte_t p[8];
+    read_size = 1 << (mpack_byte - 0xCC);
+    if (buffer_read(s, p, read_size) != read_size)
+      return false;
+
+    uint64_t u = empack_load_be(p, read_size);
+    if (u > UINT64_MAX >> (65 - 8 * count_bytes)) {
+      buffer_set_error(s, EM_ERROR_TOO_BIG);
+      return false;
+    }
+
+    for (uint8_t i = 0; i < count_bytes; i++) {
+      b[i] = u & 0xFF;
+      u >>= 8;
+    }
+    EMPACK_STAT_SINCE(s);
+    return true;
   } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
     return false;
   }
-  if (read_size > count_bytes)
+  if (read_size > count_bytes) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
     return false;
+  }
 
   bool res = true;
   int8_t i;
   for (i = read_size - 1; i >= 0; i--) {
-    res &= buffer_read(s, &b[i], 1);
+    res &= buffer_read(s, &b[i], 1) == 1;
   }
 
-  uint8_t prefix = (b[read_size - 1] >> 7) == 1 ? 0xFF : 0x00;
+  uint8_t prefix = ((uint8_t)b[read_size - 1] >> 7) == 1 ? 0xFF : 0x00;
   for (i = count_bytes - 1; i >= read_size; i--) {
     b[i] = prefix;
   }
+  if (res)
+    EMPACK_STAT_SINCE(s);
   return res;
 }
 
-bool empack_read_uint(buffer_t* s, em_byte_t* b, uint8_t count_bytes)
+EMPACK_API bool empack_read_uint(buffer_t* s, em_byte_t* b, uint8_t count_bytes)
 {
-  em_byte_t mpack_byte;
+  EMPACK_STAT_MARK(s);
+  int16_t mpack_byte = buffer_read_byte(s);
   uint8_t read_size;
-  if (buffer_read(s, &mpack_byte, 1) != 1) {
+  if (mpack_byte < 0) {
     return false;
   }
 
-  if (mpack_byte < CONST(0x80)) {
+  if (mpack_byte < 0x80) {
     b[0] = mpack_byte;
     int8_t i;
     for (i = count_bytes - 1; i >= 1; i--) {
       b[i] = 0x0;
     }
+    EMPACK_STAT_SINCE(s);
     return true;
-  } else if (mpack_byte >= CONST(0xE0)) {
+  } else if (mpack_byte >= 0xE0) {
+    buffer_set_error(s, EM_ERROR_TYPE);
     return false;
-  } else if (mpack_byte == CONST(0xCC)) {
+  } else if (mpack_byte == 0xCC) {
     read_size = 1;
-  } else if (mpack_byte == CONST(0xCD)) {
+  } else if (mpack_byte == 0xCD) {
     read_size = 2;
-  } else if (mpack_byte == CONST(0xCE)) {
+  } else if (mpack_byte == 0xCE) {
     read_size = 4;
-  } else if (mpack_byte == CONST(0xCF)) {
+  } else if (mpack_byte == 0xCF) {
     read_size = 8;
   } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
     return false;
   }
 
-  if (read_size > count_bytes)
+  if (read_size > count_bytes) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
     return false;
+  }
 
   bool res = true;
   int8_t i;
 
   for (i = read_size - 1; i >= 0; i--) {
-    res &= buffer_read(s, &b[i], 1);
+    res &= buffer_read(s, &b[i], 1) == 1;
   }
 
   for (i = count_bytes - 1; i >= read_size; i--) {
     b[i] = 0x00;
   }
+  if (res)
+    EMPACK_STAT_SINCE(s);
   return res;
 }
 
-bool empack_next_skip(buffer_t* s, empack_type_t* skip_type)
+EMPACK_API bool empack_read_float(buffer_t* s, float* f)
 {
+  EMPACK_STAT_MARK(s);
+  union float_to_byte {
+    float f;
+    em_byte_t b[4];
+  } f2b;
+
+  if (buffer_read_byte(s) != 0xCA) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  bool b = true;
+  for (int8_t i = 3; i >= 0; i--)
+    b &= buffer_read(s, &f2b.b[i], 1) == 1;
+
+  *f = f2b.f;
+  if (b)
+    EMPACK_STAT_SINCE(s);
+  return b;
+}
+
+// accepts either float width and ints, which empack_write_number emits
+// for integral values
+EMPACK_API bool empack_read_double(buffer_t* s, double* d)
+{
+  EMPACK_STAT_MARK(s);
+  em_byte_t p[8];
+  float f;
+  uint64_t u;
+  int64_t i;
+
+  switch (empack_next_type(s)) {
+  case EMPACK_UINT:
+    if (!empack_read_uint(s, (em_byte_t*)&u, 8))
+      return false;
+    *d = (double)u;
+    return true;
+  case EMPACK_SINT:
+    if (!empack_read_sint(s, (em_byte_t*)&i, 8))
+      return false;
+    *d = (double)i;
+    return true;
+  case EMPACK_FLOAT:
+    if (buffer_peek(s) == 0xCA) {
+      if (!empack_read_float(s, &f))
+        return false;
+      *d = f;
+      return true;
+    }
+    break;
+  default:
+    break;
+  }
+
+  if (buffer_read_byte(s) != 0xCB) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  if (buffer_read(s, p, 8) != 8)
+    return false;
+
+  u = empack_load_be(p, 8);
+  memcpy(d, &u, 8);
+  EMPACK_STAT_SINCE(s);
+  return true;
+}
+
+// depth counts the containers around the value, so untrusted input can't
+// recurse off the end of the stack
+static bool empack_next_skip_depth(buffer_t* s, empack_type_t* skip_type, uint32_t depth)
+{
+  EMPACK_STAT_MARK(s);
   empack_type_t type = empack_next_type(s);
   *skip_type = type;
 
   uint64_t n = 0;
   uint32_t l = 0;
-  em_byte_t ignore[2];
+  int8_t ext_type;
   bool b = true, r = true;
 
   switch (type) {
@@ -221,22 +369,37 @@ bool empack_next_skip(buffer_t* s, empack_type_t* skip_type)
 
 
   case EMPACK_BIN:
-    r = empack_read_bin_sz(s, ignore, 0, &l);
-    if (r) {
-      l += s->pos;
-      s->pos = l;
-      s->max = l;
+    r = empack_read_bin_size(s, &l);
+    if (r && buffer_fits(s, l)) {
+      EMPACK_STAT_PAYLOAD(s, BIN, l);
+      s->pos += l;
+      s->max = s->pos;
+      return true;
     }
-    return r;
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+
+  case EMPACK_EXT:
+    r = empack_read_ext_size(s, &ext_type, &l);
+    if (r && buffer_fits(s, l)) {
+      EMPACK_STAT_PAYLOAD(s, EXT, l);
+      s->pos += l;
+      s->max = s->pos;
+      return true;
+    }
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
 
   case EMPACK_STRING:
-    r = empack_read_string_sz(s, (char*)ignore, 0, &l);
-    if (r) {
-      l += s->pos;
-      s->pos = l;
-      s->max = l;
+    r = empack_read_string_size(s, &l);
+    if (r && buffer_fits(s, l)) {
+      EMPACK_STAT_PAYLOAD(s, STRING, l);
+      s->pos += l;
+      s->max = s->pos;
+      return true;
     }
-    return r;
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
 
   case EMPACK_SINT:
     return empack_read_sint(s, (em_byte_t*)&n, 8);
@@ -244,26 +407,55 @@ bool empack_next_skip(buffer_t* s, empack_type_t* skip_type)
   case EMPACK_UINT:
     return empack_read_uint(s, (em_byte_t*)&n, 8);
 
+  case EMPACK_FLOAT:
+    l = buffer_read_byte(s) == 0xCA ? 4 : 8;
+    if (buffer_fits(s, l)) {
+      s->pos += l;
+      s->max = s->pos;
+      EMPACK_STAT_SINCE(s);
+      return true;
+    }
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+
   case EMPACK_ARRAY:
     r = empack_read_array_size(s, &l);
-    for (int c = 0; c < l && r; ++c)
-      r &= empack_next_skip(s, (empack_type_t*)&n);
+    if (r && depth >= EMPACK_SKIP_MAX_DEPTH) {
+      buffer_set_error(s, EM_ERROR_DEPTH);
+      return false;
+    }
+    EMPACK_STAT_ENTER(s);
+    for (uint32_t c = 0; c < l && r; ++c)
+      r &= empack_next_skip_depth(s, (empack_type_t*)&n, depth + 1);
+    EMPACK_STAT_LEAVE(s);
     return r;
 
   case EMPACK_MAP:
     r = empack_read_map_size(s, &l);
-    for (int c = 0; c < l && r; ++c)
-      r &= empack_next_skip(s, (empack_type_t*)&n);
+    if (r && depth >= EMPACK_SKIP_MAX_DEPTH) {
+      buffer_set_error(s, EM_ERROR_DEPTH);
+      return false;
+    }
+    EMPACK_STAT_ENTER(s);
+    for (uint32_t c = 0; c < 2 * (uint64_t)l && r; ++c)
+      r &= empack_next_skip_depth(s, (empack_type_t*)&n, depth + 1);
+    EMPACK_STAT_LEAVE(s);
     return r;
 
   default:
     break;
   }
 
-  return EMPACK_UNKNOWN;
+  buffer_set_error(s, EM_ERROR_TYPE);
+  return false;
 }
 
-bool empack_next_copy(buffer_t* s, buffer_t* out, empack_type_t* skip_type)
+EMPACK_API bool empack_next_skip(buffer_t* s, empack_type_t* skip_type)
+{
+  return empack_next_skip_depth(s, skip_type, 0);
+}
+
+EMPACK_API bool empack_next_copy(buffer_t* s, buffer_t* out, empack_type_t* skip_type)
 {
   bool status;
 
@@ -272,183 +464,356 @@ bool empack_next_copy(buffer_t* s, buffer_t* out, empack_type_t* skip_type)
   em_size_t pos_next = s->pos;
   em_size_t skip_size = pos_next - pos_start;
 
-  if (skip_size > out->len)
+  if (skip_size > buffer_available(out)) {
+    buffer_set_error(out, EM_ERROR_OVERFLOW);
     return false;
+  }
 
   for (em_size_t i = 0; i < skip_size; i++) {
-    buffer_write_byte(out, s->buf[i]);
+    buffer_write_byte(out, s->buf[pos_start + i]);
   }
 
   return status;
 }
 
 #define BUFFER_READ_X8(b, s, p) \
-  (b &= buffer_read(s, &p[0], 1));
+  (b &= buffer_read(s, &p[0], 1) == 1);
 
 #define BUFFER_READ_X16(b, s, p)     \
-  (b &= buffer_read(s, &p[1], 1));  \
-  (b &= buffer_read(s, &p[0], 1));
+  (b &= buffer_read(s, &p[1], 1) == 1);  \
+  (b &= buffer_read(s, &p[0], 1) == 1);
 
 
 #define BUFFER_READ_X32(b, s, p)     \
-  (b &= buffer_read(s, &p[3], 1));      \
-  (b &= buffer_read(s, &p[2], 1));        \
-  (b &= buffer_read(s, &p[1], 1));        \
-  (b &= buffer_read(s, &p[0], 1));
+  (b &= buffer_read(s, &p[3], 1) == 1);      \
+  (b &= buffer_read(s, &p[2], 1) == 1);        \
+  (b &= buffer_read(s, &p[1], 1) == 1);        \
+  (b &= buffer_read(s, &p[0], 1) == 1);
 
-bool empack_read_string_sz(buffer_t* s, char* str, uint32_t count_bytes, uint32_t* str_size)
+EMPACK_API bool empack_read_string_size(buffer_t* s, uint32_t* str_size)
 {
-  em_byte_t* str_buff = (em_byte_t*)str;
-  *str_size = 0;
-  em_byte_t mpack_byte;
+  EMPACK_STAT_MARK(s);
+  int16_t mpack_byte = buffer_read_byte(s);
   bool b = true;
   uint32_t read_size = 0;
   em_byte_t* p = (em_byte_t*)&read_size;
 
-  if (buffer_read(s, &mpack_byte, 1)) {
-    if ((mpack_byte >> 5) == 5) {
-      read_size = mpack_byte & 0x1F;
-    } else if (mpack_byte == CONST(0xD9)) {
-      BUFFER_READ_X8(b, s, p);
-    } else if (mpack_byte == CONST(0xDA)) {
-      BUFFER_READ_X16(b, s, p);
-    } else if (mpack_byte == CONST(0xDB)) {
-      BUFFER_READ_X32(b, s, p);
-    } else {
-      return false;
-    }
+  if (mpack_byte < 0)
+    return false;
 
-    *str_size = read_size;
+  if ((mpack_byte >> 5) == 5) {
+    read_size = mpack_byte & 0x1F;
+  } else if (mpack_byte == 0xD9) {
+    BUFFER_READ_X8(b, s, p);
+  } else if (mpack_byte == 0xDA) {
+    BUFFER_READ_X16(b, s, p);
+  } else if (mpack_byte == 0xDB) {
+    BUFFER_READ_X32(b, s, p);
+  } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
 
-    if (read_size > count_bytes)
-      return false;
+  *str_size = read_size;
+  if (b)
+    EMPACK_STAT_SINCE(s);
+  return b;
+}
 
-    uint32_t i;
-    for (i = 0; i < read_size; i++) {
-      b &= buffer_read(s, &(str_buff[i]), 1);
-    }
-    return b;
+EMPACK_API bool empack_read_string_sz(buffer_t* s, char* str, uint32_t count_bytes, uint32_t* str_size)
+{
+  *str_size = 0;
+  uint32_t read_size = 0;
+
+  if (!empack_read_string_size(s, &read_size))
+    return false;
+
+  *str_size = read_size;
+
+  if (read_size > count_bytes) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return false;
   }
-  return false;
+
+  if (!buffer_fits(s, read_size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  if (buffer_read(s, (em_byte_t*)str, read_size) != read_size)
+    return false;
+
+  EMPACK_STAT_PAYLOAD(s, STRING, read_size);
+  return true;
 }
 
-bool empack_read_string(buffer_t* s, char* str, uint32_t count_bytes)
+EMPACK_API bool empack_read_string(buffer_t* s, char* str, uint32_t count_bytes)
 {
   uint32_t read_size;
   return empack_read_string_sz(s, str, count_bytes, &read_size);
 }
 
+// returns a pointer to the string bytes inside the buffer instead of a copy
+EMPACK_API bool empack_read_string_ref(buffer_t* s, const char** str, uint32_t* str_size)
+{
+  if (!empack_read_string_size(s, str_size))
+    return false;
+
+  if (!buffer_fits(s, *str_size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  *str = (const char*)(s->buf + s->pos);
+  s->pos += *str_size;
+  s->max = s->pos;
+  EMPACK_STAT_PAYLOAD(s, STRING, *str_size);
+  return true;
+}
 
-bool empack_read_bin_sz(buffer_t* s, em_byte_t* bin, uint32_t count_bytes, uint32_t* bin_size)
+EMPACK_API bool empack_read_bin_size(buffer_t* s, uint32_t* bin_size)
 {
-  em_byte_t mpack_byte;
+  EMPACK_STAT_MARK(s);
+  int16_t mpack_byte = buffer_read_byte(s);
   bool b = true;
   uint32_t read_size = 0;
   em_byte_t* p = (em_byte_t*)&read_size;
-  if (buffer_read(s, &mpack_byte, 1)) {
-    if (mpack_byte == CONST(0xc4)) {
-      b &= buffer_read(s, &p[0], 1);
-      BUFFER_READ_X8(b, s, p);
-    } else if (mpack_byte == CONST(0xC5)) {
-      BUFFER_READ_X16(b, s, p);
-    } else if (mpack_byte == CONST(0xC6)) {
-      BUFFER_READ_X32(b, s, p);
-    } else {
-      return false;
-    }
 
-    *bin_size = read_size;
+  if (mpack_byte < 0)
+    return false;
 
-    if (read_size > count_bytes)
-      return false;
+  if (mpack_byte == 0xC4) {
+    BUFFER_READ_X8(b, s, p);
+  } else if (mpack_byte == 0xC5) {
+    BUFFER_READ_X16(b, s, p);
+  } else if (mpack_byte == 0xC6) {
+    BUFFER_READ_X32(b, s, p);
+  } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  *bin_size = read_size;
+  if (b)
+    EMPACK_STAT_SINCE(s);
+  return b;
+}
 
-    return b && buffer_read(s, bin, read_size) == read_size;
+EMPACK_API bool empack_read_bin_sz(buffer_t* s, em_byte_t* bin, uint32_t count_bytes, uint32_t* bin_size)
+{
+  uint32_t read_size = 0;
+
+  if (!empack_read_bin_size(s, &read_size))
+    return false;
+
+  *bin_size = read_size;
+
+  if (read_size > count_bytes) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return false;
   }
-  return false;
+
+  if (!buffer_fits(s, read_size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  if (buffer_read(s, bin, read_size) != read_size)
+    return false;
+
+  EMPACK_STAT_PAYLOAD(s, BIN, read_size);
+  return true;
 }
 
-bool empack_read_bin(buffer_t* s, em_byte_t* bin, uint32_t count_bytes)
+EMPACK_API bool empack_read_bin(buffer_t* s, em_byte_t* bin, uint32_t count_bytes)
 {
   uint32_t read_size;
   return empack_read_bin_sz(s, bin, count_bytes, &read_size);
 }
 
-bool empack_read_array_size(buffer_t* s, uint32_t* array_size)
+EMPACK_API bool empack_read_array_size(buffer_t* s, uint32_t* array_size)
 {
-  em_byte_t mpack_byte;
+  EMPACK_STAT_MARK(s);
+  int16_t mpack_byte = buffer_read_byte(s);
   bool b = true;
   em_byte_t* p = (em_byte_t*)array_size;
-  if (buffer_read(s, &mpack_byte, 1)) {
-    *array_size = 0;
-    if ((mpack_byte >> 4) == CONST(0x09)) {
-      *array_size = mpack_byte & 0x0F;
-    } else if (mpack_byte == CONST(0xDC)) {
-      BUFFER_READ_X16(b, s, p);
-      return b;
-    } else if (mpack_byte == CONST(0xDD)) {
-      BUFFER_READ_X32(b, s, p);
-    } else {
-      return false;
-    }
-    return b;
+  if (mpack_byte < 0)
+    return false;
+
+  *array_size = 0;
+  if ((mpack_byte >> 4) == 0x09) {
+    *array_size = mpack_byte & 0x0F;
+  } else if (mpack_byte == 0xDC) {
+    BUFFER_READ_X16(b, s, p);
+  } else if (mpack_byte == 0xDD) {
+    BUFFER_READ_X32(b, s, p);
+  } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
   }
-  return false;
+  if (b)
+    EMPACK_STAT_SINCE(s);
+  return b;
 }
 
-bool empack_read_map_size(buffer_t* s, uint32_t* map_size)
+EMPACK_API bool empack_read_map_size(buffer_t* s, uint32_t* map_size)
 {
-  em_byte_t mpack_byte;
+  EMPACK_STAT_MARK(s);
+  int16_t mpack_byte = buffer_read_byte(s);
   bool b = true;
   em_byte_t* p = (em_byte_t*)map_size;
-  if (buffer_read(s, &mpack_byte, 1)) {
-    *map_size = 0;
-    if ((mpack_byte >> 4) == CONST(0x08)) {
-      *map_size = mpack_byte & 0x0F;
-    } else if (mpack_byte == CONST(0xDE)) {
-      BUFFER_READ_X16(b, s, p);
-    } else if (mpack_byte == CONST(0xDF)) {
-      BUFFER_READ_X32(b, s, p);
-    } else {
-      return false;
-    }
-    return b;
+  if (mpack_byte < 0)
+    return false;
+
+  *map_size = 0;
+  if ((mpack_byte >> 4) == 0x08) {
+    *map_size = mpack_byte & 0x0F;
+  } else if (mpack_byte == 0xDE) {
+    BUFFER_READ_X16(b, s, p);
+  } else if (mpack_byte == 0xDF) {
+    BUFFER_READ_X32(b, s, p);
+  } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
   }
-  return false;
+  if (b)
+    EMPACK_STAT_SINCE(s);
+  return b;
+}
+
+EMPACK_API bool empack_read_ext_size(buffer_t* s, int8_t* ext_type, uint32_t* ext_size)
+{
+  EMPACK_STAT_MARK(s);
+  int16_t mpack_byte = buffer_read_byte(s);
+  bool b = true;
+  uint32_t read_size = 0;
+  em_byte_t* p = (em_byte_t*)&read_size;
+  if (mpack_byte < 0)
+    return false;
+
+  if (mpack_byte >= 0xD4 && mpack_byte <= 0xD8) {
+    read_size = 1 << (mpack_byte - 0xD4);
+  } else if (mpack_byte == 0xC7) {
+    BUFFER_READ_X8(b, s, p);
+  } else if (mpack_byte == 0xC8) {
+    BUFFER_READ_X16(b, s, p);
+  } else if (mpack_byte == 0xC9) {
+    BUFFER_READ_X32(b, s, p);
+  } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  int16_t type_byte = buffer_read_byte(s);
+  if (!b || type_byte < 0)
+    return false;
+
+  *ext_type = (int8_t)type_byte;
+  *ext_size = read_size;
+  EMPACK_STAT_SINCE(s);
+  return true;
+}
+
+EMPACK_API bool empack_read_ext_sz(buffer_t* s, int8_t* ext_type, em_byte_t* data, uint32_t count_bytes, uint32_t* ext_size)
+{
+  uint32_t read_size = 0;
+
+  if (!empack_read_ext_size(s, ext_type, &read_size))
+    return false;
+
+  *ext_size = read_size;
+
+  if (read_size > count_bytes) {
+    buffer_set_error(s, EM_ERROR_TOO_BIG);
+    return false;
+  }
+
+  if (!buffer_fits(s, read_size)) {
+    buffer_set_error(s, EM_ERROR_EOF);
+    return false;
+  }
+
+  if (buffer_read(s, data, read_size) != read_size)
+    return false;
+
+  EMPACK_STAT_PAYLOAD(s, EXT, read_size);
+  return true;
 }
 
-void empack_write_nil(buffer_t* s)
+EMPACK_API bool empack_read_timestamp(buffer_t* s, int64_t* seconds, uint32_t* nanoseconds)
 {
+  int8_t ext_type;
+  uint32_t ext_size;
+  em_byte_t p[12];
+
+  if (!empack_read_ext_sz(s, &ext_type, p, sizeof(p), &ext_size))
+    return false;
+
+  if (ext_type != EMPACK_EXT_TIMESTAMP) {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  if (ext_size == 4) {
+    *seconds = empack_load_be(p, 4);
+    *nanoseconds = 0;
+  } else if (ext_size == 8) {
+    uint64_t v = empack_load_be(p, 8);
+    *nanoseconds = v >> 34;
+    *seconds = v & 0x3FFFFFFFFull;
+  } else if (ext_size == 12) {
+    *nanoseconds = empack_load_be(p, 4);
+    *seconds = (int64_t)empack_load_be(p + 4, 8);
+  } else {
+    buffer_set_error(s, EM_ERROR_TYPE);
+    return false;
+  }
+
+  return true;
+}
+
+EMPACK_API void empack_write_nil(buffer_t* s)
+{
+  EMPACK_STAT_MARK(s);
   buffer_write_byte(s, 0xC0);
+  EMPACK_STAT_SINCE(s);
 }
 
-void empack_write_bool(buffer_t* s, bool b)
+EMPACK_API void empack_write_bool(buffer_t* s, bool b)
 {
+  EMPACK_STAT_MARK(s);
   b ? buffer_write_byte(s, 0xC3) : buffer_write_byte(s, 0xC2);
+  EMPACK_STAT_SINCE(s);
 }
 
-void empack_write_u8(buffer_t* s, uint8_t u)
+EMPACK_API void empack_write_u8(buffer_t* s, uint8_t u)
 {
+  EMPACK_STAT_MARK(s);
   if (u < 0x80) {
     buffer_write_byte(s, u);
   } else {
     buffer_write_byte(s, 0xCC);
     buffer_write_byte(s, u);
   }
+  EMPACK_STAT_SINCE(s);
 }
 
-void empack_write_u16(buffer_t* s, uint16_t u)
+EMPACK_API void empack_write_u16(buffer_t* s, uint16_t u)
 {
+  EMPACK_STAT_MARK(s);
   if (u < 256) {
     empack_write_u8(s, (uint8_t)u);
   } else {
     buffer_write_byte(s, 0xCD);
     buffer_write_byte(s, u >> 8);
     buffer_write_byte(s, u & 0xff);
+    EMPACK_STAT_SINCE(s);
   }
 }
 
-void empack_write_u32(buffer_t* s, uint32_t u)
+EMPACK_API void empack_write_u32(buffer_t* s, uint32_t u)
 {
+  EMPACK_STAT_MARK(s);
   if (u < 65536) {
     empack_write_u16(s, (uint16_t)u);
   } else {
@@ -456,84 +821,181 @@ void empack_write_u32(buffer_t* s, uint32_t u)
     for (uint8_t i = 24; i >= 8; i = i - 8)
       buffer_write_byte(s, u >> i);
     buffer_write_byte(s, u & 0xFF);
+    EMPACK_STAT_SINCE(s);
   }
 }
 
-void empack_write_u64(buffer_t* s, uint64_t u)
+EMPACK_API void empack_write_u64(buffer_t* s, uint64_t u)
 {
+  EMPACK_STAT_MARK(s);
   if (u < 4294967296) {
     empack_write_u32(s, (uint32_t)u);
   } else {
-    buffer_write_byte(s, 0xcd);
-    for (uint8_t i = 56; i >= 0; i = i - 8)
+    buffer_write_byte(s, 0xCF);
+    for (int8_t i = 56; i >= 0; i = i - 8)
       buffer_write_byte(s, u >> i & 0xFF);
+    EMPACK_STAT_SINCE(s);
   }
 }
 
-void empack_write_i8(buffer_t* s, int8_t i)
+EMPACK_API void empack_write_i8(buffer_t* s, int8_t i)
 {
-  if ((i < -32) || (i > 0x7F)) {
+  EMPACK_STAT_MARK(s);
+  if (i < -32) {
     buffer_write_byte(s, 0xD0);
     buffer_write_byte(s, i);
   } else {
     buffer_write_byte(s, i);
   }
+  EMPACK_STAT_SINCE(s);
 }
 
-void empack_write_i16(buffer_t* s, int16_t i)
+EMPACK_API void empack_write_i16(buffer_t* s, int16_t i)
 {
-  if ((i < SCHAR_MIN + 1) || (i > UCHAR_MAX + 1)) {
-    buffer_write_byte(s, 0xd1);
-    for (uint8_t i = 8; i >= 0; i = i - 8)
-      buffer_write_byte(s, i >> i);
+  EMPACK_STAT_MARK(s);
+  if (i >= 0) {
+    empack_write_u16(s, (uint16_t)i);
+  } else if (i < SCHAR_MIN) {
+    buffer_write_byte(s, 0xD1);
+    for (int8_t n = 8; n >= 0; n = n - 8)
+      buffer_write_byte(s, i >> n & 0xFF);
+    EMPACK_STAT_SINCE(s);
   } else {
     empack_write_i8(s, (int8_t)i);
   }
 }
 
-void empack_write_i32(buffer_t* s, int32_t i)
+EMPACK_API void empack_write_i32(buffer_t* s, int32_t i)
 {
-  if ((i < SHRT_MIN) || (i > SHRT_MAX)) {
-    buffer_write_byte(s, 0xd2);
-    for (uint8_t i = 24; i >= 0; i = i - 8)
-      buffer_write_byte(s, i >> i & 0xFF);
+  EMPACK_STAT_MARK(s);
+  if (i >= 0) {
+    empack_write_u32(s, (uint32_t)i);
+  } else if (i < SHRT_MIN) {
+    buffer_write_byte(s, 0xD2);
+    for (int8_t n = 24; n >= 0; n = n - 8)
+      buffer_write_byte(s, i >> n & 0xFF);
+    EMPACK_STAT_SINCE(s);
   } else {
     empack_write_i16(s, (int16_t)i);
   }
 }
 
-void empack_write_i64(buffer_t* s, int64_t i)
+EMPACK_API void empack_write_i64(buffer_t* s, int64_t i)
 {
-  if ((i < INT_MIN) || (i > INT_MAX)) {
+  EMPACK_STAT_MARK(s);
+  if (i >= 0) {
+    empack_write_u64(s, (uint64_t)i);
+  } else if (i < INT32_MIN) {
     buffer_write_byte(s, 0xD3);
-    for (uint8_t i = 56; i >= 0; i = i - 8)
-      buffer_write_byte(s, i >> i & 0xFF);
+    for (int8_t n = 56; n >= 0; n = n - 8)
+      buffer_write_byte(s, i >> n & 0xFF);
+    EMPACK_STAT_SINCE(s);
   } else {
     empack_write_i32(s, (int32_t)i);
   }
 }
 
-void empack_write_float(buffer_t* s, float f)
+EMPACK_API void empack_write_float(buffer_t* s, float f)
 {
+  EMPACK_STAT_MARK(s);
   union float_to_byte {
     float f;
     em_byte_t b[4];
   } f2b;
   f2b.f = f;
   buffer_write_byte(s, 0xCA);
-  for (uint8_t i = 3; i >= 0; i--)
+  for (int8_t i = 3; i >= 0; i--)
     buffer_write_byte(s, f2b.b[i]);
+  EMPACK_STAT_SINCE(s);
+}
+
+EMPACK_API void empack_write_double(buffer_t* s, double d)
+{
+  EMPACK_STAT_MARK(s);
+  em_byte_t p[9];
+  uint64_t bits;
+
+  memcpy(&bits, &d, 8);
+  p[0] = CONST(0xCB);
+  empack_store_be(p + 1, bits, 8);
+  buffer_write(s, p, 9);
+  EMPACK_STAT_SINCE(s);
+}
+
+// Picks the narrowest form that reads back as the same double, straight
+// from the bit pattern: an int when the value is integral and fits 64
+// bits, a float32 when dropping the low mantissa bits loses nothing, and
+// a float64 otherwise. -0.0 and NaNs with low payload bits stay floats.
+EMPACK_API void empack_write_number(buffer_t* s, double d)
+{
+  uint64_t bits;
+  memcpy(&bits, &d, 8);
+
+  uint64_t sign = bits >> 63;
+  int32_t exp = (int32_t)(bits >> 52 & 0x7FF) - 1023;
+  uint64_t mant = bits & 0xFFFFFFFFFFFFFull;
+  uint64_t sig = mant | 1ull << 52;
+
+  if ((bits << 1) == 0 && !sign) {
+    empack_write_u8(s, 0);
+    return;
+  }
+
+  // integral when no set mantissa bit sits below the binary point
+  if (exp >= 0 && exp < 64 && (exp >= 52 || (mant & ((1ull << (52 - exp)) - 1)) == 0)) {
+    uint64_t u = exp >= 52 ? sig << (exp - 52) : sig >> (52 - exp);
+
+    if (!sign) {
+      empack_write_u64(s, u);
+      return;
+    }
+    if (u <= 1ull << 63) {
+      empack_write_i64(s, (int64_t)(0 - u));
+      return;
+    }
+  }
+
+  uint32_t f = (uint32_t)sign << 31;
+  bool narrow = false;
+
+  if (exp == -1023) {
+    // -0.0; any other double subnormal is far below float32's range
+    narrow = mant == 0;
+  } else if (exp == 1024) {
+    // infinities, and quiet NaNs whose payload fits
+    narrow = (mant & 0x1FFFFFFF) == 0 && (mant == 0 || (mant >> 51) == 1);
+    f |= 0xFFu << 23 | (uint32_t)(mant >> 29);
+  } else if (exp >= -126 && exp <= 127) {
+    narrow = (mant & 0x1FFFFFFF) == 0;
+    f |= (uint32_t)(exp + 127) << 23 | (uint32_t)(mant >> 29);
+  } else if (exp >= -149 && exp < -126) {
+    // float32 subnormals keep the top 23 - (-126 - exp) bits of sig
+    narrow = (sig & ((1ull << (-97 - exp)) - 1)) == 0;
+    f |= (uint32_t)(sig >> (-97 - exp));
+  }
+
+  if (!narrow) {
+    empack_write_double(s, d);
+    return;
+  }
+
+  EMPACK_STAT_MARK(s);
+  em_byte_t p[5];
+  p[0] = CONST(0xCA);
+  empack_store_be(p + 1, f, 4);
+  buffer_write(s, p, 5);
+  EMPACK_STAT_SINCE(s);
 }
 
 static bool empack_write_size(buffer_t *s, uint8_t xa, uint8_t xb, uint8_t xc, uint32_t x_size)
 {
   if (x_size > USHRT_MAX) {
     buffer_write_byte(s, xa);
-    for (uint8_t i = 24; i >= 0; i = i - 8)
+    for (int8_t i = 24; i >= 0; i = i - 8)
       buffer_write_byte(s, (x_size >> i) & 0xFF);
   } else if (x_size > UCHAR_MAX) {
     buffer_write_byte(s, xb);
-    for (uint8_t i = 8; i >= 0; i = i - 8)
+    for (int8_t i = 8; i >= 0; i = i - 8)
       buffer_write_byte(s, (x_size >> i) & 0xFF);
   } else {
     buffer_write_byte(s, xc);
@@ -543,51 +1005,283 @@ static bool empack_write_size(buffer_t *s, uint8_t xa, uint8_t xb, uint8_t xc, u
   return true;
 }
 
-void empack_write_string(buffer_t* s, em_byte_t* str, uint32_t str_size)
+EMPACK_API void empack_write_string_start(buffer_t* s, uint32_t str_size)
+{
+  EMPACK_STAT_MARK(s);
+  if (str_size <= 31) {
+    buffer_write_byte(s, 0xA0 + str_size);
+  } else {
+    empack_write_size(s, 0xDB, 0xDA, 0xD9, str_size);
+  }
+  EMPACK_STAT_SINCE(s);
+}
+
+EMPACK_API void empack_write_string(buffer_t* s, em_byte_t* str, uint32_t str_size)
 {
+  EMPACK_STAT_MARK(s);
   if (str_size <= 31) {
     buffer_write_byte(s, 0xA0 + str_size);
   } else {
     empack_write_size(s, 0xDB, 0xDA, 0xD9, str_size);
   }
 
+  if (!buffer_fits(s, str_size))
+    buffer_set_error(s, EM_ERROR_OVERFLOW);
+
   buffer_write(s, str, str_size);
+  EMPACK_STAT_SINCE(s);
 }
 
-void empack_write_bin(buffer_t* s, em_byte_t* bin, uint32_t bin_size)
+EMPACK_API void empack_write_bin_start(buffer_t* s, uint32_t bin_size)
 {
+  EMPACK_STAT_MARK(s);
   empack_write_size(s, 0xC6, 0xC5, 0xC4, bin_size);
+  EMPACK_STAT_SINCE(s);
+}
+
+EMPACK_API void empack_write_bin(buffer_t* s, em_byte_t* bin, uint32_t bin_size)
+{
+  EMPACK_STAT_MARK(s);
+  empack_write_size(s, 0xC6, 0xC5, 0xC4, bin_size);
+
+  if (!buffer_fits(s, bin_size))
+    buffer_set_error(s, EM_ERROR_OVERFLOW);
+
   buffer_write(s, bin, bin_size);
+  EMPACK_STAT_SINCE(s);
 }
 
 static bool empack_write_header_size(buffer_t *s, uint8_t xa, uint8_t xb, uint8_t xc, uint32_t x_size)
 {
   bool b = true;
   if (x_size > USHRT_MAX) {
-    b &= buffer_write_byte(s, xa);
-    for (uint8_t i = 24; i >= 0; i = i - 8)
-      b &= buffer_write_byte(s, (x_size >> i) & 0xFF);
+    b &= buffer_write_byte(s, xa) == 1;
+    for (int8_t i = 24; i >= 0; i = i - 8)
+      b &= buffer_write_byte(s, (x_size >> i) & 0xFF) == 1;
   } else if (x_size > 15) {
-    b &= buffer_write_byte(s, xb);
-    for (uint8_t i = 8; i >= 0; i = i - 8)
-      b &= buffer_write_byte(s, (x_size >> i) & 0xFF);
+    b &= buffer_write_byte(s, xb) == 1;
+    for (int8_t i = 8; i >= 0; i = i - 8)
+      b &= buffer_write_byte(s, (x_size >> i) & 0xFF) == 1;
   } else {
-    b &= buffer_write_byte(s, xc + x_size);
+    b &= buffer_write_byte(s, xc + x_size) == 1;
   }
 
   return b;
 }
 
-void empack_write_array_start(buffer_t* s, uint32_t array_size)
+EMPACK_API void empack_write_array_start(buffer_t* s, uint32_t array_size)
 {
+  EMPACK_STAT_MARK(s);
   empack_write_header_size(s, 0xDD, 0xDC, 0x90, array_size);
+  EMPACK_STAT_SINCE(s);
+}
+
+EMPACK_API void empack_write_map_start(buffer_t* s, uint32_t map_size)
+{
+  EMPACK_STAT_MARK(s);
+  empack_write_header_size(s, 0xDF, 0xDE, 0x80, map_size);
+  EMPACK_STAT_SINCE(s);
+}
+
+EMPACK_API void empack_write_ext_start(buffer_t* s, int8_t ext_type, uint32_t ext_size)
+{
+  EMPACK_STAT_MARK(s);
+  switch (ext_size) {
+  case 1:
+    buffer_write_byte(s, 0xD4);
+    break;
+  case 2:
+    buffer_write_byte(s, 0xD5);
+    break;
+  case 4:
+    buffer_write_byte(s, 0xD6);
+    break;
+  case 8:
+    buffer_write_byte(s, 0xD7);
+    break;
+  case 16:
+    buffer_write_byte(s, 0xD8);
+    break;
+  default:
+    empack_write_size(s, 0xC9, 0xC8, 0xC7, ext_size);
+    break;
+  }
+  buffer_write_byte(s, ext_type);
+  EMPACK_STAT_SINCE(s);
+}
+
+EMPACK_API void empack_write_ext(buffer_t* s, int8_t ext_type, em_byte_t* data, uint32_t ext_size)
+{
+  empack_write_ext_start(s, ext_type, ext_size);
+
+  if (!buffer_fits(s, ext_size))
+    buffer_set_error(s, EM_ERROR_OVERFLOW);
+
+  if (buffer_write(s, data, ext_size) == ext_size)
+    EMPACK_STAT_PAYLOAD(s, EXT, ext_size);
+}
+
+EMPACK_API void empack_write_timestamp(buffer_t* s, int64_t seconds, uint32_t nanoseconds)
+{
+  em_byte_t p[12];
+
+  if ((uint64_t)seconds >> 34 == 0) {
+    if (nanoseconds == 0 && (uint64_t)seconds >> 32 == 0) {
+      empack_store_be(p, (uint64_t)seconds, 4);
+      empack_write_ext(s, EMPACK_EXT_TIMESTAMP, p, 4);
+    } else {
+      empack_store_be(p, ((uint64_t)nanoseconds << 34) | (uint64_t)seconds, 8);
+      empack_write_ext(s, EMPACK_EXT_TIMESTAMP, p, 8);
+    }
+  } else {
+    empack_store_be(p, nanoseconds, 4);
+    empack_store_be(p + 4, (uint64_t)seconds, 8);
+    empack_write_ext(s, EMPACK_EXT_TIMESTAMP, p, 12);
+  }
+}
+
+// ======= Sizes ===== //
+//
+// Each mirrors the header choice of its writer above.
+
+static size_t empack_sizeof_size(uint32_t size)
+{
+  return size <= UCHAR_MAX ? 2 : size <= USHRT_MAX ? 3 : 5;
+}
+
+EMPACK_API size_t empack_sizeof_uint(uint64_t u)
+{
+  return u < 0x80 ? 1 : u <= UCHAR_MAX ? 2 : u <= USHRT_MAX ? 3 : u <= UINT32_MAX ? 5 : 9;
+}
+
+EMPACK_API size_t empack_sizeof_sint(int64_t i)
+{
+  if (i >= 0)
+    return empack_sizeof_uint((uint64_t)i);
+
+  return i >= -32 ? 1 : i >= SCHAR_MIN ? 2 : i >= SHRT_MIN ? 3 : i >= INT32_MIN ? 5 : 9;
+}
+
+EMPACK_API size_t empack_sizeof_number(double d)
+{
+  buffer_t b;
+  buffer_init_measure(&b);
+  empack_write_number(&b, d);
+  return b.pos;
+}
+
+EMPACK_API size_t empack_sizeof_string(uint32_t str_size)
+{
+  return (str_size <= 31 ? 1 : empack_sizeof_size(str_size)) + (size_t)str_size;
+}
+
+EMPACK_API size_t empack_sizeof_bin(uint32_t bin_size)
+{
+  return empack_sizeof_size(bin_size) + (size_t)bin_size;
+}
+
+EMPACK_API size_t empack_sizeof_array(uint32_t array_size)
+{
+  return array_size <= 15 ? 1 : array_size <= USHRT_MAX ? 3 : 5;
+}
+
+EMPACK_API size_t empack_sizeof_map(uint32_t map_size)
+{
+  return empack_sizeof_array(map_size);
+}
+
+EMPACK_API size_t empack_sizeof_ext(uint32_t ext_size)
+{
+  switch (ext_size) {
+  case 1:
+  case 2:
+  case 4:
+  case 8:
+  case 16:
+    return 2 + (size_t)ext_size;
+  default:
+    return 1 + empack_sizeof_size(ext_size) + (size_t)ext_size;
+  }
+}
+
+EMPACK_API size_t empack_sizeof_timestamp(int64_t seconds, uint32_t nanoseconds)
+{
+  if ((uint64_t)seconds >> 34 != 0)
+    return empack_sizeof_ext(12);
+
+  return empack_sizeof_ext(nanoseconds == 0 && (uint64_t)seconds >> 32 == 0 ? 4 : 8);
+}
+
+#ifdef EMPACK_STATS
+
+// maps a leading msgpack byte to its stat type and width
+static void empack_stats_classify(uint8_t tag, uint8_t* type, uint8_t* width)
+{
+  static const uint8_t widths[4] = { EMPACK_STAT_8, EMPACK_STAT_16, EMPACK_STAT_32, EMPACK_STAT_64 };
+
+  *width = EMPACK_STAT_FIX;
+
+  if (tag < 0x80) {
+    *type = EMPACK_STAT_UINT;
+  } else if (tag < 0x90) {
+    *type = EMPACK_STAT_MAP;
+  } else if (tag < 0xA0) {
+    *type = EMPACK_STAT_ARRAY;
+  } else if (tag < 0xC0) {
+    *type = EMPACK_STAT_STRING;
+  } else if (tag >= 0xE0) {
+    *type = EMPACK_STAT_SINT;
+  } else if (tag == 0xC0) {
+    *type = EMPACK_STAT_NIL;
+  } else if (tag <= 0xC3) {
+    *type = EMPACK_STAT_BOOL;
+  } else if (tag <= 0xC6) {
+    *type = EMPACK_STAT_BIN;
+    *width = widths[tag - 0xC4];
+  } else if (tag <= 0xC9) {
+    *type = EMPACK_STAT_EXT;
+    *width = widths[tag - 0xC7];
+  } else if (tag <= 0xCB) {
+    *type = EMPACK_STAT_FLOAT;
+    *width = tag == 0xCA ? EMPACK_STAT_32 : EMPACK_STAT_64;
+  } else if (tag <= 0xCF) {
+    *type = EMPACK_STAT_UINT;
+    *width = widths[tag - 0xCC];
+  } else if (tag <= 0xD3) {
+    *type = EMPACK_STAT_SINT;
+    *width = widths[tag - 0xD0];
+  } else if (tag <= 0xD8) {
+    *type = EMPACK_STAT_EXT;
+  } else if (tag <= 0xDB) {
+    *type = EMPACK_STAT_STRING;
+    *width = widths[tag - 0xD9];
+  } else if (tag <= 0xDD) {
+    *type = EMPACK_STAT_ARRAY;
+    *width = widths[tag - 0xDB];
+  } else {
+    *type = EMPACK_STAT_MAP;
+    *width = widths[tag - 0xDD];
+  }
+}
+
+EMPACK_API void empack_stats_record(buffer_t* s, em_size_t mark)
+{
+  uint8_t type, width;
+
+  if (s->pos <= mark || s->buf == NULL)
+    return;
+
+  empack_stats_classify((uint8_t)s->buf[mark], &type, &width);
+  s->stats.values[type][width]++;
+  s->stats.bytes[type] += s->pos - mark;
 }
 
-void empack_write_map_start(buffer_t* s, uint32_t map_size)
+EMPACK_API void empack_stats_payload(buffer_t* s, uint8_t stat_type, uint32_t size)
 {
-  empack_write_header_size(s, 0xDE, 0xDF, 0x80, map_size);
+  s->stats.bytes[stat_type] += size;
 }
 
+#endif // EMPACK_STATS
 
 #ifdef EMPACK_PRINTF
 
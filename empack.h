@@ -20,6 +20,11 @@ extern "C" {
 #define EMPACK_JSON_BUFF_SIZE 128
 #endif
 
+// containers nested deeper than this fail a skip with EM_ERROR_DEPTH
+#ifndef EMPACK_SKIP_MAX_DEPTH
+#define EMPACK_SKIP_MAX_DEPTH 256
+#endif
+
 
 // ====================== TYPES ============== //
 
@@ -41,49 +46,112 @@ enum empack_types {
 typedef enum empack_types empack_type_t;
 struct byte_buff;
 
+#define EMPACK_EXT_TIMESTAMP -1
+
 #define EMPACK_UINT_SMALL_MAX 224
 #define EMPACK_SINT_SMALL_MAX 128
 
 // ====================== API ============== //
 
-empack_type_t empack_next_type(buffer_t* s);
-bool empack_next_skip(buffer_t* s, empack_type_t* skip_type);
-bool empack_next_copy(buffer_t* s, buffer_t* out, empack_type_t* skip_type);
-
-bool empack_read_nil(buffer_t* s);
-bool empack_read_bool(buffer_t* s, bool* b);
-bool empack_read_sint(buffer_t* s, em_byte_t* b, uint8_t count_bytes);
-bool empack_read_uint(buffer_t* s, em_byte_t* b, uint8_t count_bytes);
-bool empack_read_float(buffer_t* s, float* f);
-
-bool empack_read_string_sz(buffer_t* s, char* str, uint32_t count_bytes, uint32_t* str_size);
-bool empack_read_bin_sz(buffer_t* s, em_byte_t* bin, uint32_t count_bytes, uint32_t* bin_size);
-
-bool empack_read_array_size(buffer_t* s, uint32_t* array_size);
-bool empack_read_map_size(buffer_t* s, uint32_t* map_size);
+EMPACK_API empack_type_t empack_next_type(buffer_t* s);
+EMPACK_API bool empack_next_skip(buffer_t* s, empack_type_t* skip_type);
+EMPACK_API bool empack_next_copy(buffer_t* s, buffer_t* out, empack_type_t* skip_type);
+
+EMPACK_API bool empack_read_nil(buffer_t* s);
+EMPACK_API bool empack_read_bool(buffer_t* s, bool* b);
+// also takes the uint forms the signed writers use for non-negative values,
+// latching EM_ERROR_TOO_BIG when one doesn't fit count_bytes as signed
+EMPACK_API bool empack_read_sint(buffer_t* s, em_byte_t* b, uint8_t count_bytes);
+EMPACK_API bool empack_read_uint(buffer_t* s, em_byte_t* b, uint8_t count_bytes);
+EMPACK_API bool empack_read_float(buffer_t* s, float* f);
+EMPACK_API bool empack_read_double(buffer_t* s, double* d);
+
+EMPACK_API bool empack_read_string_size(buffer_t* s, uint32_t* str_size);
+EMPACK_API bool empack_read_string_sz(buffer_t* s, char* str, uint32_t count_bytes, uint32_t* str_size);
+EMPACK_API bool empack_read_string(buffer_t* s, char* str, uint32_t count_bytes);
+EMPACK_API bool empack_read_string_ref(buffer_t* s, const char** str, uint32_t* str_size);
+EMPACK_API bool empack_read_bin_size(buffer_t* s, uint32_t* bin_size);
+EMPACK_API bool empack_read_bin_sz(buffer_t* s, em_byte_t* bin, uint32_t count_bytes, uint32_t* bin_size);
+EMPACK_API bool empack_read_bin(buffer_t* s, em_byte_t* bin, uint32_t count_bytes);
+
+EMPACK_API bool empack_read_array_size(buffer_t* s, uint32_t* array_size);
+EMPACK_API bool empack_read_map_size(buffer_t* s, uint32_t* map_size);
+
+EMPACK_API bool empack_read_ext_size(buffer_t* s, int8_t* ext_type, uint32_t* ext_size);
+EMPACK_API bool empack_read_ext_sz(buffer_t* s, int8_t* ext_type, em_byte_t* data, uint32_t count_bytes, uint32_t* ext_size);
+EMPACK_API bool empack_read_timestamp(buffer_t* s, int64_t* seconds, uint32_t* nanoseconds);
 
 // ======= Basic Types ===== //
-void empack_write_nil(buffer_t* s);
-void empack_write_bool(buffer_t* s, bool b);
-
-void empack_write_u8(buffer_t* s, uint8_t u);
-void empack_write_u16(buffer_t* s, uint16_t u);
-void empack_write_u32(buffer_t* s, uint32_t u);
-void empack_write_u64(buffer_t* s, uint64_t u);
-void empack_write_i8(buffer_t* s, int8_t i);
-void empack_write_i16(buffer_t* s, int16_t i);
-void empack_write_i32(buffer_t* s, int32_t i);
-void empack_write_i64(buffer_t* s, int64_t i);
-
-void empack_write_float(buffer_t* s, float f);
+EMPACK_API void empack_write_nil(buffer_t* s);
+EMPACK_API void empack_write_bool(buffer_t* s, bool b);
+
+EMPACK_API void empack_write_u8(buffer_t* s, uint8_t u);
+EMPACK_API void empack_write_u16(buffer_t* s, uint16_t u);
+EMPACK_API void empack_write_u32(buffer_t* s, uint32_t u);
+EMPACK_API void empack_write_u64(buffer_t* s, uint64_t u);
+EMPACK_API void empack_write_i8(buffer_t* s, int8_t i);
+EMPACK_API void empack_write_i16(buffer_t* s, int16_t i);
+EMPACK_API void empack_write_i32(buffer_t* s, int32_t i);
+EMPACK_API void empack_write_i64(buffer_t* s, int64_t i);
+
+EMPACK_API void empack_write_float(buffer_t* s, float f);
+EMPACK_API void empack_write_double(buffer_t* s, double d);
+// smallest lossless form of `d`: an int, float32 or float64
+EMPACK_API void empack_write_number(buffer_t* s, double d);
 
 // ======= Data Types ===== //
-void empack_write_string(buffer_t* s, em_byte_t* str, uint32_t str_size);
-void empack_write_bin(buffer_t* s, em_byte_t* b, uint32_t bin_size);
+EMPACK_API void empack_write_string(buffer_t* s, em_byte_t* str, uint32_t str_size);
+EMPACK_API void empack_write_string_start(buffer_t* s, uint32_t str_size);
+EMPACK_API void empack_write_bin(buffer_t* s, em_byte_t* b, uint32_t bin_size);
+EMPACK_API void empack_write_bin_start(buffer_t* s, uint32_t bin_size);
 
 // ======= String Types ===== //
-void empack_write_array_start(buffer_t* s, uint32_t array_size);
-void empack_write_map_start(buffer_t* s, uint32_t map_size);
+EMPACK_API void empack_write_array_start(buffer_t* s, uint32_t array_size);
+EMPACK_API void empack_write_map_start(buffer_t* s, uint32_t map_size);
+
+// ======= Extension Types ===== //
+EMPACK_API void empack_write_ext_start(buffer_t* s, int8_t ext_type, uint32_t ext_size);
+EMPACK_API void empack_write_ext(buffer_t* s, int8_t ext_type, em_byte_t* data, uint32_t ext_size);
+EMPACK_API void empack_write_timestamp(buffer_t* s, int64_t seconds, uint32_t nanoseconds);
+
+// ======= Sizes ===== //
+//
+// Encoded size of a value, payload included, without writing it. Headers
+// alone are empack_sizeof_array/map; for whole messages run the writers
+// over a `buffer_init_measure` buffer instead.
+#define EMPACK_SIZEOF_NIL 1
+#define EMPACK_SIZEOF_BOOL 1
+#define EMPACK_SIZEOF_FLOAT 5
+#define EMPACK_SIZEOF_DOUBLE 9
+
+EMPACK_API size_t empack_sizeof_uint(uint64_t u);
+EMPACK_API size_t empack_sizeof_sint(int64_t i);
+EMPACK_API size_t empack_sizeof_number(double d);
+EMPACK_API size_t empack_sizeof_string(uint32_t str_size);
+EMPACK_API size_t empack_sizeof_bin(uint32_t bin_size);
+EMPACK_API size_t empack_sizeof_array(uint32_t array_size);
+EMPACK_API size_t empack_sizeof_map(uint32_t map_size);
+EMPACK_API size_t empack_sizeof_ext(uint32_t ext_size);
+EMPACK_API size_t empack_sizeof_timestamp(int64_t seconds, uint32_t nanoseconds);
+
+// ======= Stats ===== //
+#ifdef EMPACK_STATS
+EMPACK_API void empack_stats_record(buffer_t* s, em_size_t mark);
+EMPACK_API void empack_stats_payload(buffer_t* s, uint8_t stat_type, uint32_t size);
+
+#define EMPACK_STAT_MARK(s) em_size_t empack_stat_mark = (s)->pos
+#define EMPACK_STAT_SINCE(s) empack_stats_record((s), empack_stat_mark)
+#define EMPACK_STAT_PAYLOAD(s, t, n) empack_stats_payload((s), EMPACK_STAT_##t, (n))
+#define EMPACK_STAT_ENTER(s) \
+  ((s)->stats.max_depth = ++(s)->stats.depth > (s)->stats.max_depth ? (s)->stats.depth : (s)->stats.max_depth)
+#define EMPACK_STAT_LEAVE(s) ((s)->stats.depth--)
+#else
+#define EMPACK_STAT_MARK(s)
+#define EMPACK_STAT_SINCE(s) ((void)0)
+#define EMPACK_STAT_PAYLOAD(s, t, n) ((void)0)
+#define EMPACK_STAT_ENTER(s) ((void)0)
+#define EMPACK_STAT_LEAVE(s) ((void)0)
+#endif // EMPACK_STATS
 
 #ifdef EMPACK_JSON
 void empack_to_json(buffer_t* output, buffer_t* input, emsize_t buffer_size);
@@ -0,0 +1,407 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_HPP__
+#define __EMPACK_HPP__
+
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
+
+#if __cplusplus >= 202002L && __has_include(<span>)
+#include <span>
+#define EMPACK_HAS_SPAN 1
+#endif
+
+#include "em_buffer.h"
+#include "empack.h"
+
+// ====================== C++ ============== //
+//
+// Typed layer over the C API, C++17 or later. `empack::pack(buf, value)`
+// picks the encoder for the static type with `if constexpr`, so each call
+// inlines down to the matching empack_write_* call with no runtime type
+// dispatch. `empack::unpack(buf, value)` decodes in place and returns
+// false on failure, with the sticky error set on the buffer as usual;
+// `empack::unpack<T>(buf)` returns the value instead.
+//
+//   bool, integers, float, double    native msgpack scalars
+//   std::nullptr_t, std::monostate   nil
+//   std::string, std::string_view    str, string_view decodes zero-copy
+//   std::vector<uint8_t>, span<u8>   bin, span<const u8> decodes zero-copy
+//   std::vector<T>, std::span<T>     array
+//   std::optional<T>                 nil or T
+//   std::variant<Ts...>              [index, value]
+//   structs with EMPACK_FIELDS(...)  array of the listed fields
+//
+// `empack::max_size<T>()` is the worst case encoded size of a fixed size
+// type, as a constant expression for sizing stack buffers.
+
+// declares the fields of a struct, in wire order
+#define EMPACK_FIELDS(...)                                  \
+  auto empack_fields() { return std::tie(__VA_ARGS__); }     \
+  auto empack_fields() const { return std::tie(__VA_ARGS__); }
+
+namespace empack {
+
+namespace detail {
+
+  template <class>
+  inline constexpr bool dependent_false = false;
+
+  template <class T, class = void>
+  struct has_fields : std::false_type {
+  };
+
+  template <class T>
+  struct has_fields<T, std::void_t<decltype(std::declval<const T&>().empack_fields())>> : std::true_type {
+  };
+
+  template <class T>
+  struct is_optional : std::false_type {
+  };
+
+  template <class T>
+  struct is_optional<std::optional<T>> : std::true_type {
+  };
+
+  template <class T>
+  struct is_variant : std::false_type {
+  };
+
+  template <class... Ts>
+  struct is_variant<std::variant<Ts...>> : std::true_type {
+  };
+
+  template <class T>
+  struct is_vector : std::false_type {
+  };
+
+  template <class T, class A>
+  struct is_vector<std::vector<T, A>> : std::true_type {
+  };
+
+  template <class T>
+  struct is_span : std::false_type {
+  };
+
+  template <class T>
+  struct is_mutable_span : std::false_type {
+  };
+
+#ifdef EMPACK_HAS_SPAN
+  template <class T, std::size_t N>
+  struct is_span<std::span<T, N>> : std::true_type {
+  };
+
+  template <class T, std::size_t N>
+  struct is_mutable_span<std::span<T, N>> : std::bool_constant<!std::is_const_v<T>> {
+  };
+#endif
+
+  template <class T, class = void>
+  struct is_bytes : std::false_type {
+  };
+
+  template <class T>
+  struct is_bytes<T, std::enable_if_t<is_vector<T>::value || is_span<T>::value>>
+      : std::is_same<std::remove_cv_t<typename T::value_type>, std::uint8_t> {
+  };
+
+  template <class T>
+  inline constexpr bool is_bytes_v = is_bytes<T>::value;
+
+  template <class T>
+  inline constexpr bool is_nil_v = std::is_same_v<T, std::nullptr_t> || std::is_same_v<T, std::monostate>;
+
+  template <class T>
+  using fields_t = decltype(std::declval<const T&>().empack_fields());
+
+  template <class T>
+  using field_t = std::remove_cv_t<std::remove_reference_t<T>>;
+
+  template <class T>
+  inline bool read_int(buffer_t& buf, T& value)
+  {
+    empack_type_t type = empack_next_type(&buf);
+    std::uint64_t u = 0;
+    std::int64_t i = 0;
+
+    // empack_read_sint takes either encoding of a signed value
+    if constexpr (std::is_signed_v<T>) {
+      if (!empack_read_sint(&buf, (em_byte_t*)&i, 8))
+        return false;
+      if (i < (std::int64_t)std::numeric_limits<T>::min() || i > (std::int64_t)std::numeric_limits<T>::max()) {
+        buffer_set_error(&buf, EM_ERROR_TOO_BIG);
+        return false;
+      }
+      value = (T)i;
+      return true;
+    }
+
+    if (type == EMPACK_UINT) {
+      if (!empack_read_uint(&buf, (em_byte_t*)&u, 8))
+        return false;
+      if (u > (std::uint64_t)std::numeric_limits<T>::max()) {
+        buffer_set_error(&buf, EM_ERROR_TOO_BIG);
+        return false;
+      }
+      value = (T)u;
+      return true;
+    }
+
+    if (type == EMPACK_SINT) {
+      if (!empack_read_sint(&buf, (em_byte_t*)&i, 8))
+        return false;
+      if (i < 0 ? i < (std::int64_t)std::numeric_limits<T>::min()
+                : (std::uint64_t)i > (std::uint64_t)std::numeric_limits<T>::max()) {
+        buffer_set_error(&buf, EM_ERROR_TOO_BIG);
+        return false;
+      }
+      value = (T)i;
+      return true;
+    }
+
+    buffer_set_error(&buf, type == EMPACK_EMPTY ? EM_ERROR_EOF : EM_ERROR_TYPE);
+    return false;
+  }
+
+  // str and bin payloads are returned in place, like empack_read_string_ref
+  inline bool read_bin_ref(buffer_t& buf, const std::uint8_t** data, std::uint32_t* size)
+  {
+    if (!empack_read_bin_size(&buf, size))
+      return false;
+
+    if (!buffer_fits(&buf, *size)) {
+      buffer_set_error(&buf, EM_ERROR_EOF);
+      return false;
+    }
+
+    *data = (const std::uint8_t*)buf.buf + buf.pos;
+    buf.pos += *size;
+    buf.max = buf.pos;
+    return true;
+  }
+
+  inline constexpr std::size_t header_size(std::size_t count)
+  {
+    return count <= 15 ? 1 : count <= 0xFFFF ? 3 : 5;
+  }
+
+} // namespace detail
+
+template <class T>
+void pack(buffer_t& buf, const T& value);
+
+template <class T>
+bool unpack(buffer_t& buf, T& value);
+
+template <class T>
+constexpr std::size_t max_size();
+
+namespace detail {
+
+  template <class V, std::size_t... I>
+  inline bool unpack_variant(buffer_t& buf, V& value, std::uint32_t index, std::index_sequence<I...>)
+  {
+    bool ok = false;
+    bool known = ((index == I
+                      && (ok = unpack(buf, value.template emplace<I>()), true))
+        || ...);
+
+    if (!known)
+      buffer_set_error(&buf, EM_ERROR_TYPE);
+    return ok;
+  }
+
+  template <class Tuple, std::size_t... I>
+  constexpr std::size_t fields_size(std::index_sequence<I...>)
+  {
+    return header_size(sizeof...(I)) + (std::size_t(0) + ... + max_size<field_t<std::tuple_element_t<I, Tuple>>>());
+  }
+
+  template <class... Ts>
+  constexpr std::size_t variant_size(std::variant<Ts...>*)
+  {
+    std::size_t size = 0;
+    ((size = max_size<Ts>() > size ? max_size<Ts>() : size), ...);
+    return 1 + 5 + size;
+  }
+
+} // namespace detail
+
+template <class T>
+inline void pack(buffer_t& buf, const T& value)
+{
+  using U = std::remove_cv_t<T>;
+
+  if constexpr (std::is_same_v<U, bool>) {
+    empack_write_bool(&buf, value);
+  } else if constexpr (detail::is_nil_v<U>) {
+    empack_write_nil(&buf);
+  } else if constexpr (std::is_integral_v<U> && std::is_signed_v<U>) {
+    if constexpr (sizeof(U) == 1)
+      empack_write_i8(&buf, value);
+    else if constexpr (sizeof(U) == 2)
+      empack_write_i16(&buf, value);
+    else if constexpr (sizeof(U) == 4)
+      empack_write_i32(&buf, value);
+    else
+      empack_write_i64(&buf, value);
+  } else if constexpr (std::is_integral_v<U>) {
+    if constexpr (sizeof(U) == 1)
+      empack_write_u8(&buf, value);
+    else if constexpr (sizeof(U) == 2)
+      empack_write_u16(&buf, value);
+    else if constexpr (sizeof(U) == 4)
+      empack_write_u32(&buf, value);
+    else
+      empack_write_u64(&buf, value);
+  } else if constexpr (std::is_same_v<U, float>) {
+    empack_write_float(&buf, value);
+  } else if constexpr (std::is_same_v<U, double>) {
+    empack_write_double(&buf, value);
+  } else if constexpr (std::is_convertible_v<const U&, std::string_view>) {
+    std::string_view s = value;
+    empack_write_string(&buf, (em_byte_t*)s.data(), (std::uint32_t)s.size());
+  } else if constexpr (detail::is_bytes_v<U>) {
+    empack_write_bin(&buf, (em_byte_t*)value.data(), (std::uint32_t)value.size());
+  } else if constexpr (detail::is_optional<U>::value) {
+    if (value)
+      pack(buf, *value);
+    else
+      empack_write_nil(&buf);
+  } else if constexpr (detail::is_variant<U>::value) {
+    empack_write_array_start(&buf, 2);
+    empack_write_u32(&buf, (std::uint32_t)value.index());
+    std::visit([&buf](const auto& v) { pack(buf, v); }, value);
+  } else if constexpr (detail::is_vector<U>::value || detail::is_span<U>::value) {
+    empack_write_array_start(&buf, (std::uint32_t)value.size());
+    for (const auto& v : value)
+      pack(buf, v);
+  } else if constexpr (detail::has_fields<U>::value) {
+    auto fields = value.empack_fields();
+    empack_write_array_start(&buf, std::tuple_size_v<decltype(fields)>);
+    std::apply([&buf](const auto&... v) { (pack(buf, v), ...); }, fields);
+  } else {
+    static_assert(detail::dependent_false<U>, "empack: no encoder for this type");
+  }
+}
+
+template <class T>
+inline bool unpack(buffer_t& buf, T& value)
+{
+  const char* str;
+  const std::uint8_t* bin;
+  std::uint32_t size;
+
+  if constexpr (std::is_same_v<T, bool>) {
+    return empack_read_bool(&buf, &value);
+  } else if constexpr (detail::is_nil_v<T>) {
+    return empack_read_nil(&buf);
+  } else if constexpr (std::is_integral_v<T>) {
+    return detail::read_int(buf, value);
+  } else if constexpr (std::is_same_v<T, float>) {
+    return empack_read_float(&buf, &value);
+  } else if constexpr (std::is_same_v<T, double>) {
+    return empack_read_double(&buf, &value);
+  } else if constexpr (std::is_same_v<T, std::string_view> || std::is_same_v<T, std::string>) {
+    if (!empack_read_string_ref(&buf, &str, &size))
+      return false;
+    value = T(str, size);
+    return true;
+  } else if constexpr (detail::is_bytes_v<T> && detail::is_mutable_span<T>::value) {
+    static_assert(detail::dependent_false<T>,
+        "empack: a span unpacks zero-copy from the buffer, so it must be std::span<const uint8_t>");
+  } else if constexpr (detail::is_bytes_v<T>) {
+    if (!detail::read_bin_ref(buf, &bin, &size))
+      return false;
+    value = T(bin, bin + size);
+    return true;
+  } else if constexpr (detail::is_optional<T>::value) {
+    if (empack_next_type(&buf) == EMPACK_NIL) {
+      value.reset();
+      return empack_read_nil(&buf);
+    }
+    return unpack(buf, value.emplace());
+  } else if constexpr (detail::is_variant<T>::value) {
+    std::uint32_t index = 0;
+    if (!empack_read_array_size(&buf, &size))
+      return false;
+    if (size != 2) {
+      buffer_set_error(&buf, EM_ERROR_TYPE);
+      return false;
+    }
+    if (!detail::read_int(buf, index))
+      return false;
+    return detail::unpack_variant(buf, value, index, std::make_index_sequence<std::variant_size_v<T>>());
+  } else if constexpr (detail::is_vector<T>::value) {
+    if (!empack_read_array_size(&buf, &size))
+      return false;
+    // every element takes at least a byte, so a bogus count can't over-reserve
+    value.clear();
+    value.reserve(size < buffer_available(&buf) ? size : buffer_available(&buf));
+    for (std::uint32_t i = 0; i < size; i++) {
+      if (!unpack(buf, value.emplace_back()))
+        return false;
+    }
+    return true;
+  } else if constexpr (detail::has_fields<T>::value) {
+    auto fields = value.empack_fields();
+    if (!empack_read_array_size(&buf, &size))
+      return false;
+    if (size != std::tuple_size_v<decltype(fields)>) {
+      buffer_set_error(&buf, EM_ERROR_TYPE);
+      return false;
+    }
+    return std::apply([&buf](auto&... v) { return (unpack(buf, v) && ...); }, fields);
+  } else {
+    static_assert(detail::dependent_false<T>, "empack: no decoder for this type");
+  }
+}
+
+template <class T>
+inline T unpack(buffer_t& buf)
+{
+  T value {};
+  unpack(buf, value);
+  return value;
+}
+
+template <class T>
+constexpr std::size_t max_size()
+{
+  using U = std::remove_cv_t<T>;
+
+  if constexpr (std::is_same_v<U, bool> || detail::is_nil_v<U>)
+    return 1;
+  else if constexpr (std::is_integral_v<U>)
+    return 1 + sizeof(U);
+  else if constexpr (std::is_same_v<U, float>)
+    return 5;
+  else if constexpr (std::is_same_v<U, double>)
+    return 9;
+  else if constexpr (detail::is_optional<U>::value)
+    return max_size<typename U::value_type>();
+  else if constexpr (detail::is_variant<U>::value)
+    return detail::variant_size((U*)nullptr);
+  else if constexpr (detail::has_fields<U>::value)
+    return detail::fields_size<detail::fields_t<U>>(
+        std::make_index_sequence<std::tuple_size_v<detail::fields_t<U>>>());
+  else
+    static_assert(detail::dependent_false<U>, "empack: type has no fixed maximum size");
+}
+
+} // namespace empack
+
+#endif
@@ -0,0 +1,23 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#ifndef __EMPACK_INLINE__
+#define __EMPACK_INLINE__
+
+// Single header build of the buffer and msgpack primitives, see the Build
+// Modes notes in em_buffer.h. Include this in place of em_buffer.h and
+// empack.h; it must come before any other empack header in the file.
+
+#ifndef EMPACK_HEADER_ONLY
+#define EMPACK_HEADER_ONLY
+#endif
+
+#include "em_buffer.h"
+#include "empack.h"
+
+#include "em_buffer.c"
+#include "empack.c"
+
+#endif
@@ -21,12 +21,32 @@
  * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE SOFTWARE.
  */
 
+#include <math.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
 
+#include "em_columnar.h"
+#include "em_cursor.h"
+#include "em_edit.h"
+#include "em_ext.h"
+#include "em_frame.h"
+#include "em_hash.h"
+#include "em_index.h"
+#include "em_intern.h"
+#include "em_keydict.h"
+#include "em_pool.h"
+#include "em_queue.h"
+#include "em_ring.h"
+#include "em_sort.h"
+#include "em_template.h"
+#include "em_utf8.h"
 #include "empack.h"
 
 // enable this to exit at the first error
@@ -115,6 +135,21 @@ void empack_reader_init_data(buffer_t* reader, char* buf, size_t len)
   memcpy(reader->buf, buf, len);
 }
 
+// scratch files go under $TMPDIR rather than where the tests run
+static const char* test_tmp_dir(void)
+{
+  const char* dir = getenv("TMPDIR");
+  return dir != NULL ? dir : "/tmp";
+}
+
+// the pid keeps the test binaries from clobbering each other's files when
+// they run in parallel
+static const char* test_tmp_path(char* path, size_t size, const char* name)
+{
+  snprintf(path, size, "%s/%s.%ld", test_tmp_dir(), name, (long)getpid());
+  return path;
+}
+
 void test_true_impl(bool result, const char* file, int line, const char* format, ...)
 {
   ++tests;
@@ -340,15 +375,1577 @@ static void test_write_basic_structures()
 
 static void test_next_funcs()
 {
-  char buf[MAX_TEST_BUFF];
+  em_byte_t buf[MAX_TEST_BUFF];
+  size_t size = MAX_TEST_BUFF;
+  buffer_t buffer;
+  empack_type_t type;
+
+  // {"a": [1, -2, "xyz"], "b": nil}
+  buffer_init(&buffer, buf, size);
+  empack_write_map_start(&buffer, 2);
+  empack_write_string(&buffer, "a", 1);
+  empack_write_array_start(&buffer, 3);
+  empack_write_u8(&buffer, 1);
+  empack_write_i8(&buffer, -2);
+  empack_write_string(&buffer, "xyz", 3);
+  empack_write_string(&buffer, "b", 1);
+  empack_write_nil(&buffer);
+  empack_write_u16(&buffer, 300);
+
+  buffer_init(&buffer, buf, buffer.max);
+  TEST_TRUE(empack_next_type(&buffer) == EMPACK_MAP);
+  TEST_TRUE(empack_next_skip(&buffer, &type) && type == EMPACK_MAP);
+  TEST_TRUE(empack_next_type(&buffer) == EMPACK_UINT);
+
+  uint64_t u = 0;
+  TEST_TRUE(empack_read_uint(&buffer, (em_byte_t*)&u, 8) && u == 300);
+  TEST_TRUE(empack_next_type(&buffer) == EMPACK_EMPTY);
+  TEST_TRUE(!empack_next_skip(&buffer, &type));
+
+  // skipping a truncated string fails instead of running past the end
+  buffer_init(&buffer, buf, 3);
+  empack_write_string(&buffer, "xyz", 3);
+  buffer_init(&buffer, buf, 3);
+  TEST_TRUE(!empack_next_skip(&buffer, &type) && type == EMPACK_STRING);
+
+  // nesting is bounded, so a run of 0x91 bytes can't exhaust the stack
+  memset(buf, 0x91, MAX_TEST_BUFF - 1);
+  buf[MAX_TEST_BUFF - 1] = (em_byte_t)0xC0;
+  buffer_init(&buffer, buf + MAX_TEST_BUFF - 1 - EMPACK_SKIP_MAX_DEPTH, EMPACK_SKIP_MAX_DEPTH + 1);
+  TEST_TRUE(empack_next_skip(&buffer, &type) && buffer.pos == buffer.len);
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  TEST_TRUE(!empack_next_skip(&buffer, &type) && buffer_error(&buffer) == EM_ERROR_DEPTH);
+}
+
+static void test_read_sint_unsigned()
+{
+  const int64_t values[] = { 128, 300, 70000, INT64_MAX };
+  em_byte_t buf[64];
+  buffer_t buffer;
+  empack_cursor_t cursor;
+  int64_t i = 0;
+  int16_t i16 = 0;
+  int8_t i8 = 0;
+  bool all = true;
+
+  // the signed writers put non-negative values in the uint forms
+  buffer_init(&buffer, buf, sizeof(buf));
+  empack_write_i32(&buffer, 300);
+  TEST_TRUE(buffer.pos == 3 && memcmp(buf, "\xcd\x01\x2c", 3) == 0);
+  buffer_reset(&buffer);
+  TEST_TRUE(empack_read_sint(&buffer, (em_byte_t*)&i, 8) && i == 300);
+
+  buffer_init(&buffer, buf, sizeof(buf));
+  for (int k = 0; k < 4; k++)
+    empack_write_i64(&buffer, values[k]);
+  buffer_init(&buffer, buf, buffer.pos);
+  for (int k = 0; k < 4; k++)
+    all = all && empack_read_sint(&buffer, (em_byte_t*)&i, 8) && i == values[k];
+  TEST_TRUE(all && !buffer_error(&buffer));
+
+  buffer_reset(&buffer);
+  empack_cursor_init(&cursor, &buffer);
+  for (int k = 0; k < 4; k++)
+    all = all && empack_cursor_read_sint(&cursor, &i) && i == values[k];
+  TEST_TRUE(all && !empack_cursor_error(&cursor));
+
+  // a uint has to fit the destination as a signed value
+  buffer_reset(&buffer);
+  TEST_TRUE(!empack_read_sint(&buffer, (em_byte_t*)&i8, 1) && buffer_error(&buffer) == EM_ERROR_TOO_BIG);
+  buffer_init(&buffer, buf, buffer.len);
+  TEST_TRUE(empack_read_sint(&buffer, (em_byte_t*)&i16, 2) && i16 == 128);
+  TEST_TRUE(!empack_read_sint(&buffer, (em_byte_t*)&i8, 1) && buffer_error(&buffer) == EM_ERROR_TOO_BIG);
+
+  buffer_init(&buffer, buf, sizeof(buf));
+  empack_write_u64(&buffer, (uint64_t)INT64_MAX + 1);
+  buffer_init(&buffer, buf, buffer.pos);
+  TEST_TRUE(!empack_read_sint(&buffer, (em_byte_t*)&i, 8) && buffer_error(&buffer) == EM_ERROR_TOO_BIG);
+}
+
+static void test_read_cursor()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
   size_t size = MAX_TEST_BUFF;
   buffer_t buffer;
+  empack_cursor_t cursor;
+  uint32_t n;
+  uint64_t u;
+  int64_t i;
+  const char* str;
+  uint32_t str_size;
+
+  // {"id": 7, "tags": ["x", {"deep": [1, 2]}], "name": "bob"}, 42
+  buffer_init(&buffer, buf, size);
+  empack_write_map_start(&buffer, 3);
+  empack_write_string(&buffer, "id", 2);
+  empack_write_u8(&buffer, 7);
+  empack_write_string(&buffer, "tags", 4);
+  empack_write_array_start(&buffer, 2);
+  empack_write_string(&buffer, "x", 1);
+  empack_write_map_start(&buffer, 1);
+  empack_write_string(&buffer, "deep", 4);
+  empack_write_array_start(&buffer, 2);
+  empack_write_u8(&buffer, 1);
+  empack_write_u8(&buffer, 2);
+  empack_write_string(&buffer, "name", 4);
+  empack_write_string(&buffer, "bob", 3);
+  empack_write_i8(&buffer, 42);
+
+  // unread values and containers are skipped when moving on
+  buffer_init(&buffer, buf, buffer.max);
+  empack_cursor_init(&cursor, &buffer);
+  TEST_TRUE(empack_cursor_enter_map(&cursor, &n) && n == 3);
+  TEST_TRUE(empack_cursor_find_key(&cursor, "tags", 4));
+  TEST_TRUE(empack_cursor_enter_array(&cursor, &n) && n == 2);
+  TEST_TRUE(empack_cursor_depth(&cursor) == 2);
+  TEST_TRUE(empack_cursor_leave(&cursor));
+  TEST_TRUE(empack_cursor_find_key(&cursor, "name", 4));
+  TEST_TRUE(empack_cursor_read_string(&cursor, &str, &str_size));
+  TEST_TRUE(str_size == 3 && memcmp(str, "bob", 3) == 0);
+  TEST_TRUE(!empack_cursor_has_next(&cursor));
+  TEST_TRUE(empack_cursor_leave(&cursor));
+  TEST_TRUE(empack_cursor_read_sint(&cursor, &i) && i == 42);
+  TEST_TRUE(!empack_cursor_error(&cursor));
+
+  // a value found but never read is skipped by the next lookup
+  buffer_reset(&buffer);
+  empack_cursor_init(&cursor, &buffer);
+  TEST_TRUE(empack_cursor_enter_map(&cursor, &n));
+  TEST_TRUE(empack_cursor_find_key(&cursor, "tags", 4));
+  TEST_TRUE(empack_cursor_find_key(&cursor, "name", 4));
+  TEST_TRUE(empack_cursor_type(&cursor) == EMPACK_STRING);
+  TEST_TRUE(!empack_cursor_find_key(&cursor, "id", 2));
+  TEST_TRUE(empack_cursor_leave(&cursor));
+  TEST_TRUE(empack_cursor_read_uint(&cursor, &u) && u == 42);
+
+  // type mismatches latch the error
+  buffer_reset(&buffer);
+  empack_cursor_init(&cursor, &buffer);
+  TEST_TRUE(!empack_cursor_enter_array(&cursor, &n));
+  TEST_TRUE(empack_cursor_error(&cursor));
+  TEST_TRUE(!empack_cursor_skip(&cursor));
+}
+
+static void test_sticky_errors()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  buffer_t buffer;
+  uint32_t n;
+  bool b;
+
+  // writes past the end are dropped and the first failure is kept
+  buffer_init(&buffer, buf, 4);
+  empack_write_array_start(&buffer, 2);
+  empack_write_u16(&buffer, 0x1234);
+  empack_write_nil(&buffer);
+  empack_write_string(&buffer, "abc", 3);
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_OVERFLOW);
+  TEST_TRUE(buffer_error_pos(&buffer) == 4);
+  TEST_TRUE(buffer.pos == 4);
+
+  buffer_reset_all(&buffer);
+  TEST_TRUE(buffer_error(&buffer) == EM_OK);
+
+  // a type mismatch stops every later read
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_write_nil(&buffer);
+  empack_write_bool(&buffer, true);
+  buffer_init(&buffer, buf, buffer.max);
+  TEST_TRUE(!empack_read_array_size(&buffer, &n));
+  TEST_TRUE(!empack_read_bool(&buffer, &b));
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_TYPE);
+  TEST_TRUE(buffer_error_pos(&buffer) == 1);
+  TEST_TRUE(empack_next_type(&buffer) == EMPACK_EMPTY);
+
+  // reading a string into storage that is too small
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_write_string(&buffer, "abcdef", 6);
+  buffer_init(&buffer, buf, buffer.max);
+  TEST_TRUE(!empack_read_string_sz(&buffer, (char*)buf, 2, &n) && n == 6);
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_TOO_BIG);
+
+  // running off the end of the input
+  buffer_init(&buffer, buf, 0);
+  TEST_TRUE(!empack_read_nil(&buffer));
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_EOF);
+
+  // resets clear the error along with where it happened
+  buffer_init(&buffer, buf, 2);
+  empack_write_u16(&buffer, 300);
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_OVERFLOW && buffer_error_pos(&buffer) == 2);
+  buffer_reset_all(&buffer);
+  TEST_TRUE(!buffer_error(&buffer) && buffer_error_pos(&buffer) == 0);
+  empack_write_u16(&buffer, 300);
+  buffer_clear(&buffer);
+  TEST_TRUE(!buffer_error(&buffer) && buffer_error_pos(&buffer) == 0);
+}
+
+static void test_savepoint()
+{
+  em_byte_t batch[42];
+  em_byte_t out[MAX_TEST_BUFF];
+  buffer_savepoint_t sp;
+  buffer_t b, o;
+  uint32_t flushes = 0, n;
+  uint64_t u = 0;
+  bool in_order = true;
+
+  // messages of 14 bytes into a 42 byte batch: each fourth one overflows,
+  // is rolled back, and is written again after the flush
+  buffer_init(&o, out, MAX_TEST_BUFF);
+  buffer_init(&b, batch, sizeof(batch));
+  for (uint32_t i = 0; i < 10; i++) {
+    buffer_savepoint(&b, &sp);
+    empack_write_array_start(&b, 2);
+    empack_write_u8(&b, i);
+    empack_write_string(&b, (em_byte_t*)"payload-xxx", 11);
+
+    if (!buffer_commit(&b, &sp)) {
+      TEST_TRUE(b.pos == b.max && b.pos % 14 == 0 && !buffer_error(&b));
+      buffer_write(&o, batch, b.pos);
+      buffer_reset_all(&b);
+      flushes++;
+      i--;
+    }
+  }
+  buffer_write(&o, batch, b.pos);
+  TEST_TRUE(flushes == 3 && o.pos == 140);
+
+  buffer_init(&o, out, o.max);
+  for (uint32_t i = 0; i < 10; i++) {
+    const char* str;
+    in_order &= empack_read_array_size(&o, &n) && empack_read_uint(&o, (em_byte_t*)&u, 8) && u == i
+      && empack_read_string_ref(&o, &str, &n);
+  }
+  TEST_TRUE(in_order && o.pos == o.len);
+
+  // an error latched before the savepoint fails the commit and is kept
+  buffer_init(&b, batch, 1);
+  empack_write_u16(&b, 300);
+  buffer_savepoint(&b, &sp);
+  empack_write_nil(&b);
+  TEST_TRUE(!buffer_commit(&b, &sp) && buffer_error(&b) == EM_ERROR_OVERFLOW && buffer_error_pos(&b) == sp.error_pos);
+}
+
+// each thread walks the whole shared document with its own reader
+static void* test_view_worker(void* arg)
+{
+  const buffer_view_t* view = arg;
+  empack_cursor_t c;
+  buffer_t r;
+  uint32_t size = 0;
+  uint64_t u = 0, sum = 0;
+
+  for (int pass = 0; pass < 50; pass++) {
+    buffer_view_reader(view, &r, 0);
+    empack_cursor_init(&c, &r);
+    if (!empack_cursor_enter_map(&c, &size) || !empack_cursor_find_key(&c, "values", 6)
+        || !empack_cursor_enter_array(&c, &size))
+      return NULL;
+    while (empack_cursor_read_uint(&c, &u))
+      sum += u;
+  }
+
+  return (void*)(uintptr_t)sum;
+}
+
+static void test_view()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  em_byte_t frames[32];
+  buffer_view_t view, frame_view;
+  empack_path_t name[] = { EMPACK_PATH_KEY("name") };
+  uint8_t type;
+  pthread_t threads[4];
+  buffer_t b, r, s;
+  bool sums = true;
+  void* sum;
+  uint32_t n = 0;
+  uint64_t u = 0;
+
+  buffer_init(&b, buf, MAX_TEST_BUFF);
+  empack_write_map_start(&b, 2);
+  empack_write_string(&b, (em_byte_t*)"name", 4);
+  empack_write_string(&b, (em_byte_t*)"snapshot", 8);
+  empack_write_string(&b, (em_byte_t*)"values", 6);
+  empack_write_array_start(&b, 500);
+  for (uint32_t i = 0; i < 500; i++)
+    empack_write_u32(&b, i * 3);
+  TEST_TRUE(!buffer_error(&b));
+
+  buffer_view_init(&view, buf, b.pos);
+
+  // readers keep their own positions and errors
+  buffer_view_reader(&view, &r, 0);
+  buffer_view_reader(&view, &s, 1);
+  TEST_TRUE(empack_read_map_size(&r, &n) && n == 2 && r.pos == 1 && s.pos == 1);
+  TEST_TRUE(!empack_read_uint(&s, (em_byte_t*)&u, 8) && buffer_error(&s) == EM_ERROR_TYPE && !buffer_error(&r));
+
+  buffer_view_reader(&view, &r, view.len);
+  TEST_TRUE(!buffer_error(&r) && buffer_available(&r) == 0);
+  buffer_view_reader(&view, &r, view.len + 1);
+  TEST_TRUE(buffer_error(&r) == EM_ERROR_EOF && !empack_read_nil(&r));
+
+  // writes, clears and edits through a reader latch instead of landing
+  buffer_view_reader(&view, &r, 0);
+  empack_write_u8(&r, 7);
+  TEST_TRUE(buffer_error(&r) == EM_ERROR_READ_ONLY && r.pos == 0 && (uint8_t)buf[0] == 0x82);
+  buffer_view_reader(&view, &r, 0);
+  buffer_clear(&r);
+  TEST_TRUE(buffer_error(&r) == EM_ERROR_READ_ONLY && (uint8_t)buf[0] == 0x82);
+  buffer_view_reader(&view, &r, 0);
+  TEST_TRUE(!empack_edit_set_uint(&r, name, 1, 1) && buffer_error(&r) == EM_ERROR_READ_ONLY);
+  TEST_TRUE((uint8_t)buf[1] == 0xa4 && memcmp(buf + 6, "\xa8snapshot", 9) == 0);
+
+  // so do writes through a frame payload carved out of a reader
+  buffer_init(&b, frames, sizeof(frames));
+  empack_frame_write(&b, 1, (const em_byte_t*)"\x01\x02", 2);
+  buffer_view_init(&frame_view, frames, b.pos);
+  buffer_view_reader(&frame_view, &r, 0);
+  TEST_TRUE(empack_frame_next(&r, &type, &s) && type == 1);
+  empack_write_u8(&s, 7);
+  TEST_TRUE(buffer_error(&s) == EM_ERROR_READ_ONLY && frames[EMPACK_FRAME_HEADER] == 1);
+
+  for (int i = 0; i < 4; i++)
+    pthread_create(&threads[i], NULL, test_view_worker, &view);
+  for (int i = 0; i < 4; i++) {
+    pthread_join(threads[i], &sum);
+    sums = sums && (uintptr_t)sum == 50 * 3 * (499 * 500 / 2);
+  }
+  TEST_TRUE(sums);
+}
+
+static void test_wide_lengths()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  em_byte_t out[MAX_TEST_BUFF];
+  buffer_t buffer;
+  empack_type_t type;
+  uint32_t n = 0;
+
+  // a bin32 claiming 0x10003 bytes must not be narrowed to 3 bytes,
+  // which is what a 16-bit em_size_t would see
+  memcpy(buf, "\xc6\x00\x01\x00\x03" "abc", 8);
+  buffer_init(&buffer, buf, 8);
+  TEST_TRUE(!empack_next_skip(&buffer, &type) && type == EMPACK_BIN);
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_EOF);
+
+  buffer_init(&buffer, buf, 8);
+  TEST_TRUE(!empack_read_bin_sz(&buffer, out, 0x20000, &n) && n == 0x10003);
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_EOF);
+
+  buffer_init(&buffer, out, 8);
+  empack_write_bin(&buffer, buf, 0x10003);
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_OVERFLOW);
+  TEST_TRUE(buffer.pos == 5);
+}
+
+static bool test_ext_decode(void* ctx, int8_t ext_type, const em_byte_t* data, uint32_t size)
+{
+  uint32_t* seen = ctx;
+  *seen = (uint32_t)ext_type << 16 | size;
+  return size > 0 && data[0] == 'x';
+}
+
+static void test_numbers()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  buffer_t buffer;
+  const double values[] = { 3.0, -2.0, 1e10, 0.5, -0.0, 0.1, -1e300 };
+  const em_size_t sizes[] = { 1, 1, 9, 5, 5, 9, 9 };
+  bool same = true;
+  double d;
+
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  for (int i = 0; i < 7; i++) {
+    em_size_t start = buffer.pos;
+    empack_write_number(&buffer, values[i]);
+    same &= buffer.pos - start == sizes[i];
+  }
+  empack_write_double(&buffer, 0.5);
+  TEST_TRUE(same && (uint8_t)buf[11] == 0xCA && (uint8_t)buf[buffer.pos - 9] == 0xCB);
+
+  buffer_init(&buffer, buf, buffer.max);
+  for (int i = 0; i < 7; i++)
+    same &= empack_read_double(&buffer, &d) && memcmp(&d, &values[i], sizeof(d)) == 0;
+  TEST_TRUE(same && empack_read_double(&buffer, &d) && d == 0.5 && buffer.pos == buffer.len);
+
+  memcpy(buf, "\xc3", 1);
+  buffer_init(&buffer, buf, 1);
+  TEST_TRUE(!empack_read_double(&buffer, &d) && buffer_error(&buffer) == EM_ERROR_TYPE);
+}
+
+static void test_sizes()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  const int64_t ints[] = { 0, 127, 128, 255, 256, 65536, 1ll << 32, -1, -32, -33, -129, -32769, INT64_MIN };
+  const uint32_t lens[] = { 0, 15, 16, 31, 32, 255, 256, 1000 };
+  empack_path_t key[] = { EMPACK_PATH_KEY("k") };
+  buffer_t b, m;
+  bool same = true;
+
+  for (int i = 0; i < 13; i++) {
+    buffer_init_measure(&m);
+    empack_write_i64(&m, ints[i]);
+    same &= m.pos == empack_sizeof_sint(ints[i]);
+  }
+  for (int i = 0; i < 8; i++) {
+    buffer_init_measure(&m);
+    empack_write_array_start(&m, lens[i]);
+    same &= m.pos == empack_sizeof_array(lens[i]);
+    buffer_init_measure(&m);
+    empack_write_string(&m, buf, lens[i]);
+    same &= m.pos == empack_sizeof_string(lens[i]);
+    buffer_init_measure(&m);
+    empack_write_ext(&m, 7, buf, lens[i]);
+    same &= m.pos == empack_sizeof_ext(lens[i]);
+  }
+  TEST_TRUE(same && !buffer_error(&m));
+  TEST_TRUE(empack_sizeof_number(2.0) == 1 && empack_sizeof_number(0.25) == 5 && empack_sizeof_timestamp(-1, 0) == 15);
+
+  // a measuring pass gives the exact room for the real one
+  buffer_init_measure(&m);
+  empack_write_map_start(&m, 2);
+  empack_write_string(&m, (em_byte_t*)"name", 4);
+  empack_write_bin(&m, buf, 300);
+  empack_write_string(&m, (em_byte_t*)"at", 2);
+  empack_write_timestamp(&m, 1700000000, 5);
+
+  buffer_init(&b, buf + 400, m.pos);
+  empack_write_map_start(&b, 2);
+  empack_write_string(&b, (em_byte_t*)"name", 4);
+  empack_write_bin(&b, buf, 300);
+  empack_write_string(&b, (em_byte_t*)"at", 2);
+  empack_write_timestamp(&b, 1700000000, 5);
+  TEST_TRUE(!buffer_error(&b) && b.pos == b.len && m.pos == 1 + 5 + 303 + 3 + 10);
+
+  // the source may overlap the destination, from either side
+  memcpy(buf, "abcdefgh", 8);
+  buffer_init(&b, buf, 8);
+  b.pos = 2;
+  TEST_TRUE(buffer_write(&b, buf, 6) == 6 && memcmp(buf, "ababcdef", 8) == 0);
+  memcpy(buf, "abcdefgh", 8);
+  buffer_init(&b, buf, 8);
+  TEST_TRUE(buffer_write(&b, buf + 2, 6) == 6 && memcmp(buf, "cdefghgh", 8) == 0);
+
+  // a measuring buffer clears without touching memory and refuses reads
+  buffer_init_measure(&m);
+  empack_write_u32(&m, 70000);
+  buffer_clear(&m);
+  TEST_TRUE(!buffer_error(&m) && m.pos == 0 && m.max == 0);
+  empack_write_u32(&m, 70000);
+  buffer_reset(&m);
+  TEST_TRUE(buffer_peek(&m) == -1 && buffer_error(&m) == EM_ERROR_EOF && buffer_error_pos(&m) == 0);
+  buffer_init_measure(&m);
+  TEST_TRUE(buffer_read_byte(&m) == -1 && buffer_error(&m) == EM_ERROR_EOF);
+  buffer_init_measure(&m);
+  TEST_TRUE(buffer_read(&m, buf, 4) == 0 && buffer_error(&m) == EM_ERROR_EOF);
+  buffer_init_measure(&m);
+  TEST_TRUE(empack_next_type(&m) == EMPACK_EMPTY && !empack_read_uint(&m, buf, 4));
+  TEST_TRUE(buffer_error(&m) == EM_ERROR_EOF);
+  buffer_init_measure(&m);
+  TEST_TRUE(!empack_edit_set_uint(&m, key, 1, 1) && buffer_error(&m) == EM_ERROR_EOF);
+}
+
+static void test_ext()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  em_byte_t data[32];
+  buffer_t buffer;
+  int8_t ext_type;
+  uint32_t n;
+  int64_t sec = 0;
+  uint32_t nsec = 0;
+  empack_type_t type;
+
+  TEST_SIMPLE_WRITE("\xd4\x05x", empack_write_ext(&buffer, 5, "x", 1));
+  TEST_SIMPLE_WRITE("\xd6\x05xxxx", empack_write_ext(&buffer, 5, "xxxx", 4));
+  TEST_SIMPLE_WRITE("\xc7\x03\x05xxx", empack_write_ext(&buffer, 5, "xxx", 3));
+  TEST_SIMPLE_WRITE("\xc7\x00\x7f", empack_write_ext(&buffer, 127, "", 0));
+
+  // timestamp 32, 64 and 96
+  TEST_SIMPLE_WRITE("\xd6\xff\x5b\x9e\x7a\x00", empack_write_timestamp(&buffer, 1537112576, 0));
+  TEST_SIMPLE_WRITE("\xd7\xff\x00\x00\x00\x04\x5b\x9e\x7a\x00", empack_write_timestamp(&buffer, 1537112576, 1));
+  TEST_SIMPLE_WRITE("\xc7\x0c\xff\x00\x00\x00\x00\xff\xff\xff\xff\xff\xff\xff\xff",
+      empack_write_timestamp(&buffer, -1, 0));
+
+  int64_t secs[] = { 0, 1537112576, 0x3FFFFFFFFll, -62135596800ll };
+  uint32_t nsecs[] = { 0, 999999999, 1, 5 };
+  for (int i = 0; i < 4; i++) {
+    buffer_init(&buffer, buf, MAX_TEST_BUFF);
+    empack_write_timestamp(&buffer, secs[i], nsecs[i]);
+    buffer_init(&buffer, buf, buffer.max);
+    TEST_TRUE(empack_next_type(&buffer) == EMPACK_EXT);
+    TEST_TRUE(empack_read_timestamp(&buffer, &sec, &nsec));
+    TEST_TRUE(sec == secs[i] && nsec == nsecs[i], "timestamp %d", i);
+  }
+
+  // [ext 7 "xyz", ext 8 "q", 1] skipped, read back and dispatched
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_write_array_start(&buffer, 3);
+  empack_write_ext(&buffer, 7, "xyz", 3);
+  empack_write_ext(&buffer, 8, "q", 1);
+  empack_write_u8(&buffer, 1);
+  em_size_t size = buffer.max;
+
+  buffer_init(&buffer, buf, size);
+  TEST_TRUE(empack_next_skip(&buffer, &type) && type == EMPACK_ARRAY);
+  TEST_TRUE(buffer.pos == size);
+
+  buffer_init(&buffer, buf, size);
+  TEST_TRUE(empack_read_array_size(&buffer, &n) && n == 3);
+  TEST_TRUE(empack_read_ext_sz(&buffer, &ext_type, data, sizeof(data), &n));
+  TEST_TRUE(ext_type == 7 && n == 3 && memcmp(data, "xyz", 3) == 0);
+
+  empack_ext_table_t table;
+  uint32_t seen = 0;
+  empack_ext_table_init(&table);
+  empack_ext_register(&table, 7, test_ext_decode, &seen);
+  empack_ext_register(&table, 8, test_ext_decode, &seen);
+
+  buffer_init(&buffer, buf, size);
+  TEST_TRUE(empack_read_array_size(&buffer, &n));
+  TEST_TRUE(empack_ext_dispatch(&table, &buffer, &ext_type));
+  TEST_TRUE(ext_type == 7 && seen == (7 << 16 | 3));
+  TEST_TRUE(!empack_ext_dispatch(&table, &buffer, &ext_type) && ext_type == 8);
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_TYPE);
+
+  // unregistered types are skipped without an error
+  empack_ext_table_init(&table);
+  buffer_init(&buffer, buf, size);
+  TEST_TRUE(empack_read_array_size(&buffer, &n));
+  TEST_TRUE(!empack_ext_dispatch(&table, &buffer, &ext_type));
+  TEST_TRUE(!empack_ext_dispatch(&table, &buffer, &ext_type));
+  TEST_TRUE(buffer_error(&buffer) == EM_OK);
+  TEST_TRUE(empack_next_type(&buffer) == EMPACK_UINT);
+}
+
+static void test_frame()
+{
+  static em_byte_t big[30000];
+  const size_t splits[] = { 1, 255, 777, 3 * 8192 + 5, 29999 };
+  em_byte_t buf[MAX_TEST_BUFF];
+  empack_frame_t frame;
+  buffer_t b, payload;
+  uint64_t count = 0;
+  uint32_t n = 0;
+  uint8_t type;
+  bool split_ok = true;
+
+  TEST_TRUE(empack_crc32c(0, (em_byte_t*)"123456789", 9) == 0xE3069283);
+  TEST_TRUE(empack_crc32c(empack_crc32c(0, (em_byte_t*)"1234", 4), (em_byte_t*)"56789", 5) == 0xE3069283);
+
+  // long enough for the three-stream hardware path on both block sizes;
+  // any split gives the same crc
+  memset(big, 0, 32);
+  TEST_TRUE(empack_crc32c(0, big, 32) == 0x8A9136AA);
+  for (size_t i = 0; i < sizeof(big); i++)
+    big[i] = (em_byte_t)((i * 31) ^ (i >> 8));
+  TEST_TRUE(empack_crc32c(0, big, sizeof(big)) == 0x198BDC8F);
+  TEST_TRUE(empack_crc32c(0, big, 1000) == 0xFB74C2A6);
+  for (size_t i = 0; i < sizeof(splits) / sizeof(splits[0]); i++)
+    split_ok &= empack_crc32c(empack_crc32c(0, big, splits[i]), big + splits[i], sizeof(big) - splits[i]) == 0x198BDC8F;
+  TEST_TRUE(split_ok);
+
+  buffer_init(&b, buf, MAX_TEST_BUFF);
+  empack_frame_begin(&b, &frame, 1);
+  empack_write_array_start(&b, 2);
+  empack_write_u32(&b, 70000);
+  empack_write_string(&b, (em_byte_t*)"event", 5);
+  empack_frame_end(&b, &frame);
+  empack_frame_write(&b, 7, (em_byte_t*)"", 0);
+  // the payload overlaps the frames written before it
+  empack_frame_write(&b, 0, buf + 100, 300);
+  TEST_TRUE(!buffer_error(&b) && b.pos == 3 * EMPACK_FRAME_HEADER + 12 + 300);
+
+  buffer_init(&b, buf, b.max);
+  TEST_TRUE(empack_frame_verify(&b, &count) && count == 3 && b.pos == b.len);
+
+  buffer_init(&b, buf, b.len);
+  TEST_TRUE(empack_frame_next(&b, &type, &payload) && type == 1 && payload.len == 12);
+  TEST_TRUE(empack_read_array_size(&payload, &n) && n == 2);
+  TEST_TRUE(empack_frame_next(&b, &type, &payload) && type == 7 && payload.len == 0);
+
+  // a flipped payload bit stops the scan at the start of its frame
+  buf[2 * EMPACK_FRAME_HEADER + 12 + 150] ^= 0x10;
+  buffer_init(&b, buf, b.len);
+  TEST_TRUE(!empack_frame_verify(&b, &count) && count == 2 && buffer_error(&b) == EM_ERROR_CORRUPT);
+  TEST_TRUE(buffer_error_pos(&b) == 2 * EMPACK_FRAME_HEADER + 12);
+
+  buffer_init(&b, buf, 2 * EMPACK_FRAME_HEADER + 11);
+  TEST_TRUE(!empack_frame_verify(&b, &count) && count == 1 && buffer_error(&b) == EM_ERROR_EOF);
+}
+
+static void test_keydict()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  buffer_t buffer;
+  empack_keydict_t dict, peer;
+  const char* key;
+  uint32_t key_size, n;
+  int32_t id;
+
+  empack_keydict_init(&dict, false);
+  TEST_TRUE(empack_keydict_add(&dict, "temperature", 11) == 0);
+  TEST_TRUE(empack_keydict_add(&dict, "ts", 2) == 1);
+  TEST_TRUE(empack_keydict_add(&dict, "temperature", 11) == 0);
+  TEST_TRUE(empack_keydict_find(&dict, "ts", 2) == 1);
+  TEST_TRUE(empack_keydict_find(&dict, "t", 1) == -1);
+
+  TEST_SIMPLE_WRITE("\xd4\x64\x00", empack_write_key(&buffer, &dict, "temperature", 11));
+  TEST_SIMPLE_WRITE("\xa2id", empack_write_key(&buffer, &dict, "id", 2));
+
+  // the dictionary travels once at the head of the stream
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_keydict_write(&buffer, &dict);
+  empack_write_map_start(&buffer, 2);
+  empack_write_key(&buffer, &dict, "ts", 2);
+  empack_write_u8(&buffer, 1);
+  empack_write_key(&buffer, &dict, "id", 2);
+  empack_write_u8(&buffer, 2);
+  TEST_TRUE(buffer_error(&buffer) == EM_OK);
+
+  buffer_init(&buffer, buf, buffer.max);
+  empack_keydict_init(&peer, false);
+  TEST_TRUE(empack_keydict_read(&buffer, &peer));
+  TEST_TRUE(peer.count == 2 && empack_keydict_find(&peer, "ts", 2) == 1);
+  TEST_TRUE(empack_read_map_size(&buffer, &n) && n == 2);
+  TEST_TRUE(empack_read_key(&buffer, &peer, &key, &key_size, &id));
+  TEST_TRUE(id == 1 && key_size == 2 && memcmp(key, "ts", 2) == 0);
+  TEST_TRUE(empack_next_skip(&buffer, (empack_type_t*)&n));
+  TEST_TRUE(empack_read_key(&buffer, &peer, &key, &key_size, &id));
+  TEST_TRUE(id == -1 && key_size == 2 && memcmp(key, "id", 2) == 0);
+
+  // integer ids agreed out of band
+  dict.int_ids = true;
+  TEST_SIMPLE_WRITE("\x01", empack_write_key(&buffer, &dict, "ts", 2));
+  buffer_init(&buffer, buf, 1);
+  TEST_TRUE(empack_read_key(&buffer, &dict, &key, &key_size, &id) && id == 1);
+
+  // references past the end of the dictionary are rejected
+  buf[0] = 0x05;
+  buffer_init(&buffer, buf, 1);
+  TEST_TRUE(!empack_read_key(&buffer, &dict, &key, &key_size, &id));
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_TYPE);
+}
+
+static void test_columnar()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  em_byte_t block[MAX_TEST_BUFF];
+  buffer_t buffer, out;
+  int64_t ts[4], ts2[4];
+  float temp[4], temp2[4];
+  bool ok[4], ok2[4];
+  uint8_t nulls[3], nulls2[3];
+  struct empack_column cols[3] = {
+    { "ts", 2, EMPACK_COLUMN_INT, ts, &nulls[0] },
+    { "temp", 4, EMPACK_COLUMN_FLOAT, temp, &nulls[1] },
+    { "ok", 2, EMPACK_COLUMN_BOOL, ok, &nulls[2] },
+  };
+  struct empack_column cols2[3] = {
+    { "ts", 2, EMPACK_COLUMN_INT, ts2, &nulls2[0] },
+    { "temp", 4, EMPACK_COLUMN_FLOAT, temp2, &nulls2[1] },
+    { "ok", 2, EMPACK_COLUMN_BOOL, ok2, &nulls2[2] },
+  };
+  empack_columns_t c, c2;
+
+  // three records: a nil temp, an unknown key and a missing ok
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  for (int i = 0; i < 3; i++) {
+    empack_write_map_start(&buffer, 3);
+    empack_write_string(&buffer, (em_byte_t*)"ts", 2);
+    empack_write_i64(&buffer, 1000000 + i * 10 - (i == 2) * 2000000);
+    if (i == 1) {
+      empack_write_string(&buffer, (em_byte_t*)"temp", 4);
+      empack_write_nil(&buffer);
+    } else {
+      empack_write_string(&buffer, (em_byte_t*)"temp", 4);
+      empack_write_float(&buffer, 20.5f + i);
+    }
+    if (i == 2) {
+      empack_write_string(&buffer, (em_byte_t*)"extra", 5);
+      empack_write_string(&buffer, (em_byte_t*)"skip", 4);
+    } else {
+      empack_write_string(&buffer, (em_byte_t*)"ok", 2);
+      empack_write_bool(&buffer, i == 0);
+    }
+  }
+  TEST_TRUE(buffer_error(&buffer) == EM_OK);
+
+  buffer_init(&buffer, buf, buffer.max);
+  empack_columns_init(&c, cols, 3, 4);
+  TEST_TRUE(empack_columns_transcode(&buffer, &c) == 3 && buffer_error(&buffer) == EM_OK);
+  TEST_TRUE(ts[0] == 1000000 && ts[1] == 1000010 && ts[2] == -999980);
+  TEST_TRUE(temp[0] == 20.5f && EMPACK_COLUMN_IS_NULL(&cols[1], 1) && temp[2] == 22.5f);
+  TEST_TRUE(ok[0] && !ok[1] && EMPACK_COLUMN_IS_NULL(&cols[2], 2));
+  TEST_TRUE(!EMPACK_COLUMN_IS_NULL(&cols[0], 2));
+
+  // blocks round trip, with small deltas packed into single bytes
+  buffer_init(&out, block, MAX_TEST_BUFF);
+  empack_columns_write_block(&out, &c);
+  TEST_TRUE(buffer_error(&out) == EM_OK && out.max < 48);
+
+  buffer_init(&out, block, out.max);
+  empack_columns_init(&c2, cols2, 3, 4);
+  TEST_TRUE(empack_columns_read_block(&out, &c2) && c2.rows == 3);
+  TEST_TRUE(memcmp(ts, ts2, sizeof(int64_t) * 3) == 0);
+  TEST_TRUE(temp2[0] == 20.5f && EMPACK_COLUMN_IS_NULL(&cols2[1], 1) && ok2[0]);
+
+  // and back into records, dropping nulls
+  buffer_init(&out, block, MAX_TEST_BUFF);
+  empack_columns_write_record(&out, &c2, 1);
+  TEST_TRUE(out.max == 13 && (uint8_t)block[0] == 0x82);
+
+  // a record past capacity is rejected
+  c2.capacity = 3;
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  TEST_TRUE(!empack_columns_read_record(&buffer, &c2));
+  TEST_TRUE(buffer_error(&buffer) == EM_ERROR_TOO_BIG);
+
+  // blocks for a different schema are rejected
+  cols2[0].key = "tx";
+  buffer_init(&out, block, MAX_TEST_BUFF);
+  empack_columns_write_block(&out, &c);
+  buffer_init(&out, block, out.max);
+  TEST_TRUE(!empack_columns_read_block(&out, &c2));
+  TEST_TRUE(buffer_error(&out) == EM_ERROR_TYPE);
+}
+
+static void test_hash()
+{
+  buffer_t a, b;
+  uint64_t ha, hb;
+
+  // the same logical value at different widths
+  em_byte_t small[] = { 0x92, 0x05, 0xa2, 'h', 'i' };
+  em_byte_t wide[] = { 0xdc, 0x00, 0x02, 0xce, 0x00, 0x00, 0x00, 0x05, 0xd9, 0x02, 'h', 'i' };
+  em_byte_t other[] = { 0x92, 0x06, 0xa2, 'h', 'i' };
+
+  buffer_init(&a, small, sizeof(small));
+  buffer_init(&b, wide, sizeof(wide));
+  TEST_TRUE(empack_hash(&a, 0, &ha) && empack_hash(&b, 0, &hb) && ha == hb);
+  TEST_TRUE(a.pos == sizeof(small) && b.pos == sizeof(wide));
+
+  buffer_init(&a, small, sizeof(small));
+  buffer_init(&b, wide, sizeof(wide));
+  TEST_TRUE(empack_equal(&a, &b) && b.pos == sizeof(wide));
+
+  buffer_init(&a, small, sizeof(small));
+  buffer_init(&b, other, sizeof(other));
+  TEST_TRUE(empack_hash(&a, 0, &ha) && empack_hash(&b, 0, &hb) && ha != hb);
+  buffer_init(&a, small, sizeof(small));
+  buffer_init(&b, other, sizeof(other));
+  TEST_TRUE(empack_compare(&a, &b) < 0 && a.pos == sizeof(small) && b.pos == sizeof(other));
+
+  // signed and unsigned forms, and float widths
+  em_byte_t sint[] = { 0xd0, 0x05 };
+  em_byte_t neg[] = { 0xd1, 0xff, 0xfe };
+  em_byte_t f32[] = { 0xca, 0x3f, 0x00, 0x00, 0x00 };
+  em_byte_t f64[] = { 0xcb, 0x3f, 0xe0, 0x00, 0x00, 0x00, 0x00, 0x00, 0x00 };
+
+  buffer_init(&a, sint, sizeof(sint));
+  buffer_init(&b, small + 1, 1);
+  TEST_TRUE(empack_equal(&a, &b));
+  buffer_init(&a, neg, sizeof(neg));
+  buffer_init(&b, sint, sizeof(sint));
+  TEST_TRUE(empack_compare(&a, &b) < 0);
+  buffer_init(&a, f32, sizeof(f32));
+  buffer_init(&b, f64, sizeof(f64));
+  TEST_TRUE(empack_equal(&a, &b));
+  buffer_init(&a, f64, sizeof(f64));
+  TEST_TRUE(empack_hash(&a, 0, &ha));
+  buffer_init(&a, f32, sizeof(f32));
+  TEST_TRUE(empack_hash(&a, 0, &hb) && ha == hb);
+  TEST_TRUE(empack_hash(&a, 1, &hb) == false && buffer_error(&a) == EM_ERROR_EOF);
+
+  // ints and floats stay distinct, ints sort first
+  buffer_init(&a, small + 1, 1);
+  buffer_init(&b, f32, sizeof(f32));
+  TEST_TRUE(empack_compare(&a, &b) < 0 && !empack_equal(&a, &b));
+
+  // malformed input latches an error
+  em_byte_t bad[] = { 0xd9, 0x09, 'h' };
+  buffer_init(&a, bad, sizeof(bad));
+  buffer_init(&b, bad, sizeof(bad));
+  TEST_TRUE(!empack_equal(&a, &b) && buffer_error(&a) == EM_ERROR_EOF);
+}
+
+static void test_index()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  empack_index_t idx, loaded;
+  empack_index_scan_t scan;
+  empack_cursor_t c;
+  uint32_t map_size, matches = 0;
+  uint64_t v = 0;
+  buffer_t b, rec;
+  char path[256];
+  bool in_range = true;
+
+  // 100 records ordered by "t", with a "v" field holding the record number
+  buffer_init(&b, buf, MAX_TEST_BUFF);
+  for (uint32_t i = 0; i < 100; i++) {
+    empack_write_map_start(&b, 2);
+    empack_write_string(&b, (em_byte_t*)"v", 1);
+    empack_write_u32(&b, i);
+    empack_write_string(&b, (em_byte_t*)"t", 1);
+    empack_write_u32(&b, i * 10);
+  }
+  buffer_init(&b, buf, b.max);
+
+  TEST_TRUE(empack_index_build(&idx, &b, 8, "t", 1) && idx.records == 100 && idx.count == 13 && idx.sorted);
+  test_tmp_path(path, sizeof(path), "empack_test_index.emix");
+  TEST_TRUE(empack_index_save(&idx, path) && empack_index_load(&loaded, path));
+  TEST_TRUE(loaded.count == 13 && loaded.sorted && memcmp(loaded.entries, idx.entries, 13 * sizeof(*idx.entries)) == 0);
+  remove(path);
+
+  TEST_TRUE(empack_index_seek(&loaded, &b, 37));
+  empack_cursor_init(&c, &b);
+  TEST_TRUE(empack_cursor_enter_map(&c, &map_size) && empack_cursor_find_key(&c, "v", 1) && empack_cursor_read_uint(&c, &v) && v == 37);
+
+  TEST_TRUE(empack_index_seek_key(&loaded, &b, 355));
+  empack_cursor_init(&c, &b);
+  TEST_TRUE(empack_cursor_enter_map(&c, &map_size) && empack_cursor_find_key(&c, "v", 1) && empack_cursor_read_uint(&c, &v) && v == 36);
+  TEST_TRUE(!empack_index_seek_key(&loaded, &b, 991) && !empack_index_seek(&loaded, &b, 100) && !buffer_error(&b));
+
+  empack_index_scan_init(&scan, &loaded, &b, 200, 250);
+  while (empack_index_scan_next(&scan, &rec)) {
+    empack_cursor_init(&c, &rec);
+    in_range &= empack_cursor_enter_map(&c, &map_size) && empack_cursor_find_key(&c, "t", 1)
+      && empack_cursor_read_uint(&c, &v) && v >= 200 && v <= 250;
+    matches++;
+  }
+  TEST_TRUE(in_range && matches == 6 && !buffer_error(&b));
+
+  empack_index_free(&idx);
+  empack_index_free(&loaded);
+}
+
+#define TEST_INTERN_STRINGS 300
+
+struct test_intern_worker {
+  empack_intern_t* table;
+  uint32_t offset;
+  const empack_intern_entry_t* entries[TEST_INTERN_STRINGS];
+};
+
+// interns "key-0".."key-299", each thread starting somewhere else
+static void* test_intern_worker(void* arg)
+{
+  struct test_intern_worker* w = arg;
+  char str[16];
+
+  for (uint32_t n = 0; n < TEST_INTERN_STRINGS; n++) {
+    uint32_t k = (n + w->offset) % TEST_INTERN_STRINGS;
+    int size = snprintf(str, sizeof(str), "key-%u", (unsigned)k);
+    w->entries[k] = empack_intern(w->table, str, (uint32_t)size);
+  }
+
+  return NULL;
+}
+
+static void test_intern()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  const char* words[] = { "status", "ok", "status", "err", "ok" };
+  const empack_intern_entry_t* e[5];
+  empack_intern_t table;
+  struct test_intern_worker workers[4];
+  pthread_t threads[4];
+  buffer_t b;
+  bool read = true, same = true;
+
+  buffer_init(&b, buf, MAX_TEST_BUFF);
+  for (int i = 0; i < 5; i++)
+    empack_write_string(&b, (em_byte_t*)words[i], strlen(words[i]));
+  empack_write_string(&b, (em_byte_t*)"more", 4);
+  buffer_init(&b, buf, b.max);
+
+  TEST_TRUE(empack_intern_init(&table, 4));
+  for (int i = 0; i < 5; i++)
+    read &= empack_read_string_intern(&b, &table, &e[i]) && strcmp(e[i]->str, words[i]) == 0;
+  TEST_TRUE(read && e[0] == e[2] && e[1] == e[4] && e[0] != e[1] && e[3] != e[0] && e[3] != e[1]);
+  TEST_TRUE(empack_intern_find(&table, "err", 3) == e[3] && empack_intern_get(&table, e[1]->id) == e[1]);
+  TEST_TRUE(empack_intern_find(&table, "none", 4) == NULL && empack_intern_get(&table, 4) == NULL);
+
+  // a capacity of 4 holds 3 strings
+  TEST_TRUE(!empack_read_string_intern(&b, &table, &e[0]) && buffer_error(&b) == EM_ERROR_TOO_BIG);
+  empack_intern_destroy(&table);
+
+  // threads racing to insert the same strings all get the one entry each
+  TEST_TRUE(empack_intern_init(&table, 512));
+  for (uint32_t w = 0; w < 4; w++) {
+    workers[w].table = &table;
+    workers[w].offset = w * 53;
+    pthread_create(&threads[w], NULL, test_intern_worker, &workers[w]);
+  }
+  for (uint32_t w = 0; w < 4; w++)
+    pthread_join(threads[w], NULL);
+
+  for (uint32_t k = 0; k < TEST_INTERN_STRINGS; k++) {
+    const empack_intern_entry_t* first = workers[0].entries[k];
+    same = same && first != NULL && empack_intern_get(&table, first->id) == first;
+    for (uint32_t w = 1; w < 4; w++)
+      same = same && workers[w].entries[k] == first;
+  }
+  TEST_TRUE(same && table.count == TEST_INTERN_STRINGS);
+  empack_intern_destroy(&table);
+}
+
+static void test_edit()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  buffer_t doc, r;
+  em_size_t start, end, size;
+  uint64_t u = 0;
+  int64_t i = 0;
+  uint32_t n;
+  const char* str;
+  uint32_t str_size;
+  empack_path_t count[] = { EMPACK_PATH_KEY("stats"), EMPACK_PATH_KEY("count") };
+  empack_path_t status[] = { EMPACK_PATH_KEY("status") };
+  empack_path_t tag[] = { EMPACK_PATH_KEY("tags"), EMPACK_PATH_INDEX(1) };
+  empack_path_t missing[] = { EMPACK_PATH_KEY("nope"), EMPACK_PATH_KEY("count") };
+
+  // {"status": "ok", "stats": {"count": 300}, "tags": [1, 2]}
+  buffer_init(&doc, buf, MAX_TEST_BUFF);
+  empack_write_map_start(&doc, 3);
+  empack_write_string(&doc, (em_byte_t*)"status", 6);
+  empack_write_string(&doc, (em_byte_t*)"ok", 2);
+  empack_write_string(&doc, (em_byte_t*)"stats", 5);
+  empack_write_map_start(&doc, 1);
+  empack_write_string(&doc, (em_byte_t*)"count", 5);
+  empack_write_u16(&doc, 300);
+  empack_write_string(&doc, (em_byte_t*)"tags", 4);
+  empack_write_array_start(&doc, 2);
+  empack_write_u8(&doc, 1);
+  empack_write_u8(&doc, 2);
+  size = doc.pos;
+
+  TEST_TRUE(empack_edit_find(&doc, count, 2, &start, &end) && end - start == 3);
+  TEST_TRUE(!empack_edit_find(&doc, missing, 2, &start, &end) && buffer_error(&doc) == EM_OK);
+
+  // counters that still fit are patched in place, even below their width
+  TEST_TRUE(empack_edit_set_uint(&doc, count, 2, 7) && doc.pos == size);
+  TEST_TRUE(empack_edit_find(&doc, count, 2, &start, &end) && end - start == 3);
+  buffer_init(&r, buf + start, end - start);
+  TEST_TRUE(empack_read_uint(&r, (em_byte_t*)&u, 8) && u == 7);
+
+  // and spliced when they outgrow it
+  TEST_TRUE(empack_edit_set_uint(&doc, count, 2, 70000) && doc.pos == size + 2);
+  TEST_TRUE(empack_edit_find(&doc, count, 2, &start, &end));
+  buffer_init(&r, buf + start, end - start);
+  TEST_TRUE(empack_read_uint(&r, (em_byte_t*)&u, 8) && u == 70000);
+  TEST_TRUE(empack_edit_set_sint(&doc, tag, 2, -3) && doc.pos == size + 2);
+
+  // a longer string moves the tail once
+  TEST_TRUE(empack_edit_set(&doc, status, 1, (em_byte_t*)"\xa6" "failed", 7));
+  TEST_TRUE(empack_edit_find(&doc, tag, 2, &start, &end));
+  buffer_init(&r, buf + start, end - start);
+  TEST_TRUE(empack_read_sint(&r, (em_byte_t*)&i, 8) && i == -3);
+
+  // missing keys are appended and the count bumped
+  empack_path_t added[] = { EMPACK_PATH_KEY("stats"), EMPACK_PATH_KEY("max") };
+  TEST_TRUE(empack_edit_set_uint(&doc, added, 2, 9));
+  TEST_TRUE(empack_edit_find(&doc, added, 2, &start, &end) && end - start == 1 && buf[start] == 9);
+
+  // deleting removes the entry along with its key
+  TEST_TRUE(empack_edit_delete(&doc, status, 1));
+  TEST_TRUE(!empack_edit_find(&doc, status, 1, &start, &end));
+
+  buffer_init(&r, buf, doc.pos);
+  TEST_TRUE(empack_read_map_size(&r, &n) && n == 2);
+  TEST_TRUE(empack_read_string_ref(&r, &str, &str_size) && str_size == 5);
+  TEST_TRUE(empack_read_map_size(&r, &n) && n == 2);
+
+  // paths through scalars are errors, and growth is bounded by len
+  TEST_TRUE(!empack_edit_set_uint(&doc, (empack_path_t[]) { EMPACK_PATH_KEY("tags"), EMPACK_PATH_KEY("x") }, 2, 1));
+  TEST_TRUE(buffer_error(&doc) == EM_ERROR_TYPE);
+  doc.error = EM_OK;
+  doc.len = doc.pos;
+  TEST_TRUE(!empack_edit_set_uint(&doc, count, 2, UINT64_MAX));
+  TEST_TRUE(buffer_error(&doc) == EM_ERROR_OVERFLOW);
+}
+
+static void test_pool()
+{
+  empack_pool_t pool;
+  empack_pool_cache_t cache;
+  struct empack_pool_stats stats[EMPACK_POOL_CLASSES];
+  buffer_t a, b, c;
+  em_byte_t* first;
+
+  TEST_TRUE(empack_pool_init(&pool, 2, false));
+
+  // sizes round up to their class
+  TEST_TRUE(empack_pool_acquire(&pool, NULL, &a, 100) && a.len == 4096);
+  TEST_TRUE(empack_pool_acquire(&pool, NULL, &b, 5000) && b.len == 8192);
+  TEST_TRUE(!empack_pool_acquire(&pool, NULL, &c, 1 << 20) && buffer_error(&c) == EM_ERROR_TOO_BIG);
+
+  // an exhausted class hands back a buffer that refuses writes
+  first = a.buf;
+  TEST_TRUE(empack_pool_acquire(&pool, NULL, &c, 4096));
+  empack_pool_release(&pool, NULL, &c);
+  TEST_TRUE(empack_pool_acquire(&pool, NULL, &c, 4096));
+  TEST_TRUE(!empack_pool_acquire(&pool, NULL, &b, 10) && buffer_error(&b) == EM_ERROR_OVERFLOW);
+  empack_write_u8(&b, 1);
+  TEST_TRUE(b.pos == 0);
+
+  empack_pool_stats_snapshot(&pool, stats);
+  TEST_TRUE(stats[0].in_use == 2 && stats[0].high_water == 2 && stats[0].exhausted == 1);
+  TEST_TRUE(stats[1].in_use == 1 && stats[1].block_size == 8192);
+
+  // a thread cache recycles the same block without touching the stack
+  empack_pool_cache_init(&cache);
+  empack_pool_release(&pool, &cache, &a);
+  TEST_TRUE(a.buf == NULL && cache.count[0] == 1);
+  TEST_TRUE(empack_pool_acquire(&pool, &cache, &a, 10) && a.buf == first);
+  empack_write_u8(&a, 1);
+  empack_pool_release(&pool, &cache, &a);
+  empack_pool_release(&pool, &cache, &c);
+  empack_pool_cache_flush(&pool, &cache);
+
+  empack_pool_stats_snapshot(&pool, stats);
+  TEST_TRUE(stats[0].in_use == 0 && stats[0].high_water == 2);
+  empack_pool_destroy(&pool);
+}
+
+#define TEST_QUEUE_MESSAGES 20000
+
+struct test_queue_producer {
+  empack_queue_t* q;
+  uint32_t id;
+};
+
+// sends [id, seq] for seq in 0..TEST_QUEUE_MESSAGES, retrying while full
+static void* test_queue_producer(void* arg)
+{
+  struct test_queue_producer* p = arg;
+  empack_queue_slot_t slot;
+
+  for (uint32_t seq = 0; seq < TEST_QUEUE_MESSAGES; seq++) {
+    while (!empack_queue_reserve(p->q, &slot, 16))
+      sched_yield();
+    empack_write_array_start(&slot.buf, 2);
+    empack_write_u32(&slot.buf, p->id);
+    empack_write_u32(&slot.buf, seq);
+    empack_queue_publish(p->q, &slot);
+  }
+
+  return NULL;
+}
+
+// every producer's messages arrive once each and in order
+static bool test_queue_threads(bool multi_producer, uint32_t producers)
+{
+  static uint64_t storage[128];
+  struct test_queue_producer args[3];
+  pthread_t threads[3];
+  uint32_t next[3] = { 0 }, received = 0, n, size = 0, id;
+  empack_queue_t q;
+  buffer_t frames[8];
+  uint64_t u = 0;
+  bool ordered = true;
+
+  empack_queue_init(&q, (em_byte_t*)storage, sizeof(storage), multi_producer);
+  for (uint32_t i = 0; i < producers; i++) {
+    args[i] = (struct test_queue_producer) { &q, i };
+    pthread_create(&threads[i], NULL, test_queue_producer, &args[i]);
+  }
+
+  while (received < producers * TEST_QUEUE_MESSAGES && ordered) {
+    if ((n = empack_queue_dequeue(&q, frames, 8)) == 0)
+      sched_yield();
+    for (uint32_t k = 0; k < n; k++) {
+      ordered = ordered && empack_read_array_size(&frames[k], &size) && size == 2
+        && empack_read_uint(&frames[k], (em_byte_t*)&u, 8) && u < producers;
+      id = (uint32_t)u;
+      ordered = ordered && empack_read_uint(&frames[k], (em_byte_t*)&u, 8) && u == next[id]++;
+      received++;
+    }
+    empack_queue_release(&q);
+  }
+
+  for (uint32_t i = 0; i < producers; i++)
+    pthread_join(threads[i], NULL);
+
+  return ordered && received == producers * TEST_QUEUE_MESSAGES && empack_queue_dequeue(&q, frames, 8) == 0;
+}
+
+static void test_queue()
+{
+  uint64_t storage[32];
+  empack_queue_t q;
+  empack_queue_slot_t slot, late;
+  buffer_t frames[4];
+  uint64_t u = 0;
+
+  TEST_TRUE(!empack_queue_init(&q, (em_byte_t*)storage, 100, false));
+  TEST_TRUE(SIZE_MAX < (uint64_t)1 << 32 || !empack_queue_init(&q, (em_byte_t*)storage, (size_t)((uint64_t)1 << 32), false));
+  TEST_TRUE(empack_queue_init(&q, (em_byte_t*)storage, sizeof(storage), false));
+
+  // producers encode in place, consumers read views into the ring
+  for (uint32_t i = 0; i < 3; i++) {
+    TEST_TRUE(empack_queue_reserve(&q, &slot, 64));
+    empack_write_u32(&slot.buf, 1000 + i);
+    empack_queue_publish(&q, &slot);
+  }
+  TEST_TRUE(empack_queue_dequeue(&q, frames, 4) == 3);
+  TEST_TRUE(frames[2].len == 3 && frames[2].buf > (em_byte_t*)storage && frames[2].buf < (em_byte_t*)(storage + 32));
+  TEST_TRUE(empack_read_uint(&frames[2], (em_byte_t*)&u, 8) && u == 1002);
+  TEST_TRUE(empack_queue_dequeue(&q, frames, 4) == 0);
+  empack_queue_release(&q);
+
+  // a full ring refuses, and frames wrap to stay contiguous
+  TEST_TRUE(empack_queue_reserve(&q, &slot, 200));
+  buffer_write(&slot.buf, (em_byte_t*)storage, 200);
+  empack_queue_publish(&q, &slot);
+  TEST_TRUE(!empack_queue_reserve(&q, &slot, 64) && buffer_error(&slot.buf) == EM_ERROR_OVERFLOW);
+  TEST_TRUE(empack_queue_dequeue(&q, frames, 4) == 1 && frames[0].len == 200);
+  empack_queue_release(&q);
+  TEST_TRUE(empack_queue_reserve(&q, &slot, 200));
+  buffer_write(&slot.buf, (em_byte_t*)storage, 200);
+  empack_queue_publish(&q, &slot);
+  TEST_TRUE(empack_queue_dequeue(&q, frames, 4) == 1);
+  empack_queue_release(&q);
+  TEST_TRUE(empack_queue_reserve(&q, &slot, 64) && slot.buf.buf == (em_byte_t*)storage + 8);
+  empack_write_nil(&slot.buf);
+  empack_queue_publish(&q, &slot);
+  TEST_TRUE(empack_queue_dequeue(&q, frames, 4) == 1 && frames[0].len == 1);
+  TEST_TRUE(empack_read_nil(&frames[0]));
+  empack_queue_release(&q);
+  TEST_TRUE(!empack_queue_reserve(&q, &slot, 512) && buffer_error(&slot.buf) == EM_ERROR_TOO_BIG);
+
+  // a lone producer holds one reservation at a time
+  TEST_TRUE(empack_queue_reserve(&q, &slot, 16));
+  TEST_TRUE(!empack_queue_reserve(&q, &late, 16) && buffer_error(&late.buf) == EM_ERROR_OVERFLOW);
+  empack_write_u8(&slot.buf, 5);
+  empack_queue_publish(&q, &slot);
+  TEST_TRUE(empack_queue_reserve(&q, &late, 16));
+  empack_queue_publish(&q, &late);
+  TEST_TRUE(empack_queue_dequeue(&q, frames, 4) == 2 && frames[0].buf[0] == 5 && frames[1].len == 0);
+  empack_queue_release(&q);
+
+  // with several producers frames show up in claim order, failed ones never
+  TEST_TRUE(empack_queue_init(&q, (em_byte_t*)storage, sizeof(storage), true));
+  TEST_TRUE(empack_queue_reserve(&q, &slot, 16) && empack_queue_reserve(&q, &late, 16));
+  empack_write_u8(&late.buf, 2);
+  empack_write_bin(&slot.buf, (em_byte_t*)storage, 100);
+  empack_queue_publish(&q, &slot);
+  empack_queue_publish(&q, &late);
+  TEST_TRUE(empack_queue_dequeue(&q, frames, 4) == 1 && frames[0].len == 1 && frames[0].buf[0] == 2);
+  empack_queue_release(&q);
+
+  TEST_TRUE(test_queue_threads(false, 1));
+  TEST_TRUE(test_queue_threads(true, 3));
+}
+
+static void test_ring()
+{
+  empack_ring_t ring;
+  buffer_t b;
+  size_t space;
+  uint64_t u = 0;
+  uint32_t total = 0, seen = 0;
+  bool in_order = true;
+
+  TEST_TRUE(empack_ring_init(&ring, 4096));
+  TEST_TRUE(ring.capacity >= 4096 && empack_ring_write_ptr(&ring, &space) == ring.buf && space == ring.capacity);
+
+  // bursts of small messages, consumed whole, until the ring has wrapped
+  while (total < 3 * ring.capacity / 5) {
+    empack_ring_writer(&ring, &b);
+    for (int i = 0; i < 100 && b.len - b.pos >= 5; i++)
+      empack_write_u32(&b, total++);
+    empack_ring_commit(&ring, &b);
+
+    // leave a partial message behind each time
+    empack_ring_reader(&ring, &b);
+    while (b.len - b.pos > 5)
+      in_order &= empack_read_uint(&b, (em_byte_t*)&u, 8) && u == seen++;
+    empack_ring_consume(&ring, &b);
+  }
+  TEST_TRUE(in_order && seen == total - 1);
+
+  empack_ring_reader(&ring, &b);
+  TEST_TRUE(empack_read_uint(&b, (em_byte_t*)&u, 8) && u == seen && b.pos == b.len);
+  empack_ring_consume(&ring, &b);
+  TEST_TRUE(empack_ring_size(&ring) == 0 && ring.read < ring.capacity);
+
+  // a full ring hands out no room, and failed writes commit nothing
+  empack_ring_write_ptr(&ring, &space);
+  empack_ring_produce(&ring, space);
+  empack_ring_writer(&ring, &b);
+  empack_write_nil(&b);
+  empack_ring_commit(&ring, &b);
+  TEST_TRUE(buffer_error(&b) == EM_ERROR_OVERFLOW && empack_ring_size(&ring) == ring.capacity);
+  empack_ring_destroy(&ring);
+}
+
+// sorted by "ts", unkeyed records last, ties in "n" order
+static bool test_sort_ordered(buffer_t* b, uint32_t records)
+{
+  empack_type_t skip_type;
+  empack_cursor_t c;
+  buffer_t rec;
+  bool ordered = true, missing = false, last_missing = false;
+  int64_t key = 0, last_key = INT64_MIN;
+  uint64_t n = 0, last_n = 0;
+  uint32_t map_size, count = 0;
+
+  while (b->pos < b->len && ordered) {
+    missing = !empack_index_record_key(b, "ts", 2, &key);
+    rec = *b;
+    empack_cursor_init(&c, &rec);
+    ordered = empack_cursor_enter_map(&c, &map_size) && empack_cursor_find_key(&c, "n", 1)
+      && empack_cursor_read_uint(&c, &n);
+
+    if (count > 0 && missing == last_missing && (missing || key == last_key))
+      ordered = ordered && n > last_n;
+    else if (count > 0)
+      ordered = ordered && (missing ? !last_missing : !last_missing && key > last_key);
+
+    last_missing = missing;
+    last_key = key;
+    last_n = n;
+    count++;
+    ordered = ordered && empack_next_skip(b, &skip_type);
+  }
+
+  return ordered && count == records;
+}
+
+static void test_sort()
+{
+  const uint32_t records = 4000;
+  em_byte_t* in = malloc(65535);
+  em_byte_t* sorted = malloc(65535);
+  em_byte_t* read = malloc(65535);
+  empack_sort_options_t opts = { "ts", 2, 0, 3, NULL };
+  em_byte_t pad[700] = { 0 };
+  buffer_t b, out;
+  char in_path[256], out_path[256], tmp_dir[256];
+  FILE* f;
+  size_t size = 0;
+
+  // duplicate keys, every 97th record unkeyed and one longer than a run
+  buffer_init(&b, in, 65535);
+  for (uint32_t i = 0; i < records; i++) {
+    empack_write_map_start(&b, i == 3900 ? 3 : 2);
+    empack_write_string(&b, (em_byte_t*)"n", 1);
+    empack_write_u32(&b, i);
+    if (i % 97 == 0) {
+      empack_write_string(&b, (em_byte_t*)"x", 1);
+      empack_write_nil(&b);
+    } else {
+      empack_write_string(&b, (em_byte_t*)"ts", 2);
+      empack_write_i64(&b, (int64_t)(i * 7919 % 500) - 250);
+    }
+    if (i == 3900) {
+      empack_write_string(&b, (em_byte_t*)"pad", 3);
+      empack_write_bin(&b, pad, sizeof(pad));
+    }
+  }
+  TEST_TRUE(!buffer_error(&b));
+
+  buffer_init(&b, in, b.max);
+  buffer_init(&out, sorted, 65535);
+  TEST_TRUE(empack_sort_buffer(&b, &out, &opts) && out.pos == b.len);
+  buffer_init(&out, sorted, b.len);
+  TEST_TRUE(test_sort_ordered(&out, records));
+
+  buffer_init(&out, sorted, 100);
+  buffer_init(&b, in, b.len);
+  TEST_TRUE(!empack_sort_buffer(&b, &out, &opts) && buffer_error(&out) == EM_ERROR_OVERFLOW);
+
+  test_tmp_path(in_path, sizeof(in_path), "empack_test_sort.in");
+  test_tmp_path(out_path, sizeof(out_path), "empack_test_sort.out");
+  snprintf(tmp_dir, sizeof(tmp_dir), "%s", test_tmp_dir());
+
+  // small runs spill over a hundred files, so the merge takes two passes
+  f = fopen(in_path, "wb");
+  TEST_TRUE(f != NULL && fwrite(in, 1, b.len, f) == b.len && fclose(f) == 0);
+
+  opts.run_size = 256;
+  opts.tmp_dir = tmp_dir;
+  TEST_TRUE(empack_sort_file(in_path, out_path, &opts));
+  f = fopen(out_path, "rb");
+  TEST_TRUE(f != NULL && (size = fread(read, 1, 65535, f)) == b.len && memcmp(read, sorted, size) == 0);
+  if (f != NULL)
+    fclose(f);
+
+  // one run needs no spill
+  opts.run_size = 0;
+  opts.tmp_dir = NULL;
+  opts.threads = 1;
+  TEST_TRUE(empack_sort_file(in_path, out_path, &opts));
+  f = fopen(out_path, "rb");
+  TEST_TRUE(f != NULL && (size = fread(read, 1, 65535, f)) == b.len && memcmp(read, sorted, size) == 0);
+  if (f != NULL)
+    fclose(f);
+
+  // a truncated last record fails the sort
+  f = fopen(in_path, "wb");
+  TEST_TRUE(f != NULL && fwrite(in, 1, b.len - 1, f) == (size_t)(b.len - 1) && fclose(f) == 0);
+  opts.run_size = 256;
+  TEST_TRUE(!empack_sort_file(in_path, out_path, &opts));
+
+  remove(in_path);
+  remove(out_path);
+  free(in);
+  free(sorted);
+  free(read);
+}
+
+static void test_template()
+{
+  em_byte_t consts[64], buf[MAX_TEST_BUFF], out[MAX_TEST_BUFF];
+  empack_fragment_t key, msg;
+  empack_slot_t seq, temp, delta;
+  buffer_t b, c;
+  uint32_t n = 0, str_size;
+  const char* str;
+  uint64_t u = 0;
+  int64_t i = 0;
+  double d = 0;
+
+  // constant keys are encoded once and appended with one copy
+  buffer_init(&c, consts, sizeof(consts));
+  empack_fragment_begin(&c, &key);
+  empack_write_string(&c, (em_byte_t*)"status", 6);
+  empack_fragment_end(&c, &key);
+  TEST_TRUE(key.data == consts && key.size == 7);
+
+  buffer_init(&b, buf, MAX_TEST_BUFF);
+  empack_write_u8(&b, 1);
+  empack_fragment_begin(&b, &msg);
+  empack_write_map_start(&b, 4);
+  empack_write_fragment(&b, &key);
+  empack_write_string(&b, (em_byte_t*)"ok", 2);
+  empack_write_string(&b, (em_byte_t*)"seq", 3);
+  empack_write_slot(&b, &msg, &seq, EMPACK_SLOT_U32);
+  empack_write_string(&b, (em_byte_t*)"temp", 4);
+  empack_write_slot(&b, &msg, &temp, EMPACK_SLOT_DOUBLE);
+  empack_write_string(&b, (em_byte_t*)"delta", 5);
+  empack_write_slot(&b, &msg, &delta, EMPACK_SLOT_I16);
+  empack_fragment_end(&b, &msg);
+  TEST_TRUE(!buffer_error(&b) && msg.data == buf + 1 && msg.size == 1 + 7 + 3 + 4 + 5 + 5 + 9 + 6 + 3);
+  TEST_TRUE((uint8_t)msg.data[seq.offset] == 0xCE && seq.offset == 15);
+
+  TEST_TRUE(empack_slot_set_uint(buf + 1, &seq, 70000));
+  TEST_TRUE(empack_slot_set_double(buf + 1, &temp, 21.5));
+  TEST_TRUE(empack_slot_set_sint(buf + 1, &delta, -300));
+
+  // slots keep their width and kind
+  TEST_TRUE(!empack_slot_set_sint(buf + 1, &seq, -1));
+  TEST_TRUE(!empack_slot_set_uint(buf + 1, &delta, 40000));
+  TEST_TRUE(!empack_slot_set_sint(buf + 1, &delta, -40000));
+  TEST_TRUE(!empack_slot_set_double(buf + 1, &seq, 1.0));
+  TEST_TRUE(!empack_slot_set_uint(buf + 1, &seq, 1ull << 32));
+
+  // a copy of the template is patched where it landed
+  buffer_init(&c, out, MAX_TEST_BUFF);
+  empack_write_fragment(&c, &msg);
+  TEST_TRUE(empack_slot_set_uint(out, &seq, 7) && empack_slot_set_sint(out, &delta, 12));
+  TEST_TRUE(c.pos == msg.size && memcmp(out, msg.data, seq.offset) == 0);
+
+  buffer_init(&c, out, c.pos);
+  TEST_TRUE(empack_read_map_size(&c, &n) && n == 4);
+  TEST_TRUE(empack_read_string_ref(&c, &str, &str_size) && str_size == 6 && memcmp(str, "status", 6) == 0);
+  TEST_TRUE(empack_read_string_ref(&c, &str, &str_size) && str_size == 2);
+  TEST_TRUE(empack_read_string_ref(&c, &str, &str_size) && empack_read_uint(&c, (em_byte_t*)&u, 8) && u == 7);
+  TEST_TRUE(empack_read_string_ref(&c, &str, &str_size) && empack_read_double(&c, &d) && d == 21.5);
+  TEST_TRUE(empack_read_string_ref(&c, &str, &str_size) && empack_read_sint(&c, (em_byte_t*)&i, 8) && i == 12);
+  TEST_TRUE(!buffer_error(&c) && c.pos == c.len);
+
+  buffer_init(&c, out, msg.size - 1);
+  empack_write_fragment(&c, &msg);
+  TEST_TRUE(buffer_error(&c) == EM_ERROR_OVERFLOW && c.pos == 0);
+
+  // a measured fragment has nothing to copy
+  buffer_init_measure(&c);
+  empack_fragment_begin(&c, &key);
+  empack_write_string(&c, (em_byte_t*)"status", 6);
+  empack_fragment_end(&c, &key);
+  empack_write_fragment(&c, &key);
+  TEST_TRUE(key.data == NULL && key.size == 7 && !buffer_error(&c) && c.pos == 14);
+  buffer_init(&c, out, MAX_TEST_BUFF);
+  empack_write_fragment(&c, &key);
+  TEST_TRUE(buffer_error(&c) == EM_ERROR_EOF && c.pos == 0);
+
+  // a float slot takes only doubles it holds exactly
+  buffer_init(&c, out, MAX_TEST_BUFF);
+  empack_fragment_begin(&c, &msg);
+  empack_write_slot(&c, &msg, &temp, EMPACK_SLOT_FLOAT);
+  empack_fragment_end(&c, &msg);
+  TEST_TRUE(empack_slot_set_double(out, &temp, 0.25) && empack_slot_set_double(out, &temp, NAN));
+  TEST_TRUE(empack_slot_set_double(out, &temp, -INFINITY));
+  TEST_TRUE(!empack_slot_set_double(out, &temp, 0.1) && !empack_slot_set_double(out, &temp, 1e300));
+  buffer_init(&c, out, msg.size);
+  TEST_TRUE(empack_read_double(&c, &d) && d == -INFINITY);
+}
+
+static void test_utf8()
+{
+  static const struct {
+    const char* bytes;
+    bool valid;
+  } seqs[] = {
+    { "\xc3\xa9", true },                 // 2 bytes
+    { "\xe2\x82\xac", true },             // 3 bytes
+    { "\xf0\x9f\x98\x80", true },         // 4 bytes
+    { "\xf4\x8f\xbf\xbf", true },         // U+10FFFF
+    { "\xc1\xbf", false },                // overlong 2
+    { "\xe0\x80\xaf", false },            // overlong 3
+    { "\xf0\x80\x80\xaf", false },        // overlong 4
+    { "\xed\xa0\x80", false },            // surrogate
+    { "\xf4\x90\x80\x80", false },        // past U+10FFFF
+    { "\xe2\x82", false },                // cut short by ascii
+    { "\x80", false },                    // stray continuation
+    { "\xc3\xa9\xa9", false },             // one continuation too many
+    { "\xff", false },
+  };
+  em_byte_t buf[MAX_TEST_BUFF];
+  em_byte_t field[64];
+  char text[96];
+  const char* str;
+  uint32_t str_size;
+  buffer_t b;
+
+  // long enough to take the vector path, with a 4 byte sequence across the 16 and 32 byte boundaries
+  const char* good = "plain ascii text.\xc3\xa9t\xc3\xa9 \xe2\x82\xac" "5 ......\xf0\x9f\x98\x80 and more ascii";
+  TEST_TRUE(empack_utf8_valid((em_byte_t*)good, strlen(good)));
+  TEST_TRUE(!empack_utf8_valid((em_byte_t*)"\xc0\x80", 2));
+  TEST_TRUE(!empack_utf8_valid((em_byte_t*)"0123456789abcdef0123456789abcdef\xed\xa0\x80", 35));
+  TEST_TRUE(!empack_utf8_valid((em_byte_t*)"0123456789abcdef0123456789abcde\xf4\x90\x80\x80", 35));
+  TEST_TRUE(!empack_utf8_valid((em_byte_t*)"0123456789abcdef0123456789abcd\xe2\x82", 32));
+
+  // every validator this machine has agrees on each sequence at every
+  // offset across the 16, 32 and 48 byte block boundaries
+  for (int impl = EMPACK_UTF8_SCALAR; impl <= EMPACK_UTF8_AVX2; impl++) {
+    bool agree = true, ends = true;
+
+    if (!empack_utf8_has_impl((empack_utf8_impl_t)impl))
+      continue;
+
+    for (size_t k = 0; k < sizeof(seqs) / sizeof(seqs[0]); k++) {
+      size_t len = strlen(seqs[k].bytes);
+      for (size_t off = 0; off + len <= 64; off++) {
+        memset(field, 'a', sizeof(field));
+        memcpy(field + off, seqs[k].bytes, len);
+        agree &= empack_utf8_valid_impl((empack_utf8_impl_t)impl, field, sizeof(field)) == seqs[k].valid;
+        agree &= empack_utf8_valid(field, sizeof(field)) == seqs[k].valid;
+      }
+    }
+    TEST_TRUE(agree);
+
+    // a sequence cut short by the end of the string, on and off a block end
+    for (size_t end = 3; end <= 64; end++) {
+      memset(field, 'a', sizeof(field));
+      memcpy(field + end - 3, "\xf0\x9f\x98", 3);
+      ends &= !empack_utf8_valid_impl((empack_utf8_impl_t)impl, field, end);
+      ends &= empack_utf8_valid_impl((empack_utf8_impl_t)impl, field, end - 3);
+    }
+    TEST_TRUE(ends);
+  }
+
+  buffer_init(&b, buf, MAX_TEST_BUFF);
+  empack_write_string(&b, (em_byte_t*)good, strlen(good));
+  empack_write_string(&b, (em_byte_t*)"bad \xff", 5);
+  buffer_init(&b, buf, b.max);
+
+  TEST_TRUE(empack_read_string_utf8(&b, text, sizeof(text), &str_size) && str_size == strlen(good));
+  TEST_TRUE(memcmp(text, good, str_size) == 0);
+  TEST_TRUE(!empack_read_string_ref_utf8(&b, &str, &str_size) && buffer_error(&b) == EM_ERROR_UTF8);
+  TEST_TRUE(buffer_error_pos(&b) == b.pos && (uint8_t)buf[b.pos] == 'b');
+}
+
+#ifdef EMPACK_STATS
+static void test_stats()
+{
+  em_byte_t buf[MAX_TEST_BUFF];
+  buffer_t buffer;
+  struct empack_stats stats;
+  empack_type_t type;
+
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_write_array_start(&buffer, 3);
+  empack_write_u64(&buffer, 1);
+  empack_write_u64(&buffer, 0x10000);
+  empack_write_string(&buffer, "abc", 3);
+
+  buffer_stats_snapshot(&buffer, &stats);
+  TEST_TRUE(stats.values[EMPACK_STAT_ARRAY][EMPACK_STAT_FIX] == 1);
+  TEST_TRUE(stats.values[EMPACK_STAT_UINT][EMPACK_STAT_FIX] == 1);
+  TEST_TRUE(stats.values[EMPACK_STAT_UINT][EMPACK_STAT_32] == 1);
+  TEST_TRUE(stats.values[EMPACK_STAT_UINT][EMPACK_STAT_16] == 0);
+  TEST_TRUE(stats.bytes[EMPACK_STAT_UINT] == 6);
+  TEST_TRUE(stats.bytes[EMPACK_STAT_STRING] == 4);
+
+  // [[nil]] read back through a buffer that is one byte short
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_write_array_start(&buffer, 1);
+  empack_write_array_start(&buffer, 1);
+  empack_write_nil(&buffer);
+  buffer_init(&buffer, buf, 3);
+  TEST_TRUE(empack_next_skip(&buffer, &type));
+  buffer_stats_snapshot(&buffer, &stats);
+  TEST_TRUE(stats.max_depth == 2 && stats.depth == 0);
+  TEST_TRUE(stats.values[EMPACK_STAT_NIL][EMPACK_STAT_FIX] == 1);
+
+  // a uint16 cut short after its first byte
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_write_u16(&buffer, 0x1234);
+  buffer_init(&buffer, buf, 2);
+  TEST_TRUE(!empack_next_skip(&buffer, &type));
+  buffer_stats_snapshot(&buffer, &stats);
+  TEST_TRUE(stats.bounds_failures == 1);
+
+  // skipped ext payloads count like read ones
+  buffer_init(&buffer, buf, MAX_TEST_BUFF);
+  empack_write_ext(&buffer, 5, (em_byte_t*)"abcd", 4);
+  buffer_init(&buffer, buf, buffer.pos);
+  TEST_TRUE(empack_next_skip(&buffer, &type) && type == EMPACK_EXT);
+  buffer_stats_snapshot(&buffer, &stats);
+  TEST_TRUE(stats.bytes[EMPACK_STAT_EXT] == 6);
+
+  buffer_stats_reset(&buffer);
+  buffer_stats_snapshot(&buffer, &stats);
+  TEST_TRUE(stats.bounds_failures == 0 && stats.max_depth == 0);
 }
+#endif
 
 int main()
 {
   test_write_simple_auto_int();
+  test_read_sint_unsigned();
   test_write_basic_structures();
+  test_next_funcs();
+  test_read_cursor();
+  test_sticky_errors();
+  test_savepoint();
+  test_view();
+  test_wide_lengths();
+  test_numbers();
+  test_sizes();
+  test_ext();
+  test_frame();
+  test_keydict();
+  test_columnar();
+  test_hash();
+  test_index();
+  test_intern();
+  test_edit();
+  test_pool();
+  test_queue();
+  test_ring();
+  test_sort();
+  test_template();
+  test_utf8();
+#ifdef EMPACK_STATS
+  test_stats();
+#endif
 
   printf("\n\nUnit testing complete. %i failures in %i checks.\n\n\n", tests - passes, tests);
   return (passes == tests) ? EXIT_SUCCESS : EXIT_FAILURE;
@@ -0,0 +1,124 @@
+/**
+ * Copyright (C) 2018 Jaremy Creechley
+ *
+ */
+
+#include <cstdio>
+#include <cstdlib>
+
+#include "empack.hpp"
+
+#define TEST_TRUE(expr) test_true_impl((expr), __FILE__, __LINE__)
+
+static int tests;
+static int passes;
+
+static void test_true_impl(bool result, const char* file, int line)
+{
+  ++tests;
+  if (result) {
+    ++passes;
+  } else {
+    std::printf("TEST FAILED AT %s:%i\n", file, line);
+    std::abort();
+  }
+}
+
+struct point {
+  int32_t x;
+  int32_t y;
+  std::optional<float> weight;
+
+  EMPACK_FIELDS(x, y, weight)
+};
+
+struct shape {
+  std::string name;
+  std::vector<point> points;
+  std::variant<std::monostate, uint8_t, std::string> tag;
+
+  EMPACK_FIELDS(name, points, tag)
+};
+
+static_assert(empack::max_size<point>() == 1 + 5 + 5 + 5);
+static_assert(empack::max_size<std::variant<bool, uint16_t>>() == 1 + 5 + 3);
+
+static void test_scalars()
+{
+  em_byte_t buf[256];
+  buffer_t b;
+
+  buffer_init(&b, buf, sizeof(buf));
+  empack::pack(b, uint64_t(5));
+  empack::pack(b, int16_t(-300));
+  empack::pack(b, 2.5);
+  empack::pack(b, "hi");
+  empack::pack(b, nullptr);
+  TEST_TRUE(buffer_error(&b) == EM_OK && (uint8_t)buf[0] == 0x05);
+
+  buffer_init(&b, buf, b.max);
+  TEST_TRUE(empack::unpack<uint8_t>(b) == 5);
+  TEST_TRUE(empack::unpack<int32_t>(b) == -300);
+  TEST_TRUE(empack::unpack<double>(b) == 2.5);
+  std::string_view s = empack::unpack<std::string_view>(b);
+  TEST_TRUE(s == "hi" && s.data() == (const char*)buf + b.pos - 2);
+  TEST_TRUE(empack::unpack<std::nullptr_t>(b) == nullptr && buffer_error(&b) == EM_OK);
+
+  // out of range ints latch an error instead of truncating
+  buffer_init(&b, buf, 1);
+  buf[0] = (em_byte_t)0xFF;
+  uint8_t u;
+  TEST_TRUE(!empack::unpack(b, u) && buffer_error(&b) == EM_ERROR_TOO_BIG);
+}
+
+static void test_structs()
+{
+  em_byte_t buf[256];
+  buffer_t b;
+  shape in { "tri", { { 1, 2, 0.5f }, { 3, -4, std::nullopt } }, std::string("red") };
+  shape out;
+
+  buffer_init(&b, buf, sizeof(buf));
+  empack::pack(b, in);
+  TEST_TRUE(buffer_error(&b) == EM_OK);
+
+  buffer_init(&b, buf, b.max);
+  TEST_TRUE(empack::unpack(b, out) && b.pos == b.len);
+  TEST_TRUE(out.name == "tri" && out.points.size() == 2);
+  TEST_TRUE(out.points[0].weight == 0.5f && !out.points[1].weight && out.points[1].y == -4);
+  TEST_TRUE(std::get<std::string>(out.tag) == "red");
+
+  std::vector<uint8_t> bytes { 1, 2, 3 };
+  buffer_init(&b, buf, sizeof(buf));
+  empack::pack(b, bytes);
+  TEST_TRUE((uint8_t)buf[0] == 0xC4 && b.pos == 5);
+#ifdef EMPACK_HAS_SPAN
+  buffer_init(&b, buf, b.max);
+  std::span<const uint8_t> view = empack::unpack<std::span<const uint8_t>>(b);
+  TEST_TRUE(view.size() == 3 && view[2] == 3 && (const em_byte_t*)view.data() == buf + 2);
+
+  // a mutable span packs as bin too, and reads back through a const one
+  std::span<uint8_t> mut(bytes);
+  buffer_init(&b, buf, sizeof(buf));
+  empack::pack(b, mut);
+  buffer_init(&b, buf, b.max);
+  TEST_TRUE(empack::unpack<std::vector<uint8_t>>(b) == bytes);
+  buffer_init(&b, buf, b.len);
+  TEST_TRUE(empack::unpack(b, view) && view.size() == 3 && view[0] == 1);
+#endif
+
+  // structs with a different field count are rejected
+  buffer_init(&b, buf, sizeof(buf));
+  empack::pack(b, std::vector<int> { 1, 2 });
+  buffer_init(&b, buf, b.max);
+  TEST_TRUE(!empack::unpack(b, out.points.emplace_back()) && buffer_error(&b) == EM_ERROR_TYPE);
+}
+
+int main()
+{
+  test_scalars();
+  test_structs();
+
+  std::printf("\n\nUnit testing complete. %i failures in %i checks.\n\n\n", tests - passes, tests);
+  return (passes == tests) ? EXIT_SUCCESS : EXIT_FAILURE;
+}